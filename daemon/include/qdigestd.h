@@ -0,0 +1,119 @@
+/*! \file qdigestd.h
+ *  \brief Wire protocol and client calls of qdigestd, the local
+ *  aggregation daemon.
+ *
+ *  Producers on the same machine send batches of values to one daemon
+ *  over a UNIX stream socket instead of each keeping its own digests.
+ *  The daemon keeps one digest per key and answers percentile queries.
+ *
+ *  Every request is a struct QdRequest followed by `key_len` key bytes
+ *  and `n` 8-byte items: values (uint64_t) for QD_OP_INSERT, percentiles
+ *  (double) for QD_OP_QUERY. Inserts are not answered; a query is
+ *  answered with a struct QdReply followed by `n` uint64_t values.
+ *  Values above QD_MAX_VALUE are a protocol error: the daemon closes
+ *  the connection, dropping the batch, and keeps serving the others.
+ *  Requests on one connection are handled in order, so a query sees the
+ *  inserts sent before it on the same connection.
+ *
+ *  Integers are in the byte order of the machine, which the daemon and
+ *  its producers share.
+ *
+ */
+
+#ifndef QDIGESTD
+#define QDIGESTD
+#include <stddef.h>
+#include <stdint.h>
+
+/** Socket path used when none is given. */
+#define QD_DEFAULT_SOCKET "/tmp/qdigestd.sock"
+
+/** Longest key accepted. */
+#define QD_MAX_KEY 255
+
+/** Most items in one request. */
+#define QD_MAX_BATCH 65536
+
+/** Largest value accepted, so that the universe of a digest, a power of
+ *  two, still fits in a size_t. */
+#define QD_MAX_VALUE (SIZE_MAX >> 1)
+
+/** Request codes. */
+enum QdOp {
+  QD_OP_INSERT = 1,             /**< Insert `n` values into the digest of the key. */
+  QD_OP_QUERY = 2               /**< Ask for `n` percentiles of the digest of the key. */
+};
+
+/** Reply status codes. */
+enum QdStatus {
+  QD_OK = 0,                    /**< The percentiles follow. */
+  QD_NOT_FOUND = 1,             /**< No value was ever inserted for the key. */
+  QD_INVALID = 2                /**< A percentile was NaN or infinite. */
+};
+
+/**
+ *  @brief The fixed part of a request.
+ */
+struct QdRequest {
+  uint32_t op;                  /**< One of enum QdOp. */
+  uint32_t key_len;             /**< Key length in bytes, at most QD_MAX_KEY. */
+  uint64_t n;                   /**< Number of items, at most QD_MAX_BATCH. */
+};
+
+/**
+ *  @brief The fixed part of a reply to QD_OP_QUERY.
+ */
+struct QdReply {
+  uint32_t status;              /**< One of enum QdStatus. */
+  uint32_t reserved;            /**< Always 0. */
+  uint64_t N;                   /**< Total count of the digest. */
+  uint64_t n;                   /**< Number of percentiles that follow. */
+};
+
+/**
+ *  @brief Connects to a daemon.
+ *
+ *  @param path The socket path, or NULL for QD_DEFAULT_SOCKET.
+ *
+ *  @return A connected socket, or -1 with errno set.
+ */
+int qd_connect(const char *path);
+
+/**
+ *  @brief Sends values to be inserted into the digest of `key`,
+ *  split into requests of at most QD_MAX_BATCH values.
+ *
+ *  @param fd A socket returned by qd_connect().
+ *  @param key The NUL-terminated key, at most QD_MAX_KEY bytes.
+ *  @param values The values, at most QD_MAX_VALUE.
+ *  @param n The number of values.
+ *
+ *  @return 0, or -1 if the key is too long, a value is out of range or
+ *  the socket failed. Nothing is sent for an out of range value.
+ */
+int qd_insert(int fd, const char *key, const uint64_t *values, size_t n);
+
+/**
+ *  @brief Asks for percentiles of the digest of `key`.
+ *
+ *  @param fd A socket returned by qd_connect().
+ *  @param key The NUL-terminated key, at most QD_MAX_KEY bytes.
+ *  @param ps The percentiles, in [0, 1]; values outside are clamped.
+ *  @param n The number of percentiles, at most QD_MAX_BATCH.
+ *  @param out Receives the `n` values.
+ *  @param N Receives the total count of the digest, if not NULL.
+ *
+ *  @return QD_OK, QD_NOT_FOUND, QD_INVALID if a percentile is not
+ *  finite, or -1 if the request is invalid or the socket failed.
+ */
+int qd_query(int fd, const char *key, const double *ps, size_t n,
+             uint64_t *out, uint64_t *N);
+
+/**
+ *  @brief Closes a socket returned by qd_connect().
+ *
+ *  @param fd The socket.
+ */
+void qd_close(int fd);
+
+#endif
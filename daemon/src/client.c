@@ -0,0 +1,123 @@
+#include "../include/qdigestd.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int qd_connect(const char *path) {
+    if (!path)
+        path = QD_DEFAULT_SOCKET;
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+void qd_close(int fd) {
+    close(fd);
+}
+
+/* Writes all of iov, resuming after short writes. A daemon gone away
+ * is reported as an error rather than raising SIGPIPE. */
+static int write_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t k = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)k >= iov->iov_len) {
+            k -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + k;
+            iov->iov_len -= k;
+        }
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t k = read(fd, p, len);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return -1;
+        p += k;
+        len -= k;
+    }
+    return 0;
+}
+
+static int send_request(int fd, uint32_t op, const char *key, const void *items,
+                        size_t n) {
+    struct QdRequest req = {op, (uint32_t)strlen(key), n};
+    struct iovec iov[3] = {
+        {&req, sizeof(req)},
+        {(void *)key, req.key_len},
+        {(void *)items, n * 8},
+    };
+    return write_all(fd, iov, 3);
+}
+
+int qd_insert(int fd, const char *key, const uint64_t *values, size_t n) {
+    if (strlen(key) > QD_MAX_KEY)
+        return -1;
+    for (size_t i = 0; i < n; i++)
+        if (values[i] > QD_MAX_VALUE)
+            return -1;
+    while (n > 0) {
+        const size_t batch = n < QD_MAX_BATCH ? n : QD_MAX_BATCH;
+        if (send_request(fd, QD_OP_INSERT, key, values, batch) < 0)
+            return -1;
+        values += batch;
+        n -= batch;
+    }
+    return 0;
+}
+
+int qd_query(int fd, const char *key, const double *ps, size_t n,
+             uint64_t *out, uint64_t *N) {
+    if (strlen(key) > QD_MAX_KEY || n > QD_MAX_BATCH)
+        return -1;
+    if (send_request(fd, QD_OP_QUERY, key, ps, n) < 0)
+        return -1;
+    struct QdReply reply;
+    if (read_all(fd, &reply, sizeof(reply)) < 0)
+        return -1;
+    if (reply.status == QD_OK && reply.n != n)
+        return -1;
+    if (reply.status == QD_OK && read_all(fd, out, n * sizeof(uint64_t)) < 0)
+        return -1;
+    if (N)
+        *N = reply.N;
+    return (int)reply.status;
+}
@@ -0,0 +1,105 @@
+/* qdigest-cli: a command line producer and client of qdigestd.
+ *
+ * Usage:
+ *   qdigest-cli [-s socket] insert KEY [VALUE...]
+ *       Inserts the values, or the values read from stdin if none are
+ *       given, into the digest of KEY.
+ *   qdigest-cli [-s socket] query KEY P...
+ *       Prints "P VALUE" for every percentile P in [0, 1], after a
+ *       "N <count>" line. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/qdigestd.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s socket] insert KEY [VALUE...]\n"
+                    "       %s [-s socket] query KEY P...\n", prog, prog);
+    return 1;
+}
+
+/* Values read from stdin, sent in batches of QD_MAX_BATCH */
+static int insert_stdin(int fd, const char *key) {
+    uint64_t *values = malloc(QD_MAX_BATCH * sizeof(uint64_t));
+    if (!values)
+        return -1;
+    size_t n = 0;
+    unsigned long long v;
+    int rc = 0;
+    while (rc == 0 && scanf("%llu", &v) == 1) {
+        values[n++] = v;
+        if (n == QD_MAX_BATCH) {
+            rc = qd_insert(fd, key, values, n);
+            n = 0;
+        }
+    }
+    if (rc == 0 && n > 0)
+        rc = qd_insert(fd, key, values, n);
+    free(values);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt != 's')
+            return usage(argv[0]);
+        path = optarg;
+    }
+    if (argc - optind < 2)
+        return usage(argv[0]);
+    const char *cmd = argv[optind];
+    const char *key = argv[optind + 1];
+    char **args = argv + optind + 2;
+    const size_t n = argc - optind - 2;
+
+    int fd = qd_connect(path);
+    if (fd < 0) {
+        fprintf(stderr, "qdigest-cli: cannot connect: %s\n", strerror(errno));
+        return 1;
+    }
+    int rc = 0;
+    if (strcmp(cmd, "insert") == 0) {
+        if (n == 0) {
+            rc = insert_stdin(fd, key);
+        } else {
+            uint64_t *values = malloc(n * sizeof(uint64_t));
+            for (size_t i = 0; i < n; i++)
+                values[i] = strtoull(args[i], NULL, 10);
+            rc = qd_insert(fd, key, values, n);
+            free(values);
+        }
+    } else if (strcmp(cmd, "query") == 0 && n > 0) {
+        double *ps = malloc(n * sizeof(double));
+        uint64_t *out = malloc(n * sizeof(uint64_t));
+        uint64_t N;
+        for (size_t i = 0; i < n; i++)
+            ps[i] = strtod(args[i], NULL);
+        rc = qd_query(fd, key, ps, n, out, &N);
+        if (rc == QD_OK) {
+            printf("N %llu\n", (unsigned long long)N);
+            for (size_t i = 0; i < n; i++)
+                printf("%g %llu\n", ps[i], (unsigned long long)out[i]);
+        } else if (rc == QD_NOT_FOUND) {
+            fprintf(stderr, "qdigest-cli: no such key: %s\n", key);
+        } else if (rc == QD_INVALID) {
+            fprintf(stderr, "qdigest-cli: percentiles must be finite\n");
+        }
+        free(ps);
+        free(out);
+    } else {
+        qd_close(fd);
+        return usage(argv[0]);
+    }
+    qd_close(fd);
+    if (rc < 0)
+        fprintf(stderr, "qdigest-cli: request failed\n");
+    return rc != 0;
+}
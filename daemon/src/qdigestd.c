@@ -0,0 +1,459 @@
+/* qdigestd: a local aggregation daemon.
+ *
+ * Producers connect to a UNIX stream socket and send batches of values
+ * per key (see qdigestd.h); the daemon keeps one digest per key and
+ * answers percentile queries.
+ *
+ * The main thread runs an epoll loop that only accepts connections and
+ * hands readable ones to a pool of worker threads. Connections are
+ * registered with EPOLLONESHOT, so each one is served by a single
+ * worker at a time and its requests are handled in order; the worker
+ * re-arms it once it has drained what was readable.
+ *
+ * The digests live in QDigestStores, one per bucket, each bucket with
+ * its own mutex; a key always maps to the same bucket, so workers
+ * inserting into different keys rarely wait for each other. An insert
+ * batch is sorted and its duplicates folded before it is handed to
+ * insert_histogram(), which compresses once per batch.
+ *
+ * Usage: qdigestd [-s socket] [-w workers] [-k K] [-u upper_bound] */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/memory_utils.h"
+#include "../../include/qcore.h"
+#include "../../include/qstore.h"
+#include "../include/qdigestd.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DEFAULT_WORKERS 4
+#define DEFAULT_K 100
+#define DEFAULT_UPPER_BOUND 1023
+
+/* Buckets per worker, so that workers seldom contend for one */
+#define BUCKETS_PER_WORKER 4
+
+/* Bytes read from one connection before it goes back to epoll */
+#define READ_QUANTUM (1 << 20)
+
+#define MAX_EVENTS 64
+
+/* How long a reply may wait for a client that does not read it */
+#define SEND_TIMEOUT_MS 5000
+
+/* A client connection and the bytes of its incomplete request */
+struct Conn {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/* A group of keys and their digests */
+struct Bucket {
+    pthread_mutex_t lock;
+    struct QDigestStore *store;
+};
+
+/* Scratch space of a worker, sized for the largest batch */
+struct Scratch {
+    uint64_t *values;
+    size_t *keys;
+    uint64_t *weights;
+};
+
+struct Server {
+    int epfd;
+    int listen_fd;
+    struct Bucket *buckets;
+    size_t n_buckets;
+    // connections ready to be served, a ring guarded by `lock`
+    struct Conn **ready;
+    size_t head;
+    size_t len;
+    size_t cap;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    bool stopping;
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t hash_key(const char *key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *key; key++)
+        h = (h ^ (unsigned char)*key) * 0x100000001b3ULL;
+    return h;
+}
+
+static void push_ready(struct Server *s, struct Conn *c) {
+    pthread_mutex_lock(&s->lock);
+    if (s->len == s->cap) {
+        struct Conn **ready = xmalloc(2 * s->cap * sizeof(struct Conn *));
+        for (size_t i = 0; i < s->len; i++)
+            ready[i] = s->ready[(s->head + i) % s->cap];
+        free(s->ready);
+        s->ready = ready;
+        s->head = 0;
+        s->cap *= 2;
+    }
+    s->ready[(s->head + s->len++) % s->cap] = c;
+    pthread_cond_signal(&s->nonempty);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* The next connection to serve, NULL once the server stops */
+static struct Conn *pop_ready(struct Server *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->len == 0 && !s->stopping)
+        pthread_cond_wait(&s->nonempty, &s->lock);
+    struct Conn *c = NULL;
+    if (s->len > 0) {
+        c = s->ready[s->head];
+        s->head = (s->head + 1) % s->cap;
+        s->len--;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return c;
+}
+
+static void close_conn(struct Conn *c) {
+    close(c->fd);
+    free(c->buf);
+    free(c);
+}
+
+/* Writes the whole reply, waiting while the socket buffer is full. A
+ * client that reads nothing for SEND_TIMEOUT_MS would hold the worker,
+ * so it fails instead and the connection is closed. */
+static bool send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t k = send(fd, p, len, MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                int ready = poll(&pfd, 1, SEND_TIMEOUT_MS);
+                if (ready == 0)
+                    return false;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += k;
+        len -= k;
+    }
+    return true;
+}
+
+static int compare_values(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns false if a value is above QD_MAX_VALUE, inserting nothing */
+static bool do_insert(struct Server *s, struct Scratch *w, const char *key,
+                      const char *items, size_t n) {
+    if (n == 0)
+        return true;
+    memcpy(w->values, items, n * sizeof(uint64_t));
+    for (size_t i = 0; i < n; i++)
+        if (w->values[i] > QD_MAX_VALUE)
+            return false;
+    qsort(w->values, n, sizeof(uint64_t), compare_values);
+    // one (value, weight) pair per distinct value
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m > 0 && w->keys[m - 1] == w->values[i]) {
+            w->weights[m - 1]++;
+        } else {
+            w->keys[m] = (size_t)w->values[i];
+            w->weights[m++] = 1;
+        }
+    }
+    struct Bucket *b = &s->buckets[hash_key(key) % s->n_buckets];
+    pthread_mutex_lock(&b->lock);
+    insert_histogram(store_get_or_create(b->store, key), w->keys, w->weights,
+                     m);
+    pthread_mutex_unlock(&b->lock);
+    return true;
+}
+
+static bool do_query(struct Server *s, struct Scratch *w, int fd,
+                     const char *key, const char *items, size_t n) {
+    struct QdReply reply = {QD_NOT_FOUND, 0, 0, 0};
+    for (size_t i = 0; i < n; i++) {
+        double p;
+        memcpy(&p, items + i * sizeof(double), sizeof(double));
+        if (!isfinite(p)) {
+            reply.status = QD_INVALID;
+            return send_all(fd, &reply, sizeof(reply));
+        }
+    }
+    struct Bucket *b = &s->buckets[hash_key(key) % s->n_buckets];
+    pthread_mutex_lock(&b->lock);
+    struct QDigest *q = store_get(b->store, key);
+    if (q) {
+        reply.status = QD_OK;
+        reply.N = q->N;
+        reply.n = n;
+        for (size_t i = 0; i < n; i++) {
+            double p;
+            memcpy(&p, items + i * sizeof(double), sizeof(double));
+            w->values[i] = percentile(q, p);
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    return send_all(fd, &reply, sizeof(reply)) &&
+           send_all(fd, w->values, reply.n * sizeof(uint64_t));
+}
+
+/* Handles the complete requests at the start of the buffer. Returns
+ * false if the connection has to be closed. */
+static bool handle_requests(struct Server *s, struct Scratch *w,
+                            struct Conn *c) {
+    size_t off = 0;
+    while (c->len - off >= sizeof(struct QdRequest)) {
+        struct QdRequest req;
+        memcpy(&req, c->buf + off, sizeof(req));
+        if ((req.op != QD_OP_INSERT && req.op != QD_OP_QUERY) ||
+            req.key_len > QD_MAX_KEY || req.n > QD_MAX_BATCH)
+            return false;
+        const size_t total = sizeof(req) + req.key_len + req.n * 8;
+        if (c->len - off < total)
+            break;
+        char key[QD_MAX_KEY + 1];
+        memcpy(key, c->buf + off + sizeof(req), req.key_len);
+        key[req.key_len] = '\0';
+        const char *items = c->buf + off + sizeof(req) + req.key_len;
+        if (req.op == QD_OP_INSERT) {
+            if (!do_insert(s, w, key, items, req.n))
+                return false;
+        } else if (!do_query(s, w, c->fd, key, items, req.n))
+            return false;
+        off += total;
+    }
+    memmove(c->buf, c->buf + off, c->len - off);
+    c->len -= off;
+    return true;
+}
+
+/* Reads what the connection has to offer, up to READ_QUANTUM bytes,
+ * and serves it. Returns false if the connection has to be closed. */
+static bool serve(struct Server *s, struct Scratch *w, struct Conn *c) {
+    size_t got = 0;
+    while (got < READ_QUANTUM) {
+        if (c->cap - c->len < 4096) {
+            c->cap *= 2;
+            char *buf = xmalloc(c->cap);
+            memcpy(buf, c->buf, c->len);
+            free(c->buf);
+            c->buf = buf;
+        }
+        ssize_t k = read(c->fd, c->buf + c->len, c->cap - c->len);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (k <= 0)
+            return false;
+        c->len += k;
+        got += k;
+        if (!handle_requests(s, w, c))
+            return false;
+    }
+    return true;
+}
+
+static void *worker(void *arg) {
+    struct Server *s = arg;
+    struct Scratch w;
+    w.values = xmalloc(QD_MAX_BATCH * sizeof(uint64_t));
+    w.keys = xmalloc(QD_MAX_BATCH * sizeof(size_t));
+    w.weights = xmalloc(QD_MAX_BATCH * sizeof(uint64_t));
+    struct Conn *c;
+    while ((c = pop_ready(s)) != NULL) {
+        if (!serve(s, &w, c)) {
+            close_conn(c);
+            continue;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+            close_conn(c);
+    }
+    free(w.values);
+    free(w.keys);
+    free(w.weights);
+    return NULL;
+}
+
+static void accept_all(struct Server *s) {
+    for (;;) {
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        struct Conn *c = xmalloc(sizeof(struct Conn));
+        c->fd = fd;
+        c->cap = 64 * 1024;
+        c->buf = xmalloc(c->cap);
+        c->len = 0;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            close_conn(c);
+    }
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "qdigestd: socket path too long\n");
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("qdigestd: socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        perror("qdigestd: bind");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = QD_DEFAULT_SOCKET;
+    size_t n_workers = DEFAULT_WORKERS;
+    size_t K = DEFAULT_K;
+    size_t upper_bound = DEFAULT_UPPER_BOUND;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:k:u:")) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'w': n_workers = strtoul(optarg, NULL, 10); break;
+        case 'k': K = strtoul(optarg, NULL, 10); break;
+        case 'u': upper_bound = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-s socket] [-w workers] [-k K] "
+                            "[-u upper_bound]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n_workers == 0 || K == 0) {
+        fprintf(stderr, "qdigestd: workers and K must be positive\n");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct Server s;
+    s.listen_fd = listen_on(path);
+    if (s.listen_fd < 0)
+        return 1;
+    s.epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(s.epfd, EPOLL_CTL_ADD, s.listen_fd, &ev);
+
+    s.n_buckets = n_workers * BUCKETS_PER_WORKER;
+    s.buckets = xmalloc(s.n_buckets * sizeof(struct Bucket));
+    for (size_t i = 0; i < s.n_buckets; i++) {
+        pthread_mutex_init(&s.buckets[i].lock, NULL);
+        s.buckets[i].store = create_store(1, K, upper_bound);
+    }
+    s.cap = 64;
+    s.ready = xmalloc(s.cap * sizeof(struct Conn *));
+    s.head = 0;
+    s.len = 0;
+    s.stopping = false;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.nonempty, NULL);
+
+    // the signals are left to the main thread, so that they wake epoll_wait()
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    pthread_t *threads = xmalloc(n_workers * sizeof(pthread_t));
+    for (size_t i = 0; i < n_workers; i++)
+        pthread_create(&threads[i], NULL, worker, &s);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    fprintf(stderr, "qdigestd: listening on %s with %zu workers\n", path,
+            n_workers);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!stop) {
+        int k = epoll_wait(s.epfd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < k; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_all(&s);
+            else
+                push_ready(&s, events[i].data.ptr);
+        }
+    }
+
+    pthread_mutex_lock(&s.lock);
+    s.stopping = true;
+    pthread_cond_broadcast(&s.nonempty);
+    pthread_mutex_unlock(&s.lock);
+    for (size_t i = 0; i < n_workers; i++)
+        pthread_join(threads[i], NULL);
+    // connections still parked in epoll are closed with the process
+
+    size_t keys = 0;
+    for (size_t i = 0; i < s.n_buckets; i++) {
+        keys += store_size(s.buckets[i].store);
+        delete_store(s.buckets[i].store);
+        pthread_mutex_destroy(&s.buckets[i].lock);
+    }
+    fprintf(stderr, "qdigestd: stopped with %zu keys\n", keys);
+    close(s.epfd);
+    close(s.listen_fd);
+    unlink(path);
+    free(threads);
+    free(s.buckets);
+    free(s.ready);
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* test_qdigestd: starts a daemon and checks that bad requests from one
+ * producer do not take it down for the others.
+ *
+ * Usage: test_qdigestd path/to/qdigestd */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../include/qdigestd.h"
+#include <assert.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOCKET_PATH "/tmp/test_qdigestd.sock"
+
+/* Connects, retrying while the daemon starts up */
+static int connect_retry(void) {
+    const struct timespec pause = {0, 10 * 1000 * 1000};
+    for (int i = 0; i < 500; i++) {
+        int fd = qd_connect(SOCKET_PATH);
+        if (fd >= 0)
+            return fd;
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+/* Sends one insert without the range check of qd_insert() */
+static void send_raw_insert(int fd, const char *key, uint64_t value) {
+    struct QdRequest req = {QD_OP_INSERT, (uint32_t)strlen(key), 1};
+    char buf[sizeof(req) + QD_MAX_KEY + sizeof(value)];
+    memcpy(buf, &req, sizeof(req));
+    memcpy(buf + sizeof(req), key, req.key_len);
+    memcpy(buf + sizeof(req) + req.key_len, &value, sizeof(value));
+    const size_t len = sizeof(req) + req.key_len + sizeof(value);
+    assert(write(fd, buf, len) == (ssize_t)len);
+}
+
+/* True if the daemon closes the connection within two seconds */
+static int closed_by_daemon(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    char c;
+    return poll(&pfd, 1, 2000) == 1 && read(fd, &c, 1) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s path/to/qdigestd\n", argv[0]);
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        // a failed assert below must not leave the daemon running
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        execl(argv[1], argv[1], "-s", SOCKET_PATH, "-w", "2", (char *)NULL);
+        perror("test_qdigestd: exec");
+        _exit(127);
+    }
+    int fd = connect_retry();
+    assert(fd >= 0);
+
+    uint64_t values[1000];
+    for (size_t i = 0; i < 1000; i++)
+        values[i] = i + 1;
+    assert(qd_insert(fd, "ok", values, 1000) == 0);
+    uint64_t out[2], N;
+    double ps[2] = {0.0, 1.0};
+    assert(qd_query(fd, "ok", ps, 2, out, &N) == QD_OK && N == 1000);
+
+    // out of range values are refused by the client before sending
+    uint64_t too_big = UINT64_MAX;
+    assert(qd_insert(fd, "evil", &too_big, 1) == -1);
+
+    // and make the daemon drop the producer that sent them anyway
+    const uint64_t bad[2] = {UINT64_MAX, (uint64_t)QD_MAX_VALUE + 2};
+    for (size_t i = 0; i < 2; i++) {
+        int evil = connect_retry();
+        send_raw_insert(evil, "evil", bad[i]);
+        assert(closed_by_daemon(evil));
+        qd_close(evil);
+    }
+
+    // the largest accepted value still fits the universe
+    int edge = connect_retry();
+    send_raw_insert(edge, "edge", QD_MAX_VALUE);
+    assert(qd_query(edge, "edge", ps, 2, out, &N) == QD_OK && N == 1);
+    assert(out[1] == QD_MAX_VALUE);
+    qd_close(edge);
+
+    // a NaN percentile is an error reply, the connection stays usable
+    ps[0] = NAN;
+    assert(qd_query(fd, "ok", ps, 2, out, &N) == QD_INVALID);
+    ps[0] = 0.5;
+    assert(qd_query(fd, "evil", ps, 2, out, &N) == QD_NOT_FOUND);
+    assert(qd_query(fd, "ok", ps, 2, out, &N) == QD_OK && N == 1000);
+    assert(out[0] <= out[1] && out[1] <= 1023);
+    qd_close(fd);
+
+    int status;
+    kill(pid, SIGTERM);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    printf("qdigestd tests passed\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+/**
+ *  @file This header file contains a slab allocator for QDigestNode
+ *  structs, used to share node storage between many digests.
+ *
+ *  Nodes are carved out of large slabs and recycled through a free
+ *  list, so creating a node is a pointer bump or a list pop instead of
+ *  a malloc() call, and destroying a whole pool releases every node of
+ *  every digest that used it with one free() per slab.
+ *
+ *  A pool is not thread-safe: digests sharing a pool must be modified
+ *  by one thread at a time.
+ *
+ * */
+#ifndef NODE_POOL
+#define NODE_POOL
+#include "../include/qcore.h"
+#include <stddef.h>
+
+/**
+ *  @brief A block of contiguous nodes owned by a NodePool.
+ *
+ * */
+struct NodeSlab {
+  struct NodeSlab *next;        /**< The previously allocated slab. */
+  struct QDigestNode nodes[];   /**< The nodes carved out of the slab. */
+};
+
+/**
+ *  @brief A slab allocator for QDigestNode structs.
+ *
+ * */
+struct NodePool {
+  struct NodeSlab *slabs;       /**< The most recent slab, linked to the older ones. */
+  struct QDigestNode *free_list;/**< Released nodes, chained through their `left` pointer. */
+  size_t slab_nodes;            /**< The number of nodes per slab. */
+  size_t slab_used;             /**< The number of nodes handed out from the most recent slab. */
+  size_t in_use;                /**< The number of nodes currently allocated. */
+};
+
+/**
+ *  @brief Creates an empty node pool.
+ *
+ *  @param slab_nodes The number of nodes allocated at once when the
+ *  pool runs out of nodes.
+ *
+ * */
+struct NodePool *create_pool(size_t slab_nodes);
+
+/**
+ *  @brief Frees a pool together with every node it handed out.
+ *
+ *  @param p A pointer to the pool.
+ *
+ * */
+void delete_pool(struct NodePool *p);
+
+/**
+ *  @brief Allocates and initializes a node, the pool counterpart of
+ *  create_node().
+ *
+ *  @param p A pointer to the pool, or NULL to fall back on create_node().
+ *
+ *  @param lower_bound The lower bound of the node's range.
+ *
+ *  @param upper_bound The upper bound of the node's range.
+ *
+ * */
+struct QDigestNode *pool_alloc(struct NodePool *p, size_t lower_bound,
+                               size_t upper_bound);
+
+/**
+ *  @brief Returns a node to its pool, the counterpart of delete_node().
+ *
+ *  @param p A pointer to the pool, or NULL to fall back on delete_node().
+ *
+ *  @param n A pointer to the node to release.
+ *
+ * */
+void pool_free(struct NodePool *p, struct QDigestNode *n);
+
+/**
+ *  @brief Releases a whole subtree, the counterpart of free_tree().
+ *
+ *  @param p A pointer to the pool, or NULL to fall back on free_tree().
+ *
+ *  @param n The root of the subtree to release.
+ *
+ * */
+void pool_free_tree(struct NodePool *p, struct QDigestNode *n);
+#endif
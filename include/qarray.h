@@ -0,0 +1,210 @@
+/*! \file qarray.h
+ *  \brief A Q-Digest engine for small universes backed by a flat array.
+ *
+ *  For a universe of at most 2^ARRAY_MAX_HEIGHT values (status codes,
+ *  small latency buckets) the complete binary tree of a digest fits in
+ *  one array of counts laid out heap-style: t[1] is the root, the
+ *  children of t[i] are t[2i] and t[2i + 1], and value v is the leaf
+ *  t[width + v]. No node is ever allocated or linked:
+ *
+ *   - an insert is one increment of a leaf;
+ *   - compression is compress_implicit(), one linear sweep per level;
+ *   - merging two digests is an element-wise vector add;
+ *   - the binary encoding copies the runs of non-zero counts as they are.
+ *
+ *  The functions mirror insert(), compress_now(), percentile(), rank(),
+ *  merge(), to_string() and from_string(), and give the same answers
+ *  as a tree holding the same nodes. The text format is the one of
+ *  to_string(), and array_to_digest() / array_from_digest() convert
+ *  between the two engines.
+ *
+ *  Until array_compress() is called every count sits on its own leaf,
+ *  so queries are exact; compressing only shrinks the encodings and
+ *  brings the digest in line with the trees it is merged with.
+ *
+ *  Counts and N clamp at SIZE_MAX on insert, merge and decode, as in
+ *  the tree engine, but a QArray keeps no `saturated` flag: N equal to
+ *  SIZE_MAX is the sign that counts were lost.
+ *
+ *  Encodings are stored in the byte order of the writer, like the
+ *  snapshot format of qsnapshot.h.
+ *
+ */
+
+#ifndef QARRAY
+#define QARRAY
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Largest universe handled, as a power of two: 65536 values. */
+#define ARRAY_MAX_HEIGHT 16
+
+/** Magic bytes opening every binary encoding. */
+#define ARRAY_MAGIC "QDAR"
+
+/**
+ *  @brief A struct representing a Q-Digest stored as a flat array.
+ */
+struct QArray {
+  size_t *counts;               /**< 2 * width counts, heap-ordered; counts[0] is unused. */
+  size_t width;                 /**< Number of leaves, the size of the universe. */
+  size_t N;                     /**< Total count. */
+  size_t K;                     /**< The compression parameter. */
+};
+
+/**
+ *  @brief The header of a binary encoding, followed by the runs.
+ *
+ *  Each run is two uint64_t, the heap index of its first count and its
+ *  length, followed by that many uint64_t counts.
+ */
+struct ArrayHeader {
+  char magic[4];                /**< ARRAY_MAGIC, not NUL terminated. */
+  uint32_t height;              /**< log2 of the width. */
+  uint64_t N;                   /**< Total count. */
+  uint64_t K;                   /**< The compression parameter. */
+  uint64_t runs;                /**< Number of runs. */
+};
+
+/**
+ *  @brief Creates an empty digest over [0, upper_bound].
+ *
+ *  @param K The compression parameter.
+ *  @param upper_bound The largest value expected; the universe is the
+ *  next power of two, at most 2^ARRAY_MAX_HEIGHT.
+ *
+ *  @return A pointer to the new digest, freed with delete_array_q(), or
+ *  NULL if the universe is too large.
+ */
+struct QArray *create_array_q(size_t K, size_t upper_bound);
+
+/**
+ *  @brief Frees a digest created by create_array_q().
+ *
+ *  @param a A pointer to the digest.
+ */
+void delete_array_q(struct QArray *a);
+
+/**
+ *  @brief Adds `count` occurrences of `key`, growing the universe to the
+ *  next power of two if needed, like insert().
+ *
+ *  @param a A pointer to the digest.
+ *  @param key The value.
+ *  @param count The number of occurrences.
+ *
+ *  @return false, and nothing is inserted, if `key` lies beyond
+ *  2^ARRAY_MAX_HEIGHT - 1.
+ */
+bool array_insert(struct QArray *a, size_t key, unsigned int count);
+
+/**
+ *  @brief Compresses the digest with the N/K threshold, as compress_now().
+ *
+ *  @param a A pointer to the digest.
+ */
+void array_compress(struct QArray *a);
+
+/**
+ *  @brief The p-th percentile, as percentile() computes it on a tree.
+ *
+ *  @param a A pointer to the digest.
+ *  @param p The percentile, in [0, 1].
+ */
+size_t array_percentile(const struct QArray *a, double p);
+
+/**
+ *  @brief The total count of the nodes ending at or below `value`, as rank().
+ *
+ *  @param a A pointer to the digest.
+ *  @param value The value.
+ */
+size_t array_rank(const struct QArray *a, size_t value);
+
+/**
+ *  @brief Adds the counts of `a2` to `a1`, growing `a1` first if `a2`
+ *  has a larger universe. `a1` keeps the larger K.
+ *
+ *  @param a1 A pointer to the destination digest.
+ *  @param a2 A pointer to the source digest, which is not modified.
+ */
+void array_merge(struct QArray *a1, const struct QArray *a2);
+
+/**
+ *  @brief Size of a buffer large enough for array_to_string().
+ *
+ *  @param a A pointer to the digest.
+ */
+size_t array_max_string(const struct QArray *a);
+
+/**
+ *  @brief Serializes the digest in the text format of to_string().
+ *
+ *  @param a A pointer to the digest.
+ *  @param buf The output, at least array_max_string(a) bytes.
+ *  @param buf_length Set to the number of bytes written.
+ */
+void array_to_string(const struct QArray *a, char *buf, size_t *buf_length);
+
+/**
+ *  @brief Rebuilds a digest from the text of to_string() or array_to_string().
+ *
+ *  @param buf The NUL terminated text.
+ *
+ *  @return A new digest, or NULL if the text is malformed, has K == 0
+ *  or describes a universe that is not a power of two up to
+ *  2^ARRAY_MAX_HEIGHT.
+ */
+struct QArray *array_from_string(const char *buf);
+
+/**
+ *  @brief Size of the binary encoding of the digest.
+ *
+ *  @param a A pointer to the digest.
+ */
+size_t array_encoded_size(const struct QArray *a);
+
+/**
+ *  @brief Writes the binary encoding: the header, then every run of
+ *  non-zero counts copied as it is.
+ *
+ *  @param a A pointer to the digest.
+ *  @param buf The output, at least array_encoded_size(a) bytes.
+ *
+ *  @return The number of bytes written.
+ */
+size_t array_encode(const struct QArray *a, void *buf);
+
+/**
+ *  @brief Rebuilds a digest from its binary encoding.
+ *
+ *  @param buf The encoding.
+ *  @param len The length of the encoding.
+ *
+ *  @return A new digest, or NULL if the encoding is malformed or has
+ *  K == 0.
+ */
+struct QArray *array_decode(const void *buf, size_t len);
+
+/**
+ *  @brief Builds a pointer tree holding the same nodes.
+ *
+ *  @param a A pointer to the digest.
+ *
+ *  @return A new QDigest, freed with delete_qdigest().
+ */
+struct QDigest *array_to_digest(const struct QArray *a);
+
+/**
+ *  @brief Copies a pointer tree into a flat array.
+ *
+ *  @param q A pointer to the QDigest; its root must span [0, 2^h - 1]
+ *  with h at most ARRAY_MAX_HEIGHT.
+ *
+ *  @return A new digest, or NULL if the universe of `q` does not fit.
+ */
+struct QArray *array_from_digest(const struct QDigest *q);
+
+#endif
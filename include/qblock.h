@@ -0,0 +1,120 @@
+/*! \file qblock.h
+ *  \brief A Q-Digest whose bottom levels are staged in dense blocks.
+ *
+ *  On a dense stream, insert() keeps walking a chain of nodes down to a
+ *  single-value leaf, and compress() folds most of those leaves away
+ *  soon after. A struct QBlocked puts a staging area in front of the
+ *  tree instead: the subtree of height `height` above each value (2^height
+ *  values, aligned) is a dense array of counts, and an insert is one
+ *  increment in it.
+ *
+ *  The blocks are flushed into the tree when `budget` of them are live
+ *  or when the digest is read. A flush runs the compression rule of
+ *  compress() over each block bottom-up, one flat loop per level over
+ *  the implicit binary tree of the block, and hands only the surviving
+ *  nodes, in preorder, to merge_flat(), which builds them in bulk.
+ *
+ *  Blocks pay off when the stream keeps hitting a working set of at most
+ *  `budget` blocks. A stream spread over many more blocks flushes every
+ *  few inserts, and can then cost more than plain insert() calls.
+ *
+ *  The universe of the tree is at least one block wide and a power of
+ *  two, so that every block is a node of it.
+ *
+ */
+
+#ifndef QBLOCK
+#define QBLOCK
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Default block height: blocks of 64 values. */
+#define BLOCK_DEFAULT_HEIGHT 6
+
+/** Default number of live blocks before a flush (128 KB of counts
+ *  with the default height). */
+#define BLOCK_DEFAULT_BUDGET 256
+
+/**
+ *  @brief A struct representing a digest with dense leaf blocks.
+ */
+struct QBlocked {
+  struct QDigest *q;            /**< The tree holding everything flushed so far. */
+  unsigned height;              /**< Blocks cover 2^height values. */
+  size_t budget;                /**< Most live blocks before a flush. */
+  size_t *counts;               /**< budget blocks of 2^height leaf counts. */
+  size_t *index;                /**< Block index (value >> height) of each live block. */
+  size_t *slots;                /**< Hash table from block index to live block + 1, 0 when empty. */
+  size_t table_size;            /**< Size of `slots`, a power of two. */
+  size_t live;                  /**< Number of live blocks. */
+  size_t pending;               /**< Total count staged in the blocks. */
+};
+
+/**
+ *  @brief Creates an empty digest with dense leaf blocks.
+ *
+ *  @param K The compression parameter of the tree.
+ *  @param upper_bound The initial universe upper bound.
+ *  @param height The block height, for instance BLOCK_DEFAULT_HEIGHT.
+ *  @param budget The number of blocks staged before a flush, at least 1.
+ *
+ *  @return A pointer to the new digest, freed with delete_blocked().
+ */
+struct QBlocked *create_blocked(size_t K, size_t upper_bound, unsigned height,
+                                size_t budget);
+
+/**
+ *  @brief Frees a digest created by create_blocked().
+ *
+ *  @param b A pointer to the digest.
+ */
+void delete_blocked(struct QBlocked *b);
+
+/**
+ *  @brief Adds `count` to the block slot of `key`, flushing first if a
+ *  new block is needed and the budget is used up.
+ *
+ *  @param b A pointer to the digest.
+ *  @param key The value to insert.
+ *  @param count The number of occurrences.
+ */
+void blocked_insert(struct QBlocked *b, size_t key, unsigned int count);
+
+/**
+ *  @brief Compresses the live blocks and merges them into the tree.
+ *
+ *  Unless the policy is COMPRESS_MANUAL, the tree is then compressed
+ *  with its new N, so that blocks flushed earlier with a smaller N / K
+ *  are folded as far as the plain insert path would fold them.
+ *
+ *  @param b A pointer to the digest.
+ */
+void blocked_flush(struct QBlocked *b);
+
+/**
+ *  @brief Flushes the blocks and returns the tree.
+ *
+ *  @param b A pointer to the digest.
+ *
+ *  @return The tree, owned by `b`, for use with the rest of qcore.h.
+ */
+struct QDigest *blocked_digest(struct QBlocked *b);
+
+/**
+ *  @brief percentile() of the flushed digest.
+ *
+ *  @param b A pointer to the digest.
+ *  @param p The percentile, in [0, 1].
+ */
+size_t blocked_percentile(struct QBlocked *b, double p);
+
+/**
+ *  @brief rank() of the flushed digest.
+ *
+ *  @param b A pointer to the digest.
+ *  @param value The value.
+ */
+size_t blocked_rank(struct QBlocked *b, size_t value);
+
+#endif
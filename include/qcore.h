@@ -12,9 +12,50 @@
 #ifndef QCORE
 #define QCORE
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
+/** Upper bound on the length of one "<lower> <upper> <count>\n" line. */
+#define TEXT_LINE_MAX 64
+
+/** Deepest split accepted by to_string_parallel() and from_string_parallel(). */
+#define PARALLEL_MAX_SPLIT_DEPTH 16
+
+/** Approximate number of characters parsed by one task of from_string_parallel(). */
+#define PARALLEL_PARSE_CHUNK (1 << 16)
+
+/** Tombstones always kept before the log falls back to full deltas. */
+#define DELTA_MIN_TOMBSTONES 64
+
 /* ======================== STRUCT DEFINITIONS ==================*/
+
+/**
+ *  @brief Selects when a Q-Digest runs its compression pass.
+ */
+enum CompressMode {
+  COMPRESS_AUTO,    /**< Compress once num_nodes reaches 6 * K (default). */
+  COMPRESS_BUDGET,  /**< Compress once num_nodes reaches the node budget. */
+  COMPRESS_MANUAL   /**< Compress only on compress_now() or before serialization. */
+};
+
+/**
+ *  @brief The compression policy attached to every Q-Digest.
+ *
+ *  The policy decouples the compression frequency from K. With
+ *  COMPRESS_BUDGET the digest is compressed when it holds `max_nodes`
+ *  nodes, and the pass keeps tightening until the tree is down to
+ *  `target_ratio * max_nodes` nodes (hysteresis), so the next
+ *  compression is postponed by the remaining headroom.
+ */
+struct CompressPolicy {
+  enum CompressMode mode;       /**< When compression is triggered. */
+  size_t max_nodes;             /**< Node budget, 0 means no hard cap. */
+  double target_ratio;          /**< Fraction of max_nodes to compress down to, in (0, 1]. */
+};
+
+/* Slab allocator optionally backing the nodes of a digest (node_pool.h) */
+struct NodePool;
+
 /* Declare QDigestNode, the building block of the Data Structure */
 
 /** 
@@ -33,10 +74,51 @@ struct QDigestNode {
   struct QDigestNode *right;    /**< Pointer to the right child. */
   struct QDigestNode *parent;   /**< Pointer to the parent node */
   size_t count;                 /**< Number of items aggregated */
+  size_t subtree_count;         /**< Sum of count over this node and all its descendants */
+  size_t lower_bound;           /**< Lower bound of covered range. */
+  size_t upper_bound;           /**< Upper bound of covered range. */
+  uint64_t version;             /**< Digest version at which count last changed (see to_delta()). */
+};
+
+/**
+ *  @brief A node without its links, as exchanged by flat transports.
+ *
+ *  The members mirror, in order, the contiguous `count`,
+ *  `subtree_count`, `lower_bound` and `upper_bound` members of
+ *  QDigestNode, so that a node can be described in place (e.g. by an
+ *  MPI datatype) and received as a plain array of QFlatNode.
+ */
+struct QFlatNode {
+  size_t count;                 /**< Number of items aggregated. */
+  size_t subtree_count;         /**< Sum of count over the node and its descendants. */
   size_t lower_bound;           /**< Lower bound of covered range. */
   size_t upper_bound;           /**< Upper bound of covered range. */
 };
 
+/**
+ *  @brief A node range removed from the digest, kept so that a delta
+ *  can tell a replica to drop it.
+ */
+struct Tombstone {
+  size_t lower_bound;           /**< Lower bound of the removed node. */
+  size_t upper_bound;           /**< Upper bound of the removed node. */
+  uint64_t version;             /**< Digest version at which it was removed. */
+};
+
+/**
+ *  @brief The change history of a digest used by to_delta().
+ *
+ *  Tombstones are only recorded once to_delta() has been called at
+ *  least once, i.e. once some replica may hold an older state.
+ */
+struct DeltaLog {
+  uint64_t version;             /**< Version stamped on the changes being made now. */
+  uint64_t trimmed_version;     /**< Tombstones up to this version may have been dropped. */
+  struct Tombstone *tombstones; /**< Removed ranges, by increasing version. */
+  size_t len;                   /**< Number of tombstones. */
+  size_t capacity;              /**< Allocated tombstones. */
+};
+
 /**
  *  @brief A struct representing the Q-Digest data structure.
  */
@@ -46,6 +128,10 @@ struct QDigest {
   size_t N;                     /**< The size of the `universe` (i.e., the maximum size that can appear in the stream.) */
   size_t K;                     /**< The compression parameter, a tunable accuracy-memory tradeoff parameter. Smaller K => more compression => higher error, lower memory. The opposite is true. */ 
   size_t num_inserts;           /**< The total number of inserted values (used to enforce the compression invariant) \f$count < num\_inserts / K\f$ */
+  struct CompressPolicy policy; /**< When and how far the digest is compressed. */
+  bool saturated;               /**< Set once a count or N had to be clamped at SIZE_MAX. */
+  struct NodePool *pool;        /**< Allocator of the nodes, NULL for plain malloc/free. */
+  struct DeltaLog log;          /**< Versions and tombstones for delta serialization. */
 };
 
 /* ================= FUNCTION PROTOTYPES =======================*/
@@ -71,6 +157,14 @@ size_t log_2_ceil(size_t n);
  */
 struct QDigestNode *create_node(size_t lower_bound, size_t upper_bound);
 
+/**
+ *  @brief Initializes a CompressPolicy to the default behaviour:
+ *  COMPRESS_AUTO, no node budget, and a single compression pass.
+ *
+ *  @param p a pointer to the CompressPolicy to initialize.
+ */
+void init_policy(struct CompressPolicy *p);
+
 /**
  *  @brief This function creates a QDigest, allocating memory for
  *  it and initializing its root, the number of nodes contained,
@@ -108,6 +202,71 @@ struct QDigest *create_q(struct QDigestNode *root, size_t num_nodes, size_t N,
  */
 struct QDigest *create_tmp_q(size_t K, size_t upper_bound);
 
+/**
+ *  @brief This function behaves like create_tmp_q(), but the root and
+ *  every node later added to the digest are taken from `pool`, and are
+ *  returned to it when they are deleted. Digests created by merge()
+ *  and expand_tree() inherit the pool of their input.
+ *
+ *  @param K a positive integer representing the compression
+ *  parameter.
+ *
+ *  @param upper_bound a positive integer representing the
+ *  maximum range that can contained in the root node.
+ *
+ *  @param pool the NodePool providing the nodes, or NULL to use
+ *  malloc/free as create_tmp_q() does.
+ */
+struct QDigest *create_pooled_q(size_t K, size_t upper_bound,
+                                struct NodePool *pool);
+
+/**
+ *  @brief This function initializes a QDigest header living in
+ *  caller-owned memory (e.g. embedded in a larger struct) the same way
+ *  create_pooled_q() does. Such a digest must not be passed to
+ *  delete_qdigest(); its nodes are released with pool_free_tree().
+ *
+ *  @param q a pointer to the header to initialize.
+ *
+ *  @param K a positive integer representing the compression
+ *  parameter.
+ *
+ *  @param upper_bound a positive integer representing the
+ *  maximum range that can contained in the root node.
+ *
+ *  @param pool the NodePool providing the nodes, or NULL for malloc.
+ */
+void init_q(struct QDigest *q, size_t K, size_t upper_bound,
+            struct NodePool *pool);
+
+/**
+ *  @brief Creates an identical copy of a QDigest in a single pass over
+ *  its nodes, without re-inserting anything.
+ *
+ *  The copy takes its nodes from the pool of `q` (or from malloc when
+ *  `q` has none), and has the same counts, bounds, K, compression
+ *  policy and saturation flag. The change history is not copied: the
+ *  first to_delta() of the copy is a full one.
+ *
+ *  @param q a pointer to the QDigest to copy.
+ *
+ *  @return A new QDigest, freed with delete_qdigest().
+ */
+struct QDigest *clone_qdigest(const struct QDigest *q);
+
+/**
+ *  @brief Same as clone_qdigest(), but the nodes of the copy are taken
+ *  from `pool`.
+ *
+ *  @param q a pointer to the QDigest to copy.
+ *
+ *  @param pool the NodePool providing the nodes, or NULL for malloc.
+ *
+ *  @return A new QDigest backed by `pool`.
+ */
+struct QDigest *clone_qdigest_pooled(const struct QDigest *q,
+                                     struct NodePool *pool);
+
 /**
  *  @brief This function safely frees memory that was dynamically
  *  allocated to build the Q-Digest. This effectively acts as a
@@ -123,7 +282,8 @@ void free_tree(struct QDigestNode *n);
 /**
  *  @brief This is a wrapper function around free_tree that
  *  automatically destroys and frees memory from a QDigest struct.
- *  The function applies free_tree on q->root.
+ *  The function applies free_tree on q->root, returning the nodes
+ *  to q->pool when the digest is pool-backed.
  *  
  *  @param q a pointer to a QDigest struct that needs to be
  *  destroyed.
@@ -223,14 +383,74 @@ void swap_q(struct QDigest *a, struct QDigest *b);
 /** 
  *  @brief This is the function that gets called directly in most
  *  implementations and acts as a wrapper around compress().
- *  This function automatically computes the compression ratio
- *  (nDivk) and the maximum depth of the Q-Digest (l_max).
- *  Then compress() is called on the root node of the Q-Digest.
+ *  The digest's CompressPolicy decides whether a pass is due: in
+ *  COMPRESS_AUTO mode once the tree holds 6 * K nodes, in
+ *  COMPRESS_BUDGET mode once it reaches the node budget (never if the
+ *  budget is 0), and never in COMPRESS_MANUAL mode. The pass itself is compress_now().
  *
  *  @param q a pointer to a QDigest struct to be compressed.
  * */
 void compress_if_needed(struct QDigest *q);
 
+/**
+ *  @brief Sets the compression policy of a Q-Digest.
+ *
+ *  @param q a pointer to the QDigest whose policy is changed.
+ *
+ *  @param mode when compression should be triggered.
+ *
+ *  @param max_nodes the node budget. With COMPRESS_BUDGET it is the
+ *  trigger threshold, with COMPRESS_MANUAL it caps compress_now().
+ *  A value of 0 disables the cap; with COMPRESS_BUDGET inserts then
+ *  never trigger a compression, as with COMPRESS_MANUAL.
+ *
+ *  @param target_ratio the fraction of `max_nodes` a compression
+ *  should shrink the tree to. Values outside (0, 1] are clamped.
+ * */
+void set_compress_policy(struct QDigest *q, enum CompressMode mode,
+                         size_t max_nodes, double target_ratio);
+
+/**
+ *  @brief Convenience wrapper around set_compress_policy() that
+ *  expresses the budget in bytes of node storage rather than in nodes.
+ *
+ *  @param q a pointer to the QDigest whose policy is changed.
+ *
+ *  @param max_bytes the memory budget for the tree nodes.
+ *
+ *  @param target_ratio the fraction of the budget to compress down to.
+ * */
+void set_memory_budget(struct QDigest *q, size_t max_bytes,
+                       double target_ratio);
+
+/**
+ *  @brief Unconditionally compresses the Q-Digest.
+ *
+ *  A regular pass with the N/K threshold is run first. If the policy
+ *  carries a node budget, the threshold is then doubled until the tree
+ *  fits in `target_ratio * max_nodes` nodes. Every doubling halves the
+ *  effective K, so hard caps trade accuracy for memory.
+ *
+ *  @param q a pointer to the QDigest to be compressed.
+ * */
+void compress_now(struct QDigest *q);
+
+/**
+ *  @brief Runs the rule of compress() over a complete tree stored as a
+ *  heap-ordered count array.
+ *
+ *  t[1] is the root and the children of t[i] are t[2i] and t[2i + 1];
+ *  the leaves are t[width] to t[2 * width - 1]. Going up one level at a
+ *  time, the children of a node move into it when their total with the
+ *  node is below `nDivk`. Each level is a branch-free loop over a
+ *  contiguous range, which the compiler can vectorize.
+ *
+ *  @param t The counts, 2 * width entries (t[0] is unused).
+ *  @param width The number of leaves, a power of two.
+ *  @param nDivk The threshold N / K.
+ * */
+void compress_implicit(size_t *t, size_t width, size_t nDivk);
+
 /** 
  *  @brief This function expands a QDigest whose value universe is 
  *  too small by embedding its existing tree into a larger QDigest 
@@ -281,6 +501,76 @@ void expand_tree(struct QDigest *q, size_t upper_bound);
 void insert(struct QDigest *q, size_t key, unsigned int count,
             bool try_compress);
 
+/**
+ *  @brief Inserts a pre-aggregated weight for a value into a QDigest.
+ *
+ *  This is the 64-bit counterpart of insert(), meant for inputs that
+ *  are already aggregated elsewhere (e.g. histograms exported by other
+ *  systems) where a single call replaces `weight` unit inserts. Counts
+ *  are added with saturation: if the leaf count or N would overflow,
+ *  they are clamped to SIZE_MAX and the digest's `saturated` flag is
+ *  raised instead of silently wrapping around.
+ *
+ *  @param q A pointer to the QDigest receiving the weight.
+ *
+ *  @param key The value to insert. The universe is expanded if needed.
+ *
+ *  @param weight How many occurrences of `key` to record.
+ *
+ *  @param try_compress If true, the compression policy is consulted
+ *  after the insertion.
+ *
+ *  @return `true` if the weight was recorded exactly, `false` if a
+ *  count saturated.
+ * */
+bool insert_weighted(struct QDigest *q, size_t key, uint64_t weight,
+                     bool try_compress);
+
+/**
+ *  @brief Inserts a whole pre-aggregated histogram into a QDigest.
+ *
+ *  Each pair (keys[i], weights[i]) is recorded with insert_weighted()
+ *  without intermediate compression; the compression policy is applied
+ *  once after the last pair. Zero weights are skipped.
+ *
+ *  @param q A pointer to the QDigest receiving the histogram.
+ *
+ *  @param keys An array of `n` values.
+ *
+ *  @param weights An array of `n` 64-bit weights, one per value.
+ *
+ *  @param n The number of (key, weight) pairs.
+ *
+ *  @return `true` if no count saturated, `false` otherwise.
+ * */
+bool insert_histogram(struct QDigest *q, const size_t *keys,
+                      const uint64_t *weights, size_t n);
+
+/**
+ *  @brief Adds a 64-bit weight to a size_t counter, clamping at SIZE_MAX.
+ *
+ *  @param dst A pointer to the counter to increase.
+ *
+ *  @param w The amount to add.
+ *
+ *  @return `true` if the addition was exact, `false` if it saturated.
+ * */
+bool add_saturating(size_t *dst, uint64_t w);
+
+/**
+ *  @brief Computes floor(a * num / den) exactly, for num <= den,
+ *  without any intermediate overflow.
+ *
+ *  @param a The value to scale (typically the digest's N).
+ *
+ *  @param num The numerator of the scaling fraction.
+ *
+ *  @param den The denominator of the scaling fraction. Must be > 0.
+ *
+ *  @return The scaled value, which never exceeds `a`.
+ * */
+size_t mul_div_floor(size_t a, uint64_t num, uint64_t den);
+
 /**
  *  @brief Inserts an existing QDigestNode into the digest, creating
  *  intermediate nodes as needed.
@@ -343,6 +633,58 @@ void insert_node(struct QDigest *q, const struct QDigestNode *n);
  */
 size_t postorder_by_rank(struct QDigestNode *n, size_t *curr_rank,
                          size_t req_rank);
+/**
+ *  @brief Adds a weight to the subtree count of a node and of every
+ *  ancestor up to the root.
+ *
+ *  @param n A pointer to the node whose count has just increased.
+ *
+ *  @param w The amount the count increased by.
+ */
+void add_to_path(struct QDigestNode *n, uint64_t w);
+
+/**
+ *  @brief Returns the number of recorded values that are less than or
+ *  equal to `value`, the inverse of percentile().
+ *
+ *  The query descends a single root-to-leaf path and relies on the
+ *  `subtree_count` cached in every node: whenever the walk moves into a
+ *  right child, the whole left sibling subtree is added at once, and a
+ *  node whose range ends at or below `value` contributes its entire
+ *  subtree. The cost is therefore O(log U) regardless of the number of
+ *  nodes, instead of the full walk done by postorder_by_rank().
+ *
+ *  As with percentile(), a node's count is attributed to its upper
+ *  bound: values folded into a node whose range straddles `value` are
+ *  not counted.
+ *
+ *  @param q A pointer to the QDigest to query.
+ *
+ *  @param value The value whose rank is requested.
+ *
+ *  @return The number of values whose node ends at or below `value`.
+ *          Dividing by q->N gives the empirical CDF at `value`.
+ */
+size_t rank(struct QDigest *q, size_t value);
+
+/**
+ *  @brief Returns the number of recorded values in the closed range
+ *  [lo, hi], computed from two rank() queries in O(log U).
+ *
+ *  This is meant for SLO-style checks: for instance the fraction of
+ *  requests slower than 250 ms is
+ *  `range_count(q, 251, SIZE_MAX) / (double)q->N`.
+ *
+ *  @param q A pointer to the QDigest to query.
+ *
+ *  @param lo The inclusive lower end of the range.
+ *
+ *  @param hi The inclusive upper end of the range.
+ *
+ *  @return The number of values attributed to [lo, hi], 0 if lo > hi.
+ */
+size_t range_count(struct QDigest *q, size_t lo, size_t hi);
+
 /**
  *  @brief Merges the contents of two QDigests into one.
  *
@@ -383,6 +725,89 @@ size_t postorder_by_rank(struct QDigestNode *n, size_t *curr_rank,
  */
 void merge(struct QDigest *q1, const struct QDigest *q2);
 
+/**
+ *  @brief Merges a QDigest into another in place by grafting its subtrees.
+ *
+ *  Both trees are walked together from the node of `q1` covering the
+ *  root of `q2`: counts are summed where both digests have a node, and
+ *  wherever `q1` has no child the whole subtree of `q2` is attached
+ *  as it is. The cost is the size of the overlap of the two trees plus
+ *  one pass over the attached nodes, with no lookup from the root per
+ *  node as in merge(). Digests built over disjoint value ranges, such
+ *  as the slices of a range-partitioned input, only overlap on the few
+ *  ancestors of their ranges, and merging them is a concatenation.
+ *
+ *  The result is the same as with merge(), overlapping digests included.
+ *  A compression pass follows when the policy of `q1` asks for it.
+ *
+ *  @param q1 A pointer to the destination QDigest, grown with expand_tree()
+ *            if `q2` has a larger universe.
+ *
+ *  @param q2 A pointer to the source QDigest, which is left empty. When
+ *            both digests use the same NodePool (or none) its nodes are
+ *            moved into `q1`, otherwise they are copied and released.
+ *
+ *  @note The roots of both digests must lie on the same dyadic grid,
+ *        as for merge_flat().
+ */
+void merge_graft(struct QDigest *q1, struct QDigest *q2);
+
+/**
+ *  @brief Removes from `q1` the counts of a digest merged into it earlier.
+ *
+ *  Every count of `q2` is taken from the node of `q1` with the same
+ *  range or, when compression has folded it upwards since the merge,
+ *  from the closest ancestors holding a count. Nodes left empty without
+ *  children are released. Together with merge(), this keeps a running
+ *  aggregate over a sliding window with one merge and one subtraction
+ *  per tick.
+ *
+ *  @param q1 A pointer to the aggregate.
+ *
+ *  @param q2 A pointer to the digest to remove, not modified. Its nodes
+ *            must lie on the dyadic grid of `q1`, as for merge_graft().
+ *
+ *  @return `true` if every count of `q2` was found, `false` if some
+ *          were missing (`q2` changed since it was merged, or was never
+ *          merged); the counts found are removed either way and N is
+ *          decreased by what was actually removed.
+ *
+ *  @note Counts only ever move up the tree, so after a subtraction every
+ *        count of `q1` still sits on a node covering the values it stands
+ *        for, and percentile() stays within the rank error of the
+ *        digest before the subtraction. That error was bounded by
+ *        log2(U) * N / K for the larger N of that time, and the
+ *        subtraction does not shrink it: the nodes coarsened by
+ *        compressions that ran between the merge and the subtraction
+ *        stay coarse, even where only counts of `q2` caused the folding.
+ *        Relative to the smaller N left, the error therefore grows. A
+ *        window that subtracts forever should be rebuilt from its
+ *        buckets from time to time.
+ */
+bool subtract(struct QDigest *q1, const struct QDigest *q2);
+
+/**
+ *  @brief Merges an array of flat nodes into a QDigest in place.
+ *
+ *  This is merge() for a digest that arrives as a QFlatNode array (for
+ *  instance straight off the network) instead of a pointer tree. The
+ *  nodes are rebuilt into a tree with a finger search, which costs O(1)
+ *  per node when they come in preorder as Send_qdigest() sends them, and
+ *  the tree is then added to `q` with merge_graft(), which runs the
+ *  compression pass. `subtree_count` is ignored, nodes with a zero count
+ *  are skipped.
+ *
+ *  @param q A pointer to the destination QDigest.
+ *  @param nodes The flat nodes, in any order; preorder is the fast case.
+ *  @param len The number of nodes.
+ *  @param K The compression parameter of the sender; `q` keeps the larger one.
+ *
+ *  @note If the nodes reach above the universe of `q`, it is first grown
+ *        with expand_tree() to the next power of two.
+ */
+void merge_flat(struct QDigest *q, const struct QFlatNode *nodes, size_t len,
+                size_t K);
+
 /**
  *  @brief Computes the value associated with the p-th percentile of the data
  *  stored in the QDigest.
@@ -412,9 +837,152 @@ void merge(struct QDigest *q1, const struct QDigest *q2);
  *  @note If `q` is empty (i.e., q->N == 0), the behavior is undefined. The
  *        caller must ensure that the digest contains data before requesting
  *        a percentile.
+ *
+ *  @note Once N exceeds 2^53 the rank is no longer computed in double
+ *        precision: `p` is converted to a 53-bit binary fraction and the
+ *        rank is obtained through percentile_exact().
  */
 size_t percentile(struct QDigest *q, double p);
 
+/**
+ *  @brief Computes the value at the rational quantile num/den using
+ *  exact integer arithmetic.
+ *
+ *  The requested rank floor(N * num / den) is computed with
+ *  mul_div_floor(), so the result is exact for any N representable in
+ *  a size_t. For example, `percentile_exact(q, 99, 100)` is the p99.
+ *
+ *  @param q A pointer to the QDigest to query.
+ *
+ *  @param num The numerator of the quantile. Clamped to `den`.
+ *
+ *  @param den The denominator of the quantile. Must be > 0.
+ *
+ *  @return The upper bound of the node at which the cumulative count
+ *          reaches the requested rank.
+ */
+size_t percentile_exact(struct QDigest *q, uint64_t num, uint64_t den);
+
+/* ================= EXPORT FUNCTIONS =======================*/
+
+/**
+ *  @brief Bookkeeping for a single in-order pass that emits CDF points.
+ *
+ *  The cursor is fed the nodes of a digest by non-decreasing upper
+ *  bound through cdf_visit(). It is shared by export_cdf() and by the
+ *  readers of other node layouts (e.g. memory-mapped snapshots).
+ */
+struct CdfCursor {
+  size_t *bounds;               /**< Output upper bounds. */
+  size_t *cum_counts;           /**< Output cumulative counts. */
+  size_t max_buckets;           /**< Capacity of both output arrays. */
+  size_t len;                   /**< Number of points emitted so far. */
+  size_t cum;                   /**< Running cumulative count. */
+  size_t N;                     /**< Total count of the digest. */
+  size_t next;                  /**< Index of the next rank threshold. */
+  bool every_node;              /**< Emit one point per node instead of sampling. */
+};
+
+/**
+ *  @brief Prepares a CdfCursor for a new pass.
+ *
+ *  @param c The cursor to initialize.
+ *
+ *  @param bounds The output array of upper bounds.
+ *
+ *  @param cum_counts The output array of cumulative counts.
+ *
+ *  @param max_buckets The capacity of both output arrays, at least 1.
+ *
+ *  @param N The total count of the digest being exported.
+ *
+ *  @param num_nodes The number of nodes of the digest. If it does not
+ *  exceed `max_buckets` every node gets its own point.
+ */
+void cdf_init(struct CdfCursor *c, size_t *bounds, size_t *cum_counts,
+              size_t max_buckets, size_t N, size_t num_nodes);
+
+/**
+ *  @brief Feeds one node to a CdfCursor. Nodes must be visited by
+ *  non-decreasing upper bound, as in postorder_by_rank().
+ *
+ *  @param c The cursor.
+ *
+ *  @param upper_bound The upper bound of the node.
+ *
+ *  @param count The count of the node. Zero counts are ignored.
+ */
+void cdf_visit(struct CdfCursor *c, size_t upper_bound, size_t count);
+
+/**
+ *  @brief Exports the cumulative distribution of a QDigest in a
+ *  single traversal of the tree.
+ *
+ *  Nodes are visited in the same order as postorder_by_rank(), i.e.
+ *  by non-decreasing upper bound, and each emitted point pairs an
+ *  upper bound with the number of values whose node ends at or below
+ *  it. `cum_counts` is therefore non-decreasing and its last entry is
+ *  always q->N.
+ *
+ *  If the tree holds at most `max_buckets` nodes every distinct upper
+ *  bound gets its own point, so the exported CDF is exactly what
+ *  percentile() would answer for any rank. Otherwise points are
+ *  emitted at the first node that reaches each rank
+ *  ceil(N * j / max_buckets), j = 1..max_buckets.
+ *
+ *  @param q A pointer to the QDigest to export.
+ *
+ *  @param bounds An array of at least `max_buckets` entries that
+ *  receives the upper bounds of the points.
+ *
+ *  @param cum_counts An array of at least `max_buckets` entries that
+ *  receives the cumulative counts of the points.
+ *
+ *  @param max_buckets The capacity of `bounds` and `cum_counts`.
+ *
+ *  @return The number of points written, at most `max_buckets`.
+ *          Returns 0 for an empty digest.
+ */
+size_t export_cdf(struct QDigest *q, size_t *bounds, size_t *cum_counts,
+                  size_t max_buckets);
+
+/**
+ *  @brief Exports a fixed-bucket histogram of a QDigest in a single
+ *  traversal of the tree.
+ *
+ *  The `n` sorted edges are inclusive bucket upper bounds, in the
+ *  style of Prometheus `le` buckets: out[0] counts the values whose
+ *  node ends at or below edges[0], out[i] those in
+ *  (edges[i - 1], edges[i]], and out[n] those above edges[n - 1]. As
+ *  with percentile(), a node's count is attributed to its upper bound.
+ *
+ *  @param q A pointer to the QDigest to export.
+ *
+ *  @param edges An array of `n` strictly increasing bucket bounds.
+ *
+ *  @param n The number of edges.
+ *
+ *  @param out An array of `n + 1` counters, overwritten by the call.
+ */
+void export_histogram(struct QDigest *q, const size_t *edges, size_t n,
+                      size_t *out);
+
+/**
+ *  @brief Post-order walk backing export_histogram().
+ *
+ *  @param n The current node.
+ *
+ *  @param edges The bucket edges.
+ *
+ *  @param n_edges The number of edges.
+ *
+ *  @param out The bucket counters.
+ *
+ *  @param bucket The index of the current bucket, only ever increased.
+ */
+void postorder_histogram(struct QDigestNode *n, const size_t *edges, size_t n_edges,
+                         size_t *out, size_t *bucket);
+
 /* ================= SERIALIZATION FUNCTIONS =======================*/
 
 /**
@@ -475,6 +1043,8 @@ char *preorder_to_string(struct QDigestNode *n, char *buf, size_t *buf_length);
  *  @note The serialization includes only nodes with count > 0.
  *  @note The function relies on `preorder_to_string()` to serialize
  *        the nodes recursively after writing the metadata.
+ *  @note A digest in COMPRESS_MANUAL mode is compressed with
+ *        compress_now() before it is written.
  */
 void to_string(struct QDigest *q, char *buf, size_t *buf_length);
 
@@ -505,4 +1075,130 @@ void to_string(struct QDigest *q, char *buf, size_t *buf_length);
  */
 struct QDigest *from_string(char *buf);
 
+/**
+ *  @brief Reads the next "<lower> <upper> <count>" line of a to_string()
+ *  text.
+ *
+ *  Every parser of the text format (from_string(), hybrid_from_string(),
+ *  array_from_string()) reads its node lines through this function.
+ *
+ *  @param p Points to the current position, advanced past the line.
+ *  @param end The end of the text.
+ *  @param v Receives the lower bound, the upper bound and the count.
+ *
+ *  @return `false` at the end of the text or on a malformed line, with
+ *          `*p` left unchanged.
+ */
+bool parse_node_line(const char **p, const char *end, size_t v[3]);
+
+/**
+ *  @brief Serializes a QDigest like to_string(), encoding subtrees in parallel.
+ *
+ *  The tree is cut at depth `split_depth`. The nodes above the cut and
+ *  each subtree below it are encoded concurrently (OpenMP) into buffers
+ *  of their own; an offset table computed from their lengths then tells
+ *  every buffer where it lands in `buf`, and they are copied in parallel.
+ *
+ *  The output is byte for byte the one of to_string(), so it can be
+ *  read back by from_string() as well as by from_string_parallel().
+ *
+ *  @param q A pointer to the QDigest to serialize.
+ *  @param buf The output buffer, large enough for to_string().
+ *  @param buf_length Set to the number of characters written.
+ *  @param split_depth Depth of the cut, clamped to [0, PARALLEL_MAX_SPLIT_DEPTH].
+ *           Up to 2^split_depth subtrees are encoded independently.
+ */
+void to_string_parallel(struct QDigest *q, char *buf, size_t *buf_length,
+                        int split_depth);
+
+/**
+ *  @brief Deserializes a QDigest like from_string(), rebuilding subtrees in parallel.
+ *
+ *  The node lines are cut into chunks at line boundaries and parsed
+ *  concurrently. Every node is then routed to the subtree at depth
+ *  `split_depth` that holds it; the subtrees are rebuilt in parallel as
+ *  separate digests and finally stitched under the nodes above the cut.
+ *
+ *  The result is the tree from_string() builds from the same text; the
+ *  node lines do not need to be in preorder.
+ *
+ *  @param buf A null-terminated string produced by to_string() or
+ *           to_string_parallel().
+ *  @param split_depth Depth of the cut, clamped to [0, PARALLEL_MAX_SPLIT_DEPTH].
+ *           A depth of 0, or one deeper than the universe, falls back to
+ *           from_string().
+ *
+ *  @return A newly allocated QDigest, or NULL if the header is invalid.
+ */
+struct QDigest *from_string_parallel(char *buf, int split_depth);
+
+/**
+ *  @brief Upper bound on the size of the text written by to_delta().
+ *
+ *  @param q A pointer to the QDigest.
+ */
+size_t delta_max_size(const struct QDigest *q);
+
+/**
+ *  @brief Serializes the changes made to a QDigest since a given version.
+ *
+ *  Every change to a node count is stamped with the current version of
+ *  the digest. The delta holds the node ranges removed after
+ *  `base_version` and the absolute counts of the nodes changed after
+ *  it, so applying it to a replica at `base_version` brings the replica
+ *  to the current state. Each call closes the current version and
+ *  returns it: passing that value as `base_version` next time yields
+ *  only what changed in between.
+ *
+ *  The header line is:
+ *    "<version> <base_version> <full> <total_count> <K> <root_lower_bound> <root_upper_bound>\n"
+ *  followed by the removed ranges as "<lower_bound> <upper_bound> 0\n"
+ *  and the changed nodes, in preorder, as "<lower_bound> <upper_bound> <count>\n".
+ *
+ *  A `base_version` of 0, or one older than the tombstones still kept
+ *  (see trim_tombstones()), gives a full delta: `full` is 1 and the
+ *  lines are those of to_string().
+ *
+ *  @param q A pointer to the QDigest.
+ *  @param base_version The version the receiver is known to hold.
+ *  @param buf The output buffer, at least delta_max_size(q) characters.
+ *  @param buf_length Set to the number of characters written.
+ *
+ *  @return The version the receiver holds once the delta is applied.
+ *
+ *  @note A digest in COMPRESS_MANUAL mode is compressed with
+ *        compress_now() before it is written.
+ */
+uint64_t to_delta(struct QDigest *q, uint64_t base_version, char *buf,
+                  size_t *buf_length);
+
+/**
+ *  @brief Applies a delta produced by to_delta() to a replica.
+ *
+ *  The replica must hold the state at the delta's base version, unless
+ *  the delta is full, in which case its previous content is dropped.
+ *  Counts are set rather than added, so the replica is not compressed
+ *  and ends up with the same nodes and counts as the sender.
+ *
+ *  @param q A pointer to the replica.
+ *  @param buf A null-terminated delta.
+ *
+ *  @return The version of the sender the replica now matches, or 0 if
+ *          the header is invalid or does not fit the replica's universe.
+ */
+uint64_t apply_delta(struct QDigest *q, const char *buf);
+
+/**
+ *  @brief Drops the tombstones every receiver has already seen.
+ *
+ *  Call it with the oldest version still held by any receiver. Deltas
+ *  from an older base version become full deltas afterwards. The log
+ *  also trims itself, the same way, once it holds more tombstones than
+ *  the digest has nodes.
+ *
+ *  @param q A pointer to the QDigest.
+ *  @param acked_version The oldest version held by a receiver.
+ */
+void trim_tombstones(struct QDigest *q, uint64_t acked_version);
+
 #endif
@@ -0,0 +1,119 @@
+/*! \file qdecay.h
+ *  \brief A forward-decay (exponentially time-weighted) Q-Digest.
+ *
+ *  Forward decay weights an item inserted at time t by
+ *  g(t - L) = exp(lambda * (t - L)), where L is a fixed landmark time.
+ *  Because the weight only depends on the insertion time, it can be
+ *  computed once on insert and never revisited: at query time every
+ *  count would have to be divided by g(now - L), and since quantiles
+ *  are invariant under a uniform scaling of the counts, percentile()
+ *  can be applied to the digest as is.
+ *
+ *  Counts are stored as fixed-point numbers with DECAY_FIXED_SHIFT
+ *  fractional bits in the regular size_t counts of a struct QDigest,
+ *  so the existing insert_weighted()/compress() machinery is reused
+ *  unchanged. The weights grow with time, therefore the landmark is
+ *  moved forward lazily: once t - L would produce weights above
+ *  2^DECAY_MAX_GROWTH_LOG2, all counts are rescaled in one bulk pass
+ *  over the tree and counts that decayed to zero are dropped.
+ *
+ */
+
+#ifndef QDECAY
+#define QDECAY
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Number of fractional bits of the fixed-point counts. */
+#define DECAY_FIXED_SHIFT 16
+
+/** Log2 of the largest growth factor allowed before a rescale. */
+#define DECAY_MAX_GROWTH_LOG2 20
+
+/**
+ *  @brief A struct representing a forward-decay Q-Digest.
+ */
+struct QDecay {
+  struct QDigest *q;            /**< The digest holding fixed-point decayed counts. */
+  double lambda;                /**< Decay rate, per time unit. */
+  double landmark;              /**< The landmark time L weights are relative to. */
+  double horizon;               /**< Maximum t - L before the counts are rescaled. */
+};
+
+/**
+ *  @brief Creates a forward-decay digest.
+ *
+ *  @param K The compression parameter of the underlying digest.
+ *
+ *  @param upper_bound The initial universe upper bound.
+ *
+ *  @param half_life The time after which an item weighs half as much
+ *  as a fresh one. Must be positive.
+ *
+ *  @param start The initial landmark time, typically the current time.
+ *
+ *  @return A pointer to the new digest, freed with delete_decay().
+ */
+struct QDecay *create_decay(size_t K, size_t upper_bound, double half_life,
+                            double start);
+
+/**
+ *  @brief Frees a forward-decay digest and its underlying QDigest.
+ *
+ *  @param d A pointer to the digest to destroy.
+ */
+void delete_decay(struct QDecay *d);
+
+/**
+ *  @brief Inserts a value observed at time `t`.
+ *
+ *  The value is recorded with weight exp(lambda * (t - L)) in fixed
+ *  point. If `t` is beyond the rescaling horizon, decay_rescale() is
+ *  run first.
+ *
+ *  @param d A pointer to the forward-decay digest.
+ *
+ *  @param key The value to insert.
+ *
+ *  @param t The time of the observation. Times may arrive slightly out
+ *  of order; older items simply get a smaller weight.
+ *
+ *  @return `false` if a count saturated, `true` otherwise.
+ */
+bool decay_insert(struct QDecay *d, size_t key, double t);
+
+/**
+ *  @brief Moves the landmark to `t` and rescales every count by
+ *  exp(-lambda * (t - L)) in a single pass over the tree.
+ *
+ *  Subtree counts and N are rebuilt on the way, and nodes whose count
+ *  decayed to zero are removed by the following compress_now().
+ *
+ *  @param d A pointer to the forward-decay digest.
+ *
+ *  @param t The new landmark. Must not precede the current landmark.
+ */
+void decay_rescale(struct QDecay *d, double t);
+
+/**
+ *  @brief Returns the approximate p-th percentile of the decayed
+ *  distribution.
+ *
+ *  @param d A pointer to the forward-decay digest.
+ *
+ *  @param p A percentile in the range [0, 1].
+ */
+size_t decay_percentile(struct QDecay *d, double p);
+
+/**
+ *  @brief Returns the total decayed weight as seen at time `t`, i.e.
+ *  the sum of exp(-lambda * (t - t_i)) over the recorded items.
+ *
+ *  @param d A pointer to the forward-decay digest.
+ *
+ *  @param t The time at which the weight is evaluated.
+ */
+double decay_total(struct QDecay *d, double t);
+
+#endif
@@ -0,0 +1,167 @@
+/*! \file qhybrid.h
+ *  \brief A Q-Digest that stays exact while it holds few values.
+ *
+ *  Most digests of a large population (one per endpoint, per interval)
+ *  only ever see a few hundred values, yet a struct QDigest builds a
+ *  pointer tree for them from the first insert. A struct QHybrid starts
+ *  out as a small array of (value, count) entries instead: inserts are
+ *  appended, and the array is sorted and its duplicates folded only
+ *  when a query needs it or when it fills up. Percentiles and ranks are
+ *  then exact.
+ *
+ *  Once more than `limit` distinct values have been seen, the digest
+ *  is promoted for good: the sorted entries become leaves of a new tree
+ *  in one bulk build (merge_flat()) followed by a single compression
+ *  pass, and every later call is forwarded to the tree.
+ *
+ *  Serialization uses the text format of to_string() in both states,
+ *  an exact digest being written as leaf nodes, so from_string() reads
+ *  either one.
+ *
+ */
+
+#ifndef QHYBRID
+#define QHYBRID
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Distinct values kept exactly by default before promotion. */
+#define HYBRID_DEFAULT_LIMIT 256
+
+/**
+ *  @brief A value and the number of times it was inserted.
+ */
+struct ExactEntry {
+  size_t value;                 /**< The inserted value. */
+  size_t count;                 /**< Its total count. */
+};
+
+/**
+ *  @brief A struct representing a digest with an exact small-N state.
+ */
+struct QHybrid {
+  struct QDigest *q;            /**< The tree once promoted, NULL while exact. */
+  struct ExactEntry *entries;   /**< The exact values, while not promoted. */
+  size_t len;                   /**< Number of entries. */
+  size_t capacity;              /**< Allocated entries, grown up to `limit`. */
+  size_t limit;                 /**< Most distinct values kept before promotion. */
+  bool sorted;                  /**< The entries are sorted and have no duplicates. */
+  size_t N;                     /**< Total count of the exact entries. */
+  size_t K;                     /**< Compression parameter of the tree. */
+  size_t upper_bound;           /**< Universe upper bound the tree will get. */
+};
+
+/**
+ *  @brief Creates an empty digest in the exact state.
+ *
+ *  @param K The compression parameter of the tree it may be promoted to.
+ *
+ *  @param upper_bound The initial universe upper bound, rounded up to
+ *  the next power of two minus one so that digests over different
+ *  universes can be merged. Like insert(), larger values grow it.
+ *
+ *  @param limit The number of distinct values kept exactly, for
+ *  instance HYBRID_DEFAULT_LIMIT. 0 promotes on the first insert.
+ *
+ *  @return A pointer to the new digest, freed with delete_hybrid().
+ */
+struct QHybrid *create_hybrid(size_t K, size_t upper_bound, size_t limit);
+
+/**
+ *  @brief Frees a digest created by create_hybrid() or hybrid_from_string().
+ *
+ *  @param h A pointer to the digest.
+ */
+void delete_hybrid(struct QHybrid *h);
+
+/**
+ *  @brief Tells whether the digest is still in the exact state.
+ *
+ *  @param h A pointer to the digest.
+ */
+bool hybrid_is_exact(const struct QHybrid *h);
+
+/**
+ *  @brief Inserts `count` occurrences of `key`, promoting the digest
+ *  once it holds more than `limit` distinct values.
+ *
+ *  @param h A pointer to the digest.
+ *  @param key The value to insert.
+ *  @param count The number of occurrences.
+ */
+void hybrid_insert(struct QHybrid *h, size_t key, unsigned int count);
+
+/**
+ *  @brief Promotes the digest to a tree if it is not one yet.
+ *
+ *  @param h A pointer to the digest.
+ *
+ *  @return The tree, owned by `h`, for use with the rest of qcore.h.
+ */
+struct QDigest *hybrid_digest(struct QHybrid *h);
+
+/**
+ *  @brief The p-th percentile, as percentile() would compute it.
+ *
+ *  In the exact state this is the smallest inserted value v such that
+ *  the values up to v have a total count of at least p * N.
+ *
+ *  @param h A pointer to the digest.
+ *  @param p The percentile, in [0, 1].
+ */
+size_t hybrid_percentile(struct QHybrid *h, double p);
+
+/**
+ *  @brief The total count of the values lower than or equal to `value`,
+ *  as rank() would compute it.
+ *
+ *  @param h A pointer to the digest.
+ *  @param value The value.
+ */
+size_t hybrid_rank(struct QHybrid *h, size_t value);
+
+/**
+ *  @brief Adds the contents of `h2` to `h1`.
+ *
+ *  Two exact digests stay exact as long as their union fits in the
+ *  limit of `h1`. An exact `h2` is added to a promoted `h1` in one bulk
+ *  pass; a promoted `h2` promotes `h1` and the trees are merged with
+ *  merge().
+ *
+ *  @param h1 A pointer to the destination digest.
+ *  @param h2 A pointer to the source digest, which is not modified.
+ */
+void hybrid_merge(struct QHybrid *h1, const struct QHybrid *h2);
+
+/**
+ *  @brief Size of a buffer large enough for hybrid_to_string().
+ *
+ *  @param h A pointer to the digest.
+ */
+size_t hybrid_max_string(const struct QHybrid *h);
+
+/**
+ *  @brief Serializes the digest in the text format of to_string().
+ *
+ *  @param h A pointer to the digest.
+ *  @param buf The output, at least hybrid_max_string(h) bytes.
+ *  @param buf_length Set to the number of bytes written.
+ */
+void hybrid_to_string(struct QHybrid *h, char *buf, size_t *buf_length);
+
+/**
+ *  @brief Rebuilds a digest from the output of hybrid_to_string() or
+ *  to_string().
+ *
+ *  Texts made only of leaves, at most `limit` of them, give an exact
+ *  digest; anything else goes through from_string().
+ *
+ *  @param buf The NUL terminated text.
+ *  @param limit The limit of the new digest.
+ *
+ *  @return A new digest, or NULL if the header is malformed.
+ */
+struct QHybrid *hybrid_from_string(char *buf, size_t limit);
+
+#endif
@@ -0,0 +1,166 @@
+/*! \file qkeymap.h
+ *  \brief Order-preserving maps from wide-range values to small keys.
+ *
+ *  Keys are size_t and the universe of a digest grows by powers of two,
+ *  so a metric with a wide dynamic range (latencies in nanoseconds,
+ *  sizes in bytes) builds trees of 35 to 64 levels, most of them spent
+ *  telling apart values no one needs to tell apart. Both maps below
+ *  keep the leading `bits` bits of a value and drop the rest, as a
+ *  floating-point number does with its mantissa:
+ *
+ *   - log_key() maps an integer to its exponent and the `bits` bits
+ *     that follow its leading one. Values below 2^bits keep their own
+ *     key, so small values stay exact. All of size_t fits in
+ *     (65 - bits) * 2^bits keys: 13 levels instead of 64 for bits = 7.
+ *
+ *   - a struct KeyMap does the same for doubles in [min_value,
+ *     max_value], straight from their IEEE 754 representation, which
+ *     is ordered like the values themselves for non-negative numbers.
+ *     Magnitudes below min_value share the key of zero, and negative
+ *     values can be mapped as well, mirrored below it.
+ *
+ *  Both maps are monotonic, so the percentile of the keys is the key
+ *  of the percentile, and the inverse maps give back the middle of the
+ *  range of values sharing that key. The relative error they add is at
+ *  most 2^-(bits + 1) on top of the error of the digest.
+ *
+ */
+
+#ifndef QKEYMAP
+#define QKEYMAP
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default number of bits kept: relative error below 0.4%. */
+#define KEYMAP_DEFAULT_BITS 7
+
+/**
+ *  @brief A map from doubles to keys in [0, keymap_upper_bound()].
+ */
+struct KeyMap {
+  unsigned bits;                /**< Mantissa bits kept, at most 52. */
+  double min_value;             /**< Smallest magnitude told apart from zero. */
+  double max_value;             /**< Largest magnitude, larger ones are clamped. */
+  bool negative;                /**< Negative values have keys of their own. */
+  uint64_t base;                /**< Leading bits of min_value. */
+  size_t span;                  /**< Keys per sign, zero excluded. */
+};
+
+/**
+ *  @brief The key of an integer, keeping `bits` bits after its leading one.
+ *
+ *  @param value The value.
+ *  @param bits The number of bits kept, lower than the width of size_t.
+ */
+size_t log_key(size_t value, unsigned bits);
+
+/**
+ *  @brief The value in the middle of the range mapped to `key` by log_key().
+ *
+ *  @param key A key returned by log_key().
+ *  @param bits The number of bits given to log_key().
+ */
+size_t log_value(size_t key, unsigned bits);
+
+/**
+ *  @brief The largest key log_key() returns.
+ *
+ *  @param bits The number of bits given to log_key().
+ */
+size_t log_upper_bound(unsigned bits);
+
+/**
+ *  @brief Inserts an integer under its log_key().
+ *
+ *  @param q A pointer to the QDigest, best created over
+ *  [0, log_upper_bound(bits)] or a smaller power of two.
+ *  @param value The value.
+ *  @param count The number of occurrences.
+ *  @param bits The number of bits kept.
+ */
+void insert_log(struct QDigest *q, size_t value, unsigned int count,
+                unsigned bits);
+
+/**
+ *  @brief The p-th percentile of a digest filled with insert_log().
+ *
+ *  @param q A pointer to the QDigest.
+ *  @param p The percentile, in [0, 1].
+ *  @param bits The number of bits given to insert_log().
+ */
+size_t percentile_log(struct QDigest *q, double p, unsigned bits);
+
+/**
+ *  @brief Sets up a map for doubles.
+ *
+ *  @param map The map to set up.
+ *  @param bits The number of mantissa bits kept, at most 52.
+ *  @param min_value The smallest positive magnitude told apart from zero.
+ *  @param max_value The largest magnitude, at least min_value and finite.
+ *  @param negative Whether negative values are mapped below zero; if
+ *  not, they share the key of zero.
+ *
+ *  @return false, and the map is left untouched, if the bounds are not
+ *  positive finite numbers with min_value <= max_value or bits > 52.
+ */
+bool keymap_init(struct KeyMap *map, unsigned bits, double min_value,
+                 double max_value, bool negative);
+
+/**
+ *  @brief The largest key of the map.
+ *
+ *  @param map A pointer to the map.
+ */
+size_t keymap_upper_bound(const struct KeyMap *map);
+
+/**
+ *  @brief The key of a double. NaN shares the key of zero.
+ *
+ *  @param map A pointer to the map.
+ *  @param x The value.
+ */
+size_t keymap_key(const struct KeyMap *map, double x);
+
+/**
+ *  @brief The value in the middle of the range mapped to `key`.
+ *
+ *  @param map A pointer to the map.
+ *  @param key A key returned by keymap_key().
+ */
+double keymap_value(const struct KeyMap *map, size_t key);
+
+/**
+ *  @brief Inserts a double under its keymap_key().
+ *
+ *  @param q A pointer to the QDigest, best created over
+ *  [0, keymap_upper_bound(map)].
+ *  @param map A pointer to the map.
+ *  @param x The value.
+ *  @param count The number of occurrences.
+ */
+void insert_double(struct QDigest *q, const struct KeyMap *map, double x,
+                   unsigned int count);
+
+/**
+ *  @brief The p-th percentile of a digest filled with insert_double().
+ *
+ *  @param q A pointer to the QDigest.
+ *  @param map The map given to insert_double().
+ *  @param p The percentile, in [0, 1].
+ */
+double percentile_double(struct QDigest *q, const struct KeyMap *map,
+                         double p);
+
+/**
+ *  @brief The total count of the values whose key is at most the key
+ *  of `x`, as rank() computes it.
+ *
+ *  @param q A pointer to the QDigest.
+ *  @param map The map given to insert_double().
+ *  @param x The value.
+ */
+size_t rank_double(struct QDigest *q, const struct KeyMap *map, double x);
+
+#endif
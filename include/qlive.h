@@ -0,0 +1,112 @@
+/*! \file qlive.h
+ *  \brief A Q-Digest fed by one writer thread and read by any number
+ *  of reader threads through immutable snapshots.
+ *
+ *  A struct QDigest is not safe to query while it is being modified:
+ *  insert() relinks nodes and compress() frees them. A struct QLive
+ *  keeps the digest private to the writer thread and publishes it to
+ *  readers as a struct QView, an immutable flat snapshot in the format
+ *  of qsnapshot.h (one allocation, one preorder pass over a tree that
+ *  compression keeps small). qdigest_snapshot() hands out the latest
+ *  view and the snapshot_* queries run on it without any lock.
+ *
+ *  Views are reference counted. Publishing swaps the current view
+ *  under a mutex held for a few instructions; the view it replaces is
+ *  freed by whichever thread drops the last reference, so a reader
+ *  walking an old view never holds up the writer, and inserts never
+ *  take the mutex at all.
+ *
+ *  Readers see the digest as of the last publication: every
+ *  `publish_every` inserts, and whenever the writer calls
+ *  live_publish().
+ *
+ */
+
+#ifndef QLIVE
+#define QLIVE
+#include "../include/qcore.h"
+#include "../include/qsnapshot.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  @brief An immutable snapshot of a struct QLive.
+ */
+struct QView {
+  struct QSnapshot *snap;       /**< The snapshot, for the snapshot_* queries. */
+  void *buf;                    /**< The encoded snapshot `snap` points into. */
+  uint64_t serial;              /**< Publication number, increasing from 1. */
+  size_t refs;                  /**< References held, guarded by the QLive mutex. */
+};
+
+/**
+ *  @brief A struct representing a digest published to concurrent readers.
+ */
+struct QLive {
+  struct QDigest *q;            /**< The digest, owned by the writer thread. */
+  struct QView *current;        /**< The latest view, guarded by `lock`. */
+  pthread_mutex_t lock;         /**< Guards `current` and the view references. */
+  size_t publish_every;         /**< Inserts between publications, 0 for live_publish() only. */
+  size_t unpublished;           /**< Inserts since the last publication. */
+  uint64_t serial;              /**< Serial of the latest view. */
+};
+
+/**
+ *  @brief Creates a digest with an empty view published.
+ *
+ *  @param K The compression parameter of the digest.
+ *  @param upper_bound The initial universe upper bound.
+ *  @param publish_every The number of inserts after which live_insert()
+ *  publishes a view, or 0 to publish only on live_publish().
+ *
+ *  @return A pointer to the new digest, freed with delete_live().
+ */
+struct QLive *create_live(size_t K, size_t upper_bound, size_t publish_every);
+
+/**
+ *  @brief Frees the digest and its current view. Every view taken with
+ *  qdigest_snapshot() must have been released.
+ *
+ *  @param l A pointer to the digest.
+ */
+void delete_live(struct QLive *l);
+
+/**
+ *  @brief Inserts a value, publishing a view every `publish_every`
+ *  inserts. Writer thread only.
+ *
+ *  @param l A pointer to the digest.
+ *  @param key The value.
+ *  @param count The number of occurrences.
+ */
+void live_insert(struct QLive *l, size_t key, unsigned int count);
+
+/**
+ *  @brief Publishes the current state of the digest. Writer thread
+ *  only; call it as well after changing `q` with the rest of qcore.h.
+ *
+ *  @param l A pointer to the digest.
+ */
+void live_publish(struct QLive *l);
+
+/**
+ *  @brief Returns the latest view. Safe from any thread.
+ *
+ *  @param l A pointer to the digest.
+ *
+ *  @return The view, which stays valid and unchanged until it is given
+ *  to view_release().
+ */
+struct QView *qdigest_snapshot(struct QLive *l);
+
+/**
+ *  @brief Drops a reference taken by qdigest_snapshot(), freeing the
+ *  view if it was the last one. Safe from any thread.
+ *
+ *  @param l The digest the view was taken from.
+ *  @param v The view.
+ */
+void view_release(struct QLive *l, struct QView *v);
+
+#endif
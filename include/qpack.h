@@ -0,0 +1,141 @@
+/*! \file qpack.h
+ *  \brief Optional block compression for serialized Q-Digests.
+ *
+ *  A packed buffer is a small header followed by a payload. The payload
+ *  is either the raw bytes or the bytes compressed with a self-contained
+ *  LZ77 codec that writes the LZ4 block format (token, literals, 16-bit
+ *  offset, extended lengths), so it needs no external library.
+ *
+ *  Inputs below a threshold are stored raw, and so is any input that
+ *  would not shrink: small digests never pay for the codec. The header
+ *  flag tells readers which case they are looking at.
+ *
+ *  The header is stored in the byte order of the writer, like the
+ *  snapshot format of qsnapshot.h.
+ *
+ */
+
+#ifndef QPACK
+#define QPACK
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Magic bytes opening every packed buffer. */
+#define PACK_MAGIC "QDPK"
+
+/** Header flag: the payload is LZ compressed. */
+#define PACK_FLAG_LZ 1u
+
+/** Inputs shorter than this are stored raw by default. */
+#define PACK_DEFAULT_THRESHOLD 4096
+
+/**
+ *  @brief The header of a packed buffer.
+ */
+struct PackHeader {
+  char magic[4];                /**< PACK_MAGIC, not NUL terminated. */
+  uint32_t flags;               /**< PACK_FLAG_LZ or 0 for a raw payload. */
+  uint64_t raw_len;             /**< Length of the original bytes. */
+  uint64_t payload_len;         /**< Length of the payload after the header. */
+};
+
+/**
+ *  @brief Worst-case size of lz_compress() output for len input bytes.
+ *
+ *  @param len The input length.
+ */
+size_t lz_bound(size_t len);
+
+/**
+ *  @brief Compresses a block in the LZ4 block format.
+ *
+ *  @param src The input bytes.
+ *  @param len The input length.
+ *  @param dst The output, at least lz_bound(len) bytes.
+ *
+ *  @return The number of bytes written to dst.
+ */
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst);
+
+/**
+ *  @brief Decompresses a block written by lz_compress().
+ *
+ *  Every offset and length is checked against both buffers, so a
+ *  corrupted block is rejected instead of overrunning them.
+ *
+ *  @param src The compressed block.
+ *  @param len The length of the block.
+ *  @param dst The output buffer.
+ *  @param raw_len The expected decompressed length, the size of dst.
+ *
+ *  @return true if the block decompressed to exactly raw_len bytes.
+ */
+bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                   size_t raw_len);
+
+/**
+ *  @brief Worst-case size of a packed buffer for len input bytes.
+ *
+ *  @param len The input length.
+ */
+size_t pack_bound(size_t len);
+
+/**
+ *  @brief Packs bytes, compressing them when it pays off.
+ *
+ *  @param src The input bytes.
+ *  @param len The input length.
+ *  @param dst The output, at least pack_bound(len) bytes.
+ *  @param threshold Inputs shorter than this are stored raw.
+ *
+ *  @return The number of bytes written to dst.
+ */
+size_t pack(const void *src, size_t len, void *dst, size_t threshold);
+
+/**
+ *  @brief Tells whether a buffer starts with a valid packed header.
+ *
+ *  @param buf The buffer.
+ *  @param len The length of the buffer.
+ */
+bool is_packed(const void *buf, size_t len);
+
+/**
+ *  @brief Unpacks a buffer written by pack() into a new allocation.
+ *
+ *  One extra NUL byte is appended after the raw bytes, so that text
+ *  produced by to_string() can be parsed in place.
+ *
+ *  @param buf The packed buffer.
+ *  @param len The length of the packed buffer.
+ *  @param raw_len Set to the length of the unpacked bytes.
+ *
+ *  @return The unpacked bytes, to be released with free(), or NULL if
+ *          the buffer is malformed.
+ */
+void *unpack_alloc(const void *buf, size_t len, size_t *raw_len);
+
+/**
+ *  @brief Serializes a QDigest with to_string() and packs the text.
+ *
+ *  @param q A pointer to the QDigest.
+ *  @param threshold Texts shorter than this are stored raw.
+ *  @param packed_len Set to the length of the returned buffer.
+ *
+ *  @return The packed buffer, to be released with free().
+ */
+void *to_packed(struct QDigest *q, size_t threshold, size_t *packed_len);
+
+/**
+ *  @brief Rebuilds a QDigest from a buffer written by to_packed().
+ *
+ *  @param buf The packed buffer.
+ *  @param len The length of the packed buffer.
+ *
+ *  @return A new QDigest, or NULL if the buffer is malformed.
+ */
+struct QDigest *from_packed(const void *buf, size_t len);
+
+#endif
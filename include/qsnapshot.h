@@ -0,0 +1,258 @@
+/*! \file qsnapshot.h
+ *  \brief A flat, position-independent on-disk format for Q-Digests
+ *  that can be memory-mapped and queried without deserialization.
+ *
+ *  A snapshot is a fixed-size header followed by an array of nodes in
+ *  preorder, the root being node 0. Children are referenced by their
+ *  index in the array rather than by pointer, so the same bytes are
+ *  valid at any address: a snapshot file can be `mmap`ed and handed
+ *  directly to snapshot_percentile(), snapshot_rank() or
+ *  snapshot_export_cdf(). Every node carries its subtree count, which
+ *  keeps rank queries at O(log U).
+ *
+ *  A struct QMapped wraps a mapped snapshot and turns it into a mutable
+ *  struct QDigest (copy-on-write) only when the first insert arrives.
+ *
+ *  All integers are stored as uint64_t in the byte order of the writer;
+ *  readers reject snapshots written with a different byte order.
+ *
+ */
+
+#ifndef QSNAPSHOT
+#define QSNAPSHOT
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Magic bytes opening every snapshot. */
+#define SNAPSHOT_MAGIC "QDSNAP01"
+
+/** Value written in the header to detect byte order mismatches. */
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+
+/** Index used in place of a missing child. The root is never a child. */
+#define SNAPSHOT_NO_CHILD 0
+
+/**
+ *  @brief The header of a snapshot.
+ */
+struct QSnapshotHeader {
+  char magic[8];                /**< SNAPSHOT_MAGIC, not NUL terminated. */
+  uint64_t byte_order;          /**< SNAPSHOT_BYTE_ORDER as seen by the writer. */
+  uint64_t N;                   /**< Total count of the digest. */
+  uint64_t K;                   /**< Compression parameter of the digest. */
+  uint64_t num_nodes;           /**< Number of entries in the node array. */
+  uint64_t reserved;            /**< Always 0, keeps the node array 16-byte aligned. */
+};
+
+/**
+ *  @brief A node of a snapshot, the flat counterpart of QDigestNode.
+ */
+struct QSnapshotNode {
+  uint64_t lower_bound;         /**< Lower bound of covered range. */
+  uint64_t upper_bound;         /**< Upper bound of covered range. */
+  uint64_t count;               /**< Number of items aggregated. */
+  uint64_t subtree_count;       /**< Sum of count over the node and its descendants. */
+  uint64_t left;                /**< Index of the left child, or SNAPSHOT_NO_CHILD. */
+  uint64_t right;               /**< Index of the right child, or SNAPSHOT_NO_CHILD. */
+};
+
+/**
+ *  @brief A read-only view on a snapshot, either memory-mapped from a
+ *  file or pointing into a caller-owned buffer.
+ */
+struct QSnapshot {
+  const struct QSnapshotHeader *hdr;    /**< The snapshot header. */
+  const struct QSnapshotNode *nodes;    /**< The node array, root first. */
+  void *map;                            /**< Start of the mapping, NULL for buffer views. */
+  size_t map_len;                       /**< Length of the mapping. */
+};
+
+/**
+ *  @brief A digest that is served from a snapshot until it is modified.
+ */
+struct QMapped {
+  struct QSnapshot *snap;       /**< The mapped snapshot, NULL once thawed. */
+  struct QDigest *q;            /**< The mutable digest, NULL until the first insert. */
+};
+
+/**
+ *  @brief Returns the number of bytes snapshot_encode() needs for `q`.
+ *
+ *  @param q A pointer to the QDigest to be encoded.
+ */
+size_t snapshot_size(const struct QDigest *q);
+
+/**
+ *  @brief Encodes a QDigest as a snapshot.
+ *
+ *  @param q A pointer to the QDigest to encode.
+ *
+ *  @param buf A buffer of at least snapshot_size(q) bytes, aligned for
+ *  uint64_t.
+ *
+ *  @return The number of bytes written.
+ */
+size_t snapshot_encode(const struct QDigest *q, void *buf);
+
+/**
+ *  @brief Writes a QDigest as a snapshot file.
+ *
+ *  @param q A pointer to the QDigest to save.
+ *
+ *  @param path The path of the file, created or truncated.
+ *
+ *  @return 0 on success, -1 on I/O errors.
+ */
+int snapshot_write(const struct QDigest *q, const char *path);
+
+/**
+ *  @brief Memory-maps a snapshot file for querying.
+ *
+ *  Only the header is validated; child indices are checked as the
+ *  nodes are visited, so opening is O(1) whatever the snapshot size.
+ *
+ *  @param path The path of a file written by snapshot_write().
+ *
+ *  @return A pointer to the view, or NULL if the file cannot be mapped
+ *          or is not a valid snapshot. Release it with snapshot_close().
+ */
+struct QSnapshot *snapshot_open(const char *path);
+
+/**
+ *  @brief Creates a view on a snapshot held in memory.
+ *
+ *  @param buf The encoded snapshot, aligned for uint64_t. It must
+ *  outlive the view.
+ *
+ *  @param len The length of the buffer.
+ *
+ *  @return A pointer to the view, or NULL if the buffer is not a valid
+ *          snapshot. Release it with snapshot_close().
+ */
+struct QSnapshot *snapshot_view(const void *buf, size_t len);
+
+/**
+ *  @brief Releases a view, unmapping its file if needed.
+ *
+ *  @param s A pointer to the view.
+ */
+void snapshot_close(struct QSnapshot *s);
+
+/**
+ *  @brief Computes a percentile directly on a snapshot, with the same
+ *  semantics as percentile().
+ *
+ *  @param s A pointer to the view.
+ *
+ *  @param p A percentile in the range [0, 1].
+ */
+size_t snapshot_percentile(const struct QSnapshot *s, double p);
+
+/**
+ *  @brief Computes rank() directly on a snapshot in O(log U).
+ *
+ *  @param s A pointer to the view.
+ *
+ *  @param value The value whose rank is requested.
+ */
+size_t snapshot_rank(const struct QSnapshot *s, size_t value);
+
+/**
+ *  @brief Computes export_cdf() directly on a snapshot.
+ *
+ *  @param s A pointer to the view.
+ *
+ *  @param bounds The output array of upper bounds.
+ *
+ *  @param cum_counts The output array of cumulative counts.
+ *
+ *  @param max_buckets The capacity of both output arrays.
+ *
+ *  @return The number of points written.
+ */
+size_t snapshot_export_cdf(const struct QSnapshot *s, size_t *bounds,
+                           size_t *cum_counts, size_t max_buckets);
+
+/**
+ *  @brief Rebuilds a mutable QDigest from a snapshot.
+ *
+ *  The node array is linked back into a pointer tree in a single pass;
+ *  no node is re-inserted through insert_node().
+ *
+ *  @param s A pointer to the view.
+ *
+ *  @return A newly allocated QDigest, freed with delete_qdigest().
+ */
+struct QDigest *snapshot_thaw(const struct QSnapshot *s);
+
+/**
+ *  @brief Same as snapshot_thaw(), but the nodes are taken from `pool`.
+ *
+ *  @param s A pointer to the view.
+ *
+ *  @param pool The NodePool providing the nodes, or NULL for malloc.
+ *
+ *  @return A newly allocated QDigest backed by `pool`.
+ */
+struct QDigest *snapshot_thaw_pooled(const struct QSnapshot *s,
+                                     struct NodePool *pool);
+
+/**
+ *  @brief Opens a snapshot file as a lazily thawed digest.
+ *
+ *  @param path The path of a file written by snapshot_write().
+ *
+ *  @return A pointer to the digest, or NULL if the file is not a valid
+ *          snapshot. Release it with mapped_close().
+ */
+struct QMapped *mapped_open(const char *path);
+
+/**
+ *  @brief Returns the mutable digest behind a QMapped, thawing the
+ *  snapshot and dropping the mapping on first use.
+ *
+ *  @param m A pointer to the lazily thawed digest.
+ */
+struct QDigest *mapped_digest(struct QMapped *m);
+
+/**
+ *  @brief Inserts a value, thawing the snapshot first if needed.
+ *
+ *  @param m A pointer to the lazily thawed digest.
+ *
+ *  @param key The value to insert.
+ *
+ *  @param count How many occurrences of the value to insert.
+ */
+void mapped_insert(struct QMapped *m, size_t key, unsigned int count);
+
+/**
+ *  @brief Computes a percentile from the snapshot or, once thawed,
+ *  from the mutable digest.
+ *
+ *  @param m A pointer to the lazily thawed digest.
+ *
+ *  @param p A percentile in the range [0, 1].
+ */
+size_t mapped_percentile(struct QMapped *m, double p);
+
+/**
+ *  @brief Computes a rank from the snapshot or, once thawed, from the
+ *  mutable digest.
+ *
+ *  @param m A pointer to the lazily thawed digest.
+ *
+ *  @param value The value whose rank is requested.
+ */
+size_t mapped_rank(struct QMapped *m, size_t value);
+
+/**
+ *  @brief Releases a QMapped, its mapping and its digest.
+ *
+ *  @param m A pointer to the lazily thawed digest.
+ */
+void mapped_close(struct QMapped *m);
+
+#endif
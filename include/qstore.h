@@ -0,0 +1,210 @@
+/*! \file qstore.h
+ *  \brief A store of many named Q-Digests sharing node storage.
+ *
+ *  Services that keep one digest per (service, endpoint, status) key
+ *  end up with hundreds of thousands of tiny digests. The store keeps
+ *  their headers inline in open-addressing hash tables and carves
+ *  their nodes out of shared slabs (see node_pool.h), so a digest
+ *  costs one table slot plus its nodes, with no per-digest malloc().
+ *
+ *  The store is split into shards, each with its own table and its own
+ *  NodePool. A key always maps to the same shard for a given number of
+ *  shards, which lets store_merge() merge two stores shard by shard in
+ *  parallel without any locking.
+ *
+ *  The whole store is saved as one sequential buffer: a header and, for
+ *  every key, the key bytes followed by the digest in the snapshot
+ *  format of qsnapshot.h.
+ *
+ */
+
+#ifndef QSTORE
+#define QSTORE
+#include "../include/node_pool.h"
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Magic bytes opening a serialized store. */
+#define STORE_MAGIC "QDSTORE1"
+
+/** Number of nodes per slab of every shard pool. */
+#define STORE_SLAB_NODES 4096
+
+/**
+ *  @brief A slot of a shard table. Empty slots have a NULL key.
+ */
+struct QStoreEntry {
+  char *key;                    /**< NUL-terminated copy of the key, or NULL. */
+  uint64_t hash;                /**< Hash of the key. */
+  struct QDigest q;             /**< The digest, stored inline. */
+};
+
+/**
+ *  @brief A shard: an open-addressing table and the pool of its nodes.
+ */
+struct QStoreShard {
+  struct QStoreEntry *entries;  /**< Linear-probing table, `capacity` slots. */
+  size_t capacity;              /**< Number of slots, a power of two. */
+  size_t len;                   /**< Number of used slots. */
+  struct NodePool *pool;        /**< Pool shared by every digest of the shard. */
+};
+
+/**
+ *  @brief A store of named Q-Digests.
+ */
+struct QDigestStore {
+  struct QStoreShard *shards;   /**< The shards. */
+  size_t n_shards;              /**< Number of shards. */
+  size_t K;                     /**< Compression parameter of new digests. */
+  size_t upper_bound;           /**< Initial universe upper bound of new digests. */
+};
+
+/**
+ *  @brief The header of a serialized store.
+ */
+struct QStoreHeader {
+  char magic[8];                /**< STORE_MAGIC, not NUL terminated. */
+  uint64_t byte_order;          /**< SNAPSHOT_BYTE_ORDER as seen by the writer. */
+  uint64_t n_shards;            /**< Number of shards of the store. */
+  uint64_t K;                   /**< Compression parameter of new digests. */
+  uint64_t upper_bound;         /**< Initial universe upper bound of new digests. */
+  uint64_t n_entries;           /**< Number of (key, digest) records that follow. */
+};
+
+/**
+ *  @brief Creates an empty store.
+ *
+ *  @param n_shards The number of shards, i.e. the maximum parallelism
+ *  of store_merge(). At least 1.
+ *
+ *  @param K The compression parameter of the digests created by the store.
+ *
+ *  @param upper_bound The initial universe upper bound of those digests.
+ */
+struct QDigestStore *create_store(size_t n_shards, size_t K,
+                                  size_t upper_bound);
+
+/**
+ *  @brief Frees a store, its keys and all the node slabs at once.
+ *
+ *  @param s A pointer to the store.
+ */
+void delete_store(struct QDigestStore *s);
+
+/**
+ *  @brief Returns the number of keys in the store.
+ *
+ *  @param s A pointer to the store.
+ */
+size_t store_size(const struct QDigestStore *s);
+
+/**
+ *  @brief Looks up the digest of a key.
+ *
+ *  @param s A pointer to the store.
+ *
+ *  @param key The NUL-terminated key.
+ *
+ *  @return The digest, or NULL if the key is absent. The pointer stays
+ *          valid until a new key is added to the same shard.
+ */
+struct QDigest *store_get(struct QDigestStore *s, const char *key);
+
+/**
+ *  @brief Looks up the digest of a key, creating an empty one if the
+ *  key is absent.
+ *
+ *  @param s A pointer to the store.
+ *
+ *  @param key The NUL-terminated key.
+ *
+ *  @return The digest. The pointer stays valid until a new key is added
+ *          to the same shard.
+ */
+struct QDigest *store_get_or_create(struct QDigestStore *s, const char *key);
+
+/**
+ *  @brief Inserts a value into the digest of a key.
+ *
+ *  @param s A pointer to the store.
+ *
+ *  @param key The NUL-terminated key, created if absent.
+ *
+ *  @param value The value to insert.
+ *
+ *  @param count How many occurrences of the value to insert.
+ */
+void store_insert(struct QDigestStore *s, const char *key, size_t value,
+                  unsigned int count);
+
+/**
+ *  @brief Merges every digest of `src` into the digest with the same
+ *  key in `dst`, creating missing keys.
+ *
+ *  When both stores have the same number of shards, shards are merged
+ *  in parallel (OpenMP), each by a single thread.
+ *
+ *  @param dst A pointer to the destination store.
+ *
+ *  @param src A pointer to the source store, left unchanged.
+ */
+void store_merge(struct QDigestStore *dst, const struct QDigestStore *src);
+
+/**
+ *  @brief Returns the number of bytes store_serialize() needs.
+ *
+ *  @param s A pointer to the store.
+ */
+size_t store_serialized_size(const struct QDigestStore *s);
+
+/**
+ *  @brief Serializes the whole store into one contiguous buffer.
+ *
+ *  @param s A pointer to the store.
+ *
+ *  @param buf A buffer of at least store_serialized_size(s) bytes,
+ *  aligned for uint64_t.
+ *
+ *  @return The number of bytes written.
+ */
+size_t store_serialize(const struct QDigestStore *s, void *buf);
+
+/**
+ *  @brief Rebuilds a store from a buffer written by store_serialize().
+ *
+ *  @param buf The serialized store, aligned for uint64_t.
+ *
+ *  @param len The length of the buffer.
+ *
+ *  @return A new store, or NULL if the buffer is malformed.
+ */
+struct QDigestStore *store_deserialize(const void *buf, size_t len);
+
+/**
+ *  @brief Writes the serialized store to a file in a single write.
+ *
+ *  The bytes go through pack() (see qpack.h) with
+ *  PACK_DEFAULT_THRESHOLD, so large stores are LZ compressed.
+ *
+ *  @param s A pointer to the store.
+ *
+ *  @param path The path of the file, created or truncated.
+ *
+ *  @return 0 on success, -1 on I/O errors.
+ */
+int store_save(const struct QDigestStore *s, const char *path);
+
+/**
+ *  @brief Loads a store saved with store_save().
+ *
+ *  Both packed files and plain store_serialize() output are accepted.
+ *
+ *  @param path The path of the file.
+ *
+ *  @return A new store, or NULL if the file cannot be read or is malformed.
+ */
+struct QDigestStore *store_load(const char *path);
+
+#endif
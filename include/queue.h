@@ -16,40 +16,30 @@
  * */
 typedef struct QDigestNode *Item;
 
-/** 
- *  @brief The struct implementing a node in the queue.
- *
- * */
-struct queueNode {
-  Item val;                 /**< The value to be stored in the queue. */
-  struct queueNode *next;   /**< A pointer to the next queueNode. */
-};
+/** Capacity of a new queue; it doubles whenever it fills up. */
+#define QUEUE_INITIAL_CAPACITY 16
 
 /** 
  *  @brief The struct implementing a queue.
  *
+ *  The items live in a ring buffer whose capacity is a power of two.
+ *  The buffer grows when it is full and is never shrunk, so a queue
+ *  reused across traversals stops allocating once it has reached the
+ *  widest level it has to hold.
+ *
  * */
 struct queue {
-  struct queueNode *first;  /**< The pointer to the first node in the queue. */
-  struct queueNode *last;   /**< The pointer to the last node in the queue. */
+  Item *items;              /**< The ring buffer. */
+  size_t head;              /**< The index of the first item. */
   size_t len;               /**< A positive integer representing the length of the queue. */
+  size_t capacity;          /**< The size of the ring buffer, a power of two. */
 };
 
-/** 
- *  @brief This function allocates memory for a queueNode and initializes
- *  it to contain the specified value (`val`).
- *
- *  @param val A pointer to a QDigestNode to be added as a queueNode.
- *
- * */
-struct queueNode *create_queue_node(Item val);
-
 /**
  *  @brief Creates and initializes an empty queue.
  *
- *  This function allocates a new `struct queue` and initializes its fields
- *  so that it represents an empty FIFO queue. Both the `first` and `last`
- *  pointers are set to NULL, and the length is initialized to zero.
+ *  This function allocates a new `struct queue` with a ring buffer of
+ *  QUEUE_INITIAL_CAPACITY items, and a length of zero.
  *
  *  The queue is typically used to support breadth-first traversal of
  *  QDigest trees during operations such as merging.
@@ -64,58 +54,81 @@ struct queueNode *create_queue_node(Item val);
 struct queue *create_queue(void);
 
 /**
- *  @brief Enqueues a node at the end of a queue.
+ *  @brief Enqueues a value at the end of a queue.
  *
- *  This function appends a `struct queueNode` to the tail of the given
- *  queue. If the queue is currently empty, the new node becomes both the
- *  head and tail. Otherwise, it is linked to the existing last node and
- *  becomes the new tail.
+ *  The value is stored in the ring buffer, which doubles its capacity
+ *  first if it is full. No memory is allocated otherwise.
  *
- *  The node's `next` pointer is assumed to be properly initialized
- *  (typically NULL) by the caller or by the node creation function.
- *
- *  @param q A pointer to the queue into which the node will be inserted.
- *  @param n The node to enqueue. Must not be NULL.
+ *  @param q A pointer to the queue into which the value will be inserted.
+ *  @param val The value to enqueue.
  *
  *  @note This function increments the queue length counter.
  */
-void push(struct queue *q, struct queueNode *n);
+void push(struct queue *q, Item val);
+
+/**
+ *  @brief Enqueues several values at once, in order.
+ *
+ *  The buffer grows at most once, to fit all of them, and the values
+ *  are copied in at most two blocks.
+ *
+ *  @param q A pointer to the queue into which the values will be inserted.
+ *  @param vals The values to enqueue.
+ *  @param n The number of values.
+ */
+void push_n(struct queue *q, const Item *vals, size_t n);
 
 /**
  *  @brief Retrieves the value stored at the front of the queue.
  *
- *  This function returns the `val` field of the first node in the queue,
- *  without removing that node. It assumes that the queue is not empty;
- *  callers must ensure this (e.g., by checking `is_empty(q)` beforehand).
+ *  This function returns the first value in the queue, without removing
+ *  it. It assumes that the queue is not empty; callers must ensure this
+ *  (e.g., by checking `is_empty(q)` beforehand).
  *
  *  @param q A pointer to the queue whose front value is requested.
  *
- *  @return The value stored in the first node of the queue.
+ *  @return The value stored at the front of the queue.
  *
- *  @warning Calling this function on an empty queue results in
- *  dereferencing a NULL pointer and therefore undefined behavior.
+ *  @warning Calling this function on an empty queue returns a stale
+ *  value and is therefore undefined behavior.
  */
 Item front(struct queue *q);
 
 /**
  *  @brief Removes and returns the value at the front of the queue.
  *
- *  This function removes the first node from the queue, returns its stored
- *  value, and frees the node. The queue’s length and first/last pointers
- *  are updated accordingly.  
+ *  This function removes the first value from the queue and returns it.
+ *  The capacity of the queue is kept for later pushes.
  *
  *  If the queue is empty, the function prints an error message to stderr
  *  and aborts the program.
  *
  *  @param q A pointer to the queue from which the front element should be removed.
  *
- *  @return The value stored in the node that was removed from the front
- *  of the queue.
+ *  @return The value that was removed from the front of the queue.
  *
  *  @warning Calling this function on an empty queue causes program termination.
  */
 Item pop(struct queue *q);
 
+/**
+ *  @brief Removes up to `max` values from the front of the queue.
+ *
+ *  @param q A pointer to the queue.
+ *  @param out The array receiving the values, in queue order.
+ *  @param max The capacity of `out`.
+ *
+ *  @return The number of values removed, zero if the queue is empty.
+ */
+size_t pop_n(struct queue *q, Item *out, size_t max);
+
+/**
+ *  @brief Empties a queue, keeping its capacity.
+ *
+ *  @param q A pointer to the queue.
+ */
+void clear_queue(struct queue *q);
+
 /**
  *  @brief Checks whether a queue is empty.
  *
@@ -132,10 +145,8 @@ bool is_empty(struct queue *q);
 /**
  *  @brief Deletes a queue and frees all associated memory.
  *
- *  This function repeatedly removes and frees all elements
- *  from the queue using `pop()`, ensuring that no queue nodes
- *  remain allocated. After the queue is emptied, the queue
- *  structure itself is freed.
+ *  The ring buffer and the queue structure itself are freed. The values
+ *  still in the queue are not: they are owned by the caller.
  *
  *  @param q A pointer to the queue to be deleted.  
  *           Must not be NULL.
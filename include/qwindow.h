@@ -0,0 +1,134 @@
+/*! \file qwindow.h
+ *  \brief A sliding-window Q-Digest built from time-bucketed
+ *  sub-digests.
+ *
+ *  The window keeps one struct QDigest per interval in a ring. Only
+ *  the newest bucket receives inserts; older buckets are sealed and
+ *  eventually expire. To avoid merging every live bucket on every
+ *  read, sealed buckets are split between two stacks:
+ *
+ *   - the front stack holds the oldest buckets together with cached
+ *     suffix merges (suffix[i] is the merge of bucket i and every
+ *     younger bucket of the front stack);
+ *   - the back stack holds the younger sealed buckets, folded into a
+ *     single running merge as they are sealed.
+ *
+ *  A query is then the merge of at most three digests (front suffix,
+ *  back aggregate, current bucket). Expiring the oldest bucket drops
+ *  its digest and its suffix; when the front stack runs empty the back
+ *  stack is flipped over and its suffix merges are rebuilt, which
+ *  amortizes to O(1) merges per interval.
+ *
+ */
+
+#ifndef QWINDOW
+#define QWINDOW
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ *  @brief A struct representing a sliding window of Q-Digests.
+ */
+struct QWindow {
+  struct QDigest **buckets;     /**< Ring of per-interval digests, oldest at `head`. */
+  struct QDigest **suffix;      /**< Ring of cached suffix merges, valid for front-stack slots only. */
+  struct QDigest *back;         /**< Merge of all sealed buckets in the back stack. */
+  size_t capacity;              /**< Number of intervals covered by the window, current one included. */
+  size_t head;                  /**< Ring index of the oldest live bucket. */
+  size_t len;                   /**< Number of live buckets, current one included. */
+  size_t front_len;             /**< Number of oldest buckets that belong to the front stack. */
+  size_t K;                     /**< Compression parameter used for every bucket. */
+  size_t upper_bound;           /**< Initial universe upper bound of every bucket. */
+};
+
+/**
+ *  @brief Creates a sliding window covering `n_buckets` intervals.
+ *  The window starts with a single, empty current bucket.
+ *
+ *  @param n_buckets The number of live intervals, at least 1. A 5
+ *  minute window updated every second uses 300 buckets.
+ *
+ *  @param K The compression parameter of every bucket.
+ *
+ *  @param upper_bound The initial universe upper bound of every bucket.
+ *
+ *  @return A pointer to the new window, to be freed with delete_window().
+ */
+struct QWindow *create_window(size_t n_buckets, size_t K, size_t upper_bound);
+
+/**
+ *  @brief Frees a window together with all its buckets and cached
+ *  merges.
+ *
+ *  @param w A pointer to the window to destroy.
+ */
+void delete_window(struct QWindow *w);
+
+/**
+ *  @brief Returns the digest of the current (newest) interval.
+ *
+ *  @param w A pointer to the window.
+ */
+struct QDigest *window_current(struct QWindow *w);
+
+/**
+ *  @brief Inserts a value into the current interval of the window.
+ *
+ *  @param w A pointer to the window.
+ *
+ *  @param key The value to insert.
+ *
+ *  @param count How many occurrences of the value to insert.
+ */
+void window_insert(struct QWindow *w, size_t key, unsigned int count);
+
+/**
+ *  @brief Closes the current interval and opens a new one.
+ *
+ *  The current bucket is sealed and folded into the back-stack merge.
+ *  If the window was full, the oldest bucket is expired first: its
+ *  digest and cached suffix are dropped, and the back stack is flipped
+ *  into the front stack when the latter is empty.
+ *
+ *  @param w A pointer to the window.
+ */
+void window_advance(struct QWindow *w);
+
+/**
+ *  @brief Drops the oldest live interval of the window.
+ *
+ *  Only sealed buckets can expire; if the current bucket is the only
+ *  one left the call does nothing.
+ *
+ *  @param w A pointer to the window.
+ */
+void window_expire(struct QWindow *w);
+
+/**
+ *  @brief Builds the digest of the whole window.
+ *
+ *  The result is obtained by merging the front-stack suffix of the
+ *  oldest bucket, the back-stack merge and the current bucket, i.e. at
+ *  most three merge() calls whatever the number of buckets.
+ *
+ *  @param w A pointer to the window.
+ *
+ *  @return A newly allocated QDigest; the caller frees it with
+ *          delete_qdigest().
+ */
+struct QDigest *window_merged(struct QWindow *w);
+
+/**
+ *  @brief Computes a percentile over the whole window.
+ *
+ *  @param w A pointer to the window.
+ *
+ *  @param p A percentile in the range [0, 1].
+ *
+ *  @return The value associated with the p-th percentile, or 0 if the
+ *          window holds no values.
+ */
+size_t window_percentile(struct QWindow *w, double p);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __PARTITION_H__
+#define __PARTITION_H__
+
+#include <mpi.h>
+#include <stdlib.h>
+
+/* Sampled values per rank used to pick the range splitters */
+#define SAMPLES_PER_RANK 64
+
+int *Scatter_even(
+    const int *data,
+    int n,
+    int *local_n,
+    int root,
+    MPI_Comm comm);
+
+int *Scatter_by_range(
+    const int *data,
+    int n,
+    int sample_size,
+    int *local_n,
+    int root,
+    MPI_Comm comm);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __QDIGEST_MPI_H__
+#define __QDIGEST_MPI_H__
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../../include/qcore.h"
+
+/* MPI datatype matching size_t */
+#if SIZE_MAX == UINT64_MAX
+#define MPI_SIZE_T MPI_UINT64_T
+#else
+#define MPI_SIZE_T MPI_UINT32_T
+#endif
+
+/* A message starts with N, K and the bounds of the sender's root,
+ * followed by the flat nodes */
+#define QDIGEST_MSG_HEADER 4
+#define QFLAT_FIELDS (sizeof(struct QFlatNode) / sizeof(size_t))
+
+/* Receive buffer reused across messages, grown on demand */
+struct QDigestArena {
+    size_t *buf;        /* header followed by the QFlatNode array */
+    size_t capacity;    /* in size_t */
+    size_t len;         /* number of nodes of the last message */
+};
+
+void Init_arena(
+    struct QDigestArena *a,
+    size_t capacity_nodes);
+
+void Free_arena(
+    struct QDigestArena *a);
+
+struct QFlatNode *Arena_nodes(
+    const struct QDigestArena *a);
+
+void Send_qdigest(
+    struct QDigest *q,
+    int dest,
+    int tag,
+    MPI_Comm comm);
+
+size_t Qdigest_msg_count(
+    const struct QDigest *q);
+
+size_t Flatten_qdigest(
+    const struct QDigest *q,
+    size_t *buf);
+
+void Irecv_qdigest(
+    struct QDigestArena *a,
+    size_t count,
+    int source,
+    int tag,
+    MPI_Comm comm,
+    MPI_Request *request);
+
+void Arena_received(
+    struct QDigestArena *a,
+    const MPI_Status *status);
+
+void Recv_qdigest(
+    struct QDigestArena *a,
+    int source,
+    int tag,
+    MPI_Comm comm,
+    MPI_Status *status);
+
+void Recv_merge_qdigest(
+    struct QDigest *q,
+    struct QDigestArena *a,
+    int source,
+    int tag,
+    MPI_Comm comm,
+    MPI_Status *status);
+
+#endif
@@ -1,15 +1,31 @@
 #ifndef __ALLREDUCE_H__
 #define __ALLREDUCE_H__
 
+#include <mpi.h>
 #include <stdlib.h>
-#include "../include/qcore.h"
-
-typedef struct QDigest *Item;
+#include "../../include/qcore.h"
 
 void TreeAllreduce(
-    size_t *data,
-    size_t length,
+    struct QDigest *q,
     int comm_size,
-    int rank);
+    int rank,
+    MPI_Comm comm);
+
+void TreeReduce(
+    struct QDigest *q,
+    int fan_in,
+    int root,
+    MPI_Comm comm);
+
+void PackedTreeReduce(
+    struct QDigest *q,
+    int fan_in,
+    int root,
+    MPI_Comm comm);
+
+void HierarchicalReduce(
+    struct QDigest *q,
+    int fan_in,
+    MPI_Comm comm);
 
 #endif
\ No newline at end of file
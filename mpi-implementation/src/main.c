@@ -1,64 +1,68 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
+#include "../../include/memory_utils.h"
 #include "../../include/qcore.h"
+#include "../include/partition.h"
+#include "../include/treeReduce.h"
 
 /* NOTE: These are test parameters and should be removed in 
  * favor of proper user-based I/O */
 // how many numbers to generate
 // also the size of the array (vector) that stores them in process 0
-#define NUMS 100
+#define NUMS 1000
 #define K 5
+#define FAN_IN 2
 
 /* =========== FUNCTION PROTOTYPES ==================== */
 struct QDigest *_build_q_from_vector(int *a, int size);
 
 /* ============== MAIN FUNCTION ======================== */
 
-int main(void) {
-    MPI_Init(NULL, NULL);
+/* Usage: main [even|range]
+ * even (the default) scatters blocks of NUMS/n_prcs values, the first
+ * NUMS % n_prcs ranks taking one more; range gives every rank a
+ * contiguous slice of the values instead (see partition.h). */
+int main(int argc, char **argv) {
+    MPI_Init(&argc, &argv);
     
     int rank, n_prcs;
 
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &n_prcs);
 
-    int local_n = NUMS/n_prcs;
+    int by_range = argc > 1 && strcmp(argv[1], "range") == 0;
+
     // rank 0 should collect the input data (a vector)
     // and scatter it to the other processes so that each
     // process gets a subset of the input data
+    int *arr = NULL;
     if (rank == 0) {
-        int arr[NUMS];
-        // fill array with numbers
+        arr = xmalloc(NUMS * sizeof(int));
+        // skewed input: most values crowd the bottom of the universe
         for (int i = 0; i < NUMS; i++) {
-            arr[i] = i;
+            arr[i] = (int)((long)i * i / NUMS);
         }
-        // try scatter in other process
-        int local_buf[local_n];
-        MPI_Scatter(arr, local_n, MPI_INT, local_buf,
-                    local_n, MPI_INT, 0, MPI_COMM_WORLD);
-        struct QDigest *q = _build_q_from_vector(local_buf, local_n);
-        delete_qdigest(q);
-
-    } else {
-        int local_buf[local_n];
-        MPI_Scatter(NULL, local_n, MPI_INT, local_buf,
-                    local_n, MPI_INT, 0, MPI_COMM_WORLD);
-
-        struct QDigest *q = _build_q_from_vector(local_buf, local_n);
+    }
+    int local_n;
+    int *local_buf = by_range
+        ? Scatter_by_range(arr, NUMS, SAMPLES_PER_RANK * n_prcs, &local_n,
+                           0, MPI_COMM_WORLD)
+        : Scatter_even(arr, NUMS, &local_n, 0, MPI_COMM_WORLD);
+    free(arr);
 
-        // serialize
-        char ser[1024];
-        size_t length = 0;
-        to_string(q, ser, &length);
-        printf("length of buf: %zu\n", length);
+    struct QDigest *q = _build_q_from_vector(local_buf, local_n);
+    free(local_buf);
+    printf("process %d: %d values, %zu nodes\n", rank, local_n,
+           q->num_nodes);
 
-        // print serialization
-        printf("=======\nSerialization from process %d\n=======\n%s",
-               rank, ser);
-        delete_qdigest(q);
-    } // processes other than 0
-    
+    TreeReduce(q, FAN_IN, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("%s partitioning: N = %zu of %d, median %zu\n",
+               by_range ? "range" : "even", q->N, NUMS, percentile(q, 0.5));
+    }
+    delete_qdigest(q);
 
     MPI_Finalize();
     return 0;
@@ -75,7 +79,7 @@ struct QDigest *_build_q_from_vector(int *a, int size) {
      * due to the fact that when using an upper bound that is much
      * smaller than the actual received number the q-digest might
      * overflow internal nodes, causing a strange ranges in serialization. */
-    struct QDigest *q = create_tmp_q(5, NUMS-1);
+    struct QDigest *q = create_tmp_q(K, NUMS-1);
     for (int i = 0; i < size; i++) {
         insert(q, a[i], 1, true);
     }
@@ -0,0 +1,166 @@
+#include <mpi.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../../include/memory_utils.h"
+#include "../include/partition.h"
+
+/* Input distribution.
+ *
+ * Scatter_even() hands out contiguous blocks of the input whose sizes
+ * differ by at most one, so no value is left behind when n is not a
+ * multiple of the number of ranks.
+ *
+ * Scatter_by_range() instead gives every rank a contiguous slice of the
+ * values: the root draws a sample, sorts it and takes p - 1 evenly spaced
+ * sample values as splitters, so that skewed inputs still end up in
+ * slices of about n/p values. The digests built from the slices only
+ * share the few ancestors of the slice boundaries, which makes their
+ * final merge (merge_graft()) a concatenation of disjoint subtrees, and
+ * each of them spans a narrow range, which keeps it small. */
+
+static int Compare_ints(
+    const void *a,
+    const void *b)
+{
+    const int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}   /* Compare_ints */
+
+
+/* Receive buffer of at least one element, so that empty shares are valid */
+static int *Alloc_share(
+    int local_n)
+{
+    return xmalloc((local_n > 0 ? (size_t)local_n : 1) * sizeof(int));
+}   /* Alloc_share */
+
+
+/* n must be the same on every rank; data is only read on root.
+ * Returns the share of the calling rank, to be released with free(). */
+int *Scatter_even(
+    const int *data,
+    int n,
+    int *local_n,
+    int root,
+    MPI_Comm comm)
+{
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+
+    int *counts = xmalloc(comm_sz * sizeof(int));
+    int *displs = xmalloc(comm_sz * sizeof(int));
+    for (int r = 0, offset = 0; r < comm_sz; r++) {
+        // the first n % comm_sz ranks take one extra value
+        counts[r] = n / comm_sz + (r < n % comm_sz);
+        displs[r] = offset;
+        offset += counts[r];
+    }
+    *local_n = counts[rank];
+    int *local = Alloc_share(*local_n);
+    MPI_Scatterv(data, counts, displs, MPI_INT, local, *local_n, MPI_INT,
+        root, comm);
+
+    free(counts);
+    free(displs);
+    return local;
+}   /* Scatter_even */
+
+
+/* Rank owning v: the number of splitters not above it */
+static int Owner(
+    int v,
+    const int *splitters,
+    int n_splitters)
+{
+    int lo = 0, hi = n_splitters;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (splitters[mid] <= v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}   /* Owner */
+
+
+/* The p - 1 splitters of a sample of sample_size values of data */
+static int *Choose_splitters(
+    const int *data,
+    int n,
+    int sample_size,
+    int comm_sz)
+{
+    int s = sample_size < n ? sample_size : n;
+    int *sample = xmalloc((s > 0 ? (size_t)s : 1) * sizeof(int));
+    // fixed seed, so that runs are reproducible
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < s; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        sample[i] = data[(state >> 33) % (uint64_t)n];
+    }
+    qsort(sample, s, sizeof(int), Compare_ints);
+
+    int *splitters = xmalloc((comm_sz > 1 ? (size_t)comm_sz - 1 : 1) *
+        sizeof(int));
+    for (int j = 0; j < comm_sz - 1; j++)
+        splitters[j] = s > 0 ? sample[(long)(j + 1) * s / comm_sz] : 0;
+    free(sample);
+    return splitters;
+}   /* Choose_splitters */
+
+
+/* Like Scatter_even(), but rank r receives the values between splitters
+ * r - 1 and r, in input order. Heavy duplicates stay on one rank, so the
+ * shares are only as even as the sample allows. */
+int *Scatter_by_range(
+    const int *data,
+    int n,
+    int sample_size,
+    int *local_n,
+    int root,
+    MPI_Comm comm)
+{
+    int rank, comm_sz;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_sz);
+
+    int *counts = NULL, *displs = NULL, *by_owner = NULL;
+    if (rank == root) {
+        int *splitters = Choose_splitters(data, n, sample_size, comm_sz);
+        int *owner = xmalloc((n > 0 ? (size_t)n : 1) * sizeof(int));
+        counts = xmalloc(comm_sz * sizeof(int));
+        displs = xmalloc(comm_sz * sizeof(int));
+        for (int r = 0; r < comm_sz; r++)
+            counts[r] = 0;
+        for (int i = 0; i < n; i++) {
+            owner[i] = Owner(data[i], splitters, comm_sz - 1);
+            counts[owner[i]]++;
+        }
+        for (int r = 0, offset = 0; r < comm_sz; r++) {
+            displs[r] = offset;
+            offset += counts[r];
+        }
+        // counting sort of the values by owner
+        by_owner = xmalloc((n > 0 ? (size_t)n : 1) * sizeof(int));
+        int *next = xmalloc(comm_sz * sizeof(int));
+        for (int r = 0; r < comm_sz; r++)
+            next[r] = displs[r];
+        for (int i = 0; i < n; i++)
+            by_owner[next[owner[i]]++] = data[i];
+        free(next);
+        free(owner);
+        free(splitters);
+    }
+
+    MPI_Scatter(counts, 1, MPI_INT, local_n, 1, MPI_INT, root, comm);
+    int *local = Alloc_share(*local_n);
+    MPI_Scatterv(by_owner, counts, displs, MPI_INT, local, *local_n, MPI_INT,
+        root, comm);
+
+    free(by_owner);
+    free(counts);
+    free(displs);
+    return local;
+}   /* Scatter_by_range */
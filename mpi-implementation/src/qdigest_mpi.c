@@ -0,0 +1,229 @@
+#include <mpi.h>
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../include/qcore.h"
+#include "../../include/memory_utils.h"
+#include "../include/qdigest_mpi.h"
+
+/* Zero-copy exchange of q-digests.
+ *
+ * The sender never serializes: the message is described by a derived
+ * datatype made of the header and one block of QFLAT_FIELDS size_t per
+ * node, taken at the absolute address of the node's `count` member
+ * (count, subtree_count, lower_bound and upper_bound are contiguous in
+ * struct QDigestNode). MPI gathers the blocks straight from the tree.
+ *
+ * The receiver gets the same bytes as a plain array of QFlatNode in a
+ * preallocated arena and merges it with merge_flat(). The nodes arrive
+ * in preorder, which is the order merge_flat() rebuilds fastest. */
+
+void Init_arena(
+    struct QDigestArena *a,
+    size_t capacity_nodes)
+{
+    a->capacity = QDIGEST_MSG_HEADER + capacity_nodes * QFLAT_FIELDS;
+    a->buf = xmalloc(a->capacity * sizeof(size_t));
+    a->len = 0;
+}   /* Init_arena */
+
+
+void Free_arena(
+    struct QDigestArena *a)
+{
+    free(a->buf);
+    a->buf = NULL;
+    a->capacity = a->len = 0;
+}   /* Free_arena */
+
+
+struct QFlatNode *Arena_nodes(
+    const struct QDigestArena *a)
+{
+    return (struct QFlatNode *)(a->buf + QDIGEST_MSG_HEADER);
+}   /* Arena_nodes */
+
+
+/* Preorder addresses of the nodes that carry a count */
+static void Collect_displacements(
+    struct QDigestNode *n,
+    MPI_Aint *displs,
+    size_t *len)
+{
+    if (!n) return;
+    if (n->count > 0)
+        MPI_Get_address(&n->count, &displs[(*len)++]);
+    Collect_displacements(n->left, displs, len);
+    Collect_displacements(n->right, displs, len);
+}   /* Collect_displacements */
+
+
+void Send_qdigest(
+    struct QDigest *q,
+    int dest,
+    int tag,
+    MPI_Comm comm)
+{
+    // the blocks rely on this part of QDigestNode being laid out like QFlatNode
+    assert(offsetof(struct QDigestNode, upper_bound) -
+           offsetof(struct QDigestNode, count) ==
+           offsetof(struct QFlatNode, upper_bound));
+
+    // deferred compression is settled before the digest leaves the process
+    if (q->policy.mode == COMPRESS_MANUAL)
+        compress_now(q);
+
+    size_t header[QDIGEST_MSG_HEADER] = {
+        q->N, q->K, q->root->lower_bound, q->root->upper_bound
+    };
+    MPI_Aint *displs = xmalloc(q->num_nodes * sizeof(MPI_Aint));
+    size_t len = 0;
+    Collect_displacements(q->root, displs, &len);
+
+    MPI_Datatype nodes_type, msg_type;
+    MPI_Type_create_hindexed_block((int)len, (int)QFLAT_FIELDS, displs,
+        MPI_SIZE_T, &nodes_type);
+    int blocklens[2] = {QDIGEST_MSG_HEADER, 1};
+    MPI_Aint offsets[2];
+    MPI_Get_address(header, &offsets[0]);
+    offsets[1] = 0;     // node displacements are already absolute
+    MPI_Datatype types[2] = {MPI_SIZE_T, nodes_type};
+    MPI_Type_create_struct(2, blocklens, offsets, types, &msg_type);
+    MPI_Type_commit(&msg_type);
+
+    MPI_Send(MPI_BOTTOM, 1, msg_type, dest, tag, comm);
+
+    MPI_Type_free(&msg_type);
+    MPI_Type_free(&nodes_type);
+    free(displs);
+}   /* Send_qdigest */
+
+
+/* Number of nodes that carry a count */
+static size_t Count_live_nodes(
+    const struct QDigestNode *n)
+{
+    if (!n) return 0;
+    return (n->count > 0) + Count_live_nodes(n->left) +
+        Count_live_nodes(n->right);
+}   /* Count_live_nodes */
+
+
+/* Number of MPI_SIZE_T elements Send_qdigest() sends for q, for
+ * receivers that have to post their receive before the message shows up */
+size_t Qdigest_msg_count(
+    const struct QDigest *q)
+{
+    return QDIGEST_MSG_HEADER + Count_live_nodes(q->root) * QFLAT_FIELDS;
+}   /* Qdigest_msg_count */
+
+
+/* Preorder copy of the nodes that carry a count */
+static void Flatten_nodes(
+    const struct QDigestNode *n,
+    struct QFlatNode *out,
+    size_t *len)
+{
+    if (!n) return;
+    if (n->count > 0) {
+        out[*len].count = n->count;
+        out[*len].subtree_count = n->subtree_count;
+        out[*len].lower_bound = n->lower_bound;
+        out[*len].upper_bound = n->upper_bound;
+        (*len)++;
+    }
+    Flatten_nodes(n->left, out, len);
+    Flatten_nodes(n->right, out, len);
+}   /* Flatten_nodes */
+
+
+/* Writes the elements Send_qdigest() would send into buf, which must
+ * hold Qdigest_msg_count(q) of them, for transports that do not go
+ * through messages. Returns the number of elements written. */
+size_t Flatten_qdigest(
+    const struct QDigest *q,
+    size_t *buf)
+{
+    buf[0] = q->N;
+    buf[1] = q->K;
+    buf[2] = q->root->lower_bound;
+    buf[3] = q->root->upper_bound;
+    size_t len = 0;
+    Flatten_nodes(q->root, (struct QFlatNode *)(buf + QDIGEST_MSG_HEADER),
+        &len);
+    return QDIGEST_MSG_HEADER + len * QFLAT_FIELDS;
+}   /* Flatten_qdigest */
+
+
+/* Grows the arena to hold count elements */
+static void Reserve_arena(
+    struct QDigestArena *a,
+    size_t count)
+{
+    if (count > a->capacity) {
+        free(a->buf);
+        a->capacity = count;
+        a->buf = xmalloc(a->capacity * sizeof(size_t));
+    }
+}   /* Reserve_arena */
+
+
+/* Posts the receive of a message of at most count elements (see
+ * Qdigest_msg_count()); call Arena_received() once it completes */
+void Irecv_qdigest(
+    struct QDigestArena *a,
+    size_t count,
+    int source,
+    int tag,
+    MPI_Comm comm,
+    MPI_Request *request)
+{
+    Reserve_arena(a, count);
+    a->len = 0;
+    MPI_Irecv(a->buf, (int)count, MPI_SIZE_T, source, tag, comm, request);
+}   /* Irecv_qdigest */
+
+
+/* Sets a->len from the status of a completed Irecv_qdigest(). The
+ * sender may have compressed the digest after announcing its size. */
+void Arena_received(
+    struct QDigestArena *a,
+    const MPI_Status *status)
+{
+    int count;
+    MPI_Get_count(status, MPI_SIZE_T, &count);
+    a->len = ((size_t)count - QDIGEST_MSG_HEADER) / QFLAT_FIELDS;
+}   /* Arena_received */
+
+
+void Recv_qdigest(
+    struct QDigestArena *a,
+    int source,
+    int tag,
+    MPI_Comm comm,
+    MPI_Status *status)
+{
+    MPI_Status probe;
+    int count;
+    MPI_Probe(source, tag, comm, &probe);
+    MPI_Get_count(&probe, MPI_SIZE_T, &count);
+    Reserve_arena(a, (size_t)count);
+    // receive exactly the probed message, even for wildcard sources
+    MPI_Recv(a->buf, count, MPI_SIZE_T, probe.MPI_SOURCE, probe.MPI_TAG,
+        comm, status);
+    a->len = ((size_t)count - QDIGEST_MSG_HEADER) / QFLAT_FIELDS;
+}   /* Recv_qdigest */
+
+
+void Recv_merge_qdigest(
+    struct QDigest *q,
+    struct QDigestArena *a,
+    int source,
+    int tag,
+    MPI_Comm comm,
+    MPI_Status *status)
+{
+    Recv_qdigest(a, source, tag, comm, status);
+    merge_flat(q, Arena_nodes(a), a->len, a->buf[1]);
+}   /* Recv_merge_qdigest */
@@ -6,8 +6,12 @@
 #include "../../include/qcore.h"
 #include "../include/treeReduce.h"
 #include "../../include/memory_utils.h"
+#include "../../include/qpack.h"
+#include "../include/qdigest_mpi.h"
 
-#define DEFAULT_STR_BUFFER_SIZE 128
+/* Digests travel as derived datatypes straight from the tree (see
+ * qdigest_mpi.h). PackedTreeReduce sends LZ compressed text instead,
+ * for when the network, not the copies, is the bottleneck. */
 
 void Distribute_vector(
     int *sendbuf,
@@ -53,21 +57,14 @@ void TreeAllreduce(
         // thus we evaluate ([0,1],[2,3]) or rank < orphans*2
         if (rank < 2*orphans) { // if orphan, send to newly formed subset.
             if (rank % 2 != 0) {
-                char buf[DEFAULT_STR_BUFFER_SIZE]; 
-                size_t length = 0;
-                to_string(q, buf, &length); // to implement
-                MPI_Send(length, 1, MPI_UNSIGNED_LONG, rank-1, 0, comm);
-                MPI_Send(buf, length, MPI_CHAR, rank-1, 0, comm);
+                Send_qdigest(q, rank-1, 0, comm);
                 local_orphan_activity_flag = 0;
             } else {
-                size_t recv_length;
-                char buf[DEFAULT_STR_BUFFER_SIZE];
-                MPI_Recv(recv_length, 1, MPI_UNSIGNED_LONG, rank+1, 0, comm,
+                struct QDigestArena arena;
+                Init_arena(&arena, q->num_nodes);
+                Recv_merge_qdigest(q, &arena, rank+1, 0, comm,
                     MPI_STATUS_IGNORE);
-                MPI_Recv(buf, recv_length, MPI_CHAR, rank+1, 0, comm,
-                    MPI_STATUS_IGNORE);
-                struct QDigest *tmp = from_string(buf); // To implement
-                merge(q, tmp);
+                Free_arena(&arena);
                 new_rank = rank / 2; // p0<-p1, p2<-p3, thus rank 0 stays 0, rank 2 becomes new rank 1
                                      // p0, p1.
             }
@@ -88,3 +85,200 @@ void TreeAllreduce(
 
     return;
 }
+
+
+/* Tags of the two messages every child sends to its parent */
+#define TREE_SIZE_TAG 1
+#define TREE_DIGEST_TAG 2
+
+/* Merges a to_packed() buffer received from a child. A buffer that
+ * does not parse means a broken peer, so the whole job is stopped. */
+static void Merge_packed(struct QDigest *q, const void *buf, size_t len,
+    MPI_Comm comm)
+{
+    struct QDigest *tmp = from_packed(buf, len);
+    if (!tmp) {
+        fprintf(stderr, "TreeReduce: malformed packed digest\n");
+        MPI_Abort(comm, EXIT_FAILURE);
+    }
+    merge(q, tmp);
+    delete_qdigest(tmp);
+}
+
+/* Reduces the digests of all ranks into the one of `root` along a
+ * k-ary tree. Ranks are renumbered so that root is 0; the children of
+ * v are v*fan_in+1 ... v*fan_in+fan_in. Every parent posts a receive
+ * per child and merges the children as they complete, in any order,
+ * before passing the result up. Only root holds the full digest.
+ *
+ * The size message of a child gives the number of size_t of its
+ * derived datatype, or with `packed` the bytes of its to_packed()
+ * buffer. */
+static void Tree_reduce(
+    struct QDigest *q,
+    int fan_in,
+    int root,
+    MPI_Comm comm,
+    bool packed)
+{
+    int rank, comm_size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_size);
+    if (fan_in < 1) fan_in = 1;
+
+    int vrank = (rank - root + comm_size) % comm_size;
+    long first = (long)vrank * fan_in + 1;
+    int n_children = 0;
+    if (first < comm_size)
+        n_children = (int)((comm_size - first < fan_in) ? comm_size - first
+                                                        : fan_in);
+
+    if (n_children > 0) {
+        // slots [0, n) wait for the sizes, [n, 2n) for the digests
+        MPI_Request *requests = xmalloc(2 * n_children * sizeof(MPI_Request));
+        size_t *sizes = xmalloc(n_children * sizeof(size_t));
+        struct QDigestArena *arenas =
+            xmalloc(n_children * sizeof(struct QDigestArena));
+        void **bufs = xmalloc(n_children * sizeof(void *));
+        for (int c = 0; c < n_children; c++) {
+            int child = ((int)first + c + root) % comm_size;
+            Init_arena(&arenas[c], 0);
+            MPI_Irecv(&sizes[c], 1, MPI_SIZE_T, child, TREE_SIZE_TAG, comm,
+                &requests[c]);
+            requests[n_children + c] = MPI_REQUEST_NULL;
+        }
+
+        while (true) {
+            int idx;
+            MPI_Status status;
+            MPI_Waitany(2 * n_children, requests, &idx, &status);
+            if (idx == MPI_UNDEFINED) break;    // all done
+            if (idx < n_children) {
+                // a size arrived: post the digest receive of that child
+                int child = ((int)first + idx + root) % comm_size;
+                if (packed) {
+                    bufs[idx] = xmalloc(sizes[idx]);
+                    MPI_Irecv(bufs[idx], (int)sizes[idx], MPI_BYTE, child,
+                        TREE_DIGEST_TAG, comm, &requests[n_children + idx]);
+                } else {
+                    Irecv_qdigest(&arenas[idx], sizes[idx], child,
+                        TREE_DIGEST_TAG, comm, &requests[n_children + idx]);
+                }
+            } else if (packed) {
+                int c = idx - n_children;
+                Merge_packed(q, bufs[c], sizes[c], comm);
+                free(bufs[c]);
+            } else {
+                struct QDigestArena *a = &arenas[idx - n_children];
+                Arena_received(a, &status);
+                merge_flat(q, Arena_nodes(a), a->len, a->buf[1]);
+                Free_arena(a);
+            }
+        }
+        free(bufs);
+        free(arenas);
+        free(sizes);
+        free(requests);
+    }
+
+    if (vrank != 0) {
+        int parent = ((vrank - 1) / fan_in + root) % comm_size;
+        if (packed) {
+            size_t length = 0;
+            void *buf = to_packed(q, PACK_DEFAULT_THRESHOLD, &length);
+            MPI_Send(&length, 1, MPI_SIZE_T, parent, TREE_SIZE_TAG, comm);
+            MPI_Send(buf, (int)length, MPI_BYTE, parent, TREE_DIGEST_TAG,
+                comm);
+            free(buf);
+        } else {
+            size_t count = Qdigest_msg_count(q);
+            MPI_Send(&count, 1, MPI_SIZE_T, parent, TREE_SIZE_TAG, comm);
+            Send_qdigest(q, parent, TREE_DIGEST_TAG, comm);
+        }
+    }
+}   /* Tree_reduce */
+
+void TreeReduce(
+    struct QDigest *q,
+    int fan_in,
+    int root,
+    MPI_Comm comm)
+{
+    Tree_reduce(q, fan_in, root, comm, false);
+}   /* TreeReduce */
+
+/* TreeReduce sending every digest as a to_packed() buffer */
+void PackedTreeReduce(
+    struct QDigest *q,
+    int fan_in,
+    int root,
+    MPI_Comm comm)
+{
+    Tree_reduce(q, fan_in, root, comm, true);
+}   /* PackedTreeReduce */
+
+
+/* Reduces the digests of all ranks into rank 0 of comm in two levels.
+ *
+ * Ranks sharing a node (MPI_COMM_TYPE_SHARED) publish their digests as
+ * flat node arrays in an MPI-3 shared-memory window. The node leader
+ * (the lowest rank of the node) merges its peers' arrays by reading
+ * them in place, without any message. Then only the leaders take part
+ * in a TreeReduce with the given fan-in. Rank 0 is always the leader of
+ * its node and rank 0 among the leaders, so it ends up with the result. */
+void HierarchicalReduce(
+    struct QDigest *q,
+    int fan_in,
+    MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+        &node_comm);
+    int node_rank, node_size;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+
+    /* INTRA-NODE: the leader needs no segment, it merges into q */
+    if (q->policy.mode == COMPRESS_MANUAL)
+        compress_now(q);
+    size_t count = (node_rank == 0) ? 0 : Qdigest_msg_count(q);
+    size_t *segment;
+    MPI_Win win;
+    MPI_Win_allocate_shared((MPI_Aint)(count * sizeof(size_t)),
+        sizeof(size_t), MPI_INFO_NULL, node_comm, &segment, &win);
+    MPI_Win_fence(0, win);
+    if (node_rank != 0)
+        Flatten_qdigest(q, segment);
+    MPI_Win_fence(0, win);
+
+    if (node_rank == 0) {
+        for (int peer = 1; peer < node_size; peer++) {
+            MPI_Aint size;
+            int disp_unit;
+            size_t *peer_segment;
+            MPI_Win_shared_query(win, peer, &size, &disp_unit,
+                &peer_segment);
+            size_t peer_count = (size_t)size / sizeof(size_t);
+            merge_flat(q,
+                (const struct QFlatNode *)(peer_segment + QDIGEST_MSG_HEADER),
+                (peer_count - QDIGEST_MSG_HEADER) / QFLAT_FIELDS,
+                peer_segment[1]);
+        }
+    }
+    // peers keep their segments until the leader is done reading
+    MPI_Win_fence(0, win);
+    MPI_Win_free(&win);
+
+    /* INTER-NODE: one leader per node */
+    MPI_Comm leaders;
+    MPI_Comm_split(comm, (node_rank == 0) ? 0 : MPI_UNDEFINED, rank,
+        &leaders);
+    if (leaders != MPI_COMM_NULL) {
+        TreeReduce(q, fan_in, 0, leaders);
+        MPI_Comm_free(&leaders);
+    }
+    MPI_Comm_free(&node_comm);
+}   /* HierarchicalReduce */
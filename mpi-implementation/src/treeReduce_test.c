@@ -2,6 +2,8 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "../../include/qcore.h"
 #include "../include/treeReduce.h"
 
 #define BUFFER_SIZE 1024
@@ -18,7 +20,20 @@ void initialize(int rank, int *data, int n)
     return;
 }
 
-int main(void) 
+struct QDigest *Build_qdigest(int *data, int n)
+{
+    struct QDigest *q = create_tmp_q(5, UPPER_BOUND);
+    for (int i = 0; i < n; i++)
+        insert(q, data[i], 1, true);
+    return q;
+}
+
+/* Usage: tree_reduce [fan_in [shared|packed]]
+ * Without fan_in the digests go through TreeAllreduce, otherwise they
+ * are gathered on rank 0 by TreeReduce with the given fan-in, by
+ * HierarchicalReduce when "shared" follows, or by PackedTreeReduce
+ * when "packed" follows. */
+int main(int argc, char **argv) 
 {
     int rank, comm_sz;
     int data[BUFFER_SIZE]; // TO evaluate switch to xmalloc(); 
@@ -27,19 +42,39 @@ int main(void)
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
 
-    // Init the random number array of data
-    initialize(rank, data, BUFFER_SIZE);
-
     int local_n = BUFFER_SIZE/comm_sz;
 
-    // Scatter the array around the nodes
-    Distribute_vector(data, local_n, rank, MPI_COMM_WORLD);
+    // Every process draws its own share of the data
+    initialize(rank, data, local_n);
 
     // From the data buffer create the q-digest
-    struct QDigest *q = from_buff_to_q(); // To DO;
+    struct QDigest *q = Build_qdigest(data, local_n);
 
     // data get inserted into qdigest and then compressed, ecc...
-    TreeAllreduce(q, comm_sz, rank, MPI_COMM_WORLD);
+    if (argc > 2 && strcmp(argv[2], "shared") == 0) {
+        int fan_in = atoi(argv[1]);
+        HierarchicalReduce(q, fan_in, MPI_COMM_WORLD);
+        if (rank == 0)
+            printf("N after hierarchical reduction (fan-in %d): %zu of %d\n",
+                   fan_in, q->N, local_n * comm_sz);
+    } else if (argc > 2 && strcmp(argv[2], "packed") == 0) {
+        int fan_in = atoi(argv[1]);
+        PackedTreeReduce(q, fan_in, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            printf("N after packed reduction (fan-in %d): %zu of %d\n",
+                   fan_in, q->N, local_n * comm_sz);
+    } else if (argc > 1) {
+        int fan_in = atoi(argv[1]);
+        TreeReduce(q, fan_in, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+            printf("N after reduction (fan-in %d): %zu of %d\n", fan_in,
+                   q->N, local_n * comm_sz);
+    } else {
+        TreeAllreduce(q, comm_sz, rank, MPI_COMM_WORLD);
+        if (rank == 0)
+            printf("N after reduction: %zu\n", q->N);
+    }
+    delete_qdigest(q);
     
     MPI_Finalize();
     return 0;
@@ -0,0 +1,238 @@
+/* Accuracy versus memory benchmark.
+ *
+ * Sweeps the compression parameter K, the number of values N and the
+ * input distribution, and prints one CSV line per run:
+ *
+ *   distribution,N,K,max_rank_error,mean_rank_error,nodes,memory_bytes,
+ *   text_bytes,packed_bytes,inserts_per_sec
+ *
+ * Rank errors are fractions of N, measured at the percentiles 0.01 to
+ * 0.99: the distance between p * N and the range of ranks held by the
+ * value percentile() returns. Sizes are taken after compress_now().
+ *
+ * Usage: bench [max_N [seed]] */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../../include/memory_utils.h"
+#include "../../include/qcore.h"
+#include "../../include/qpack.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const size_t KS[] = {10, 20, 50, 100, 200, 500, 1000};
+static const size_t NS[] = {10000, 100000, 1000000, 10000000};
+
+#define ZIPF_VALUES 100000
+#define ZIPF_EXPONENT 1.1
+
+/* xorshift64*, so that runs are reproducible across platforms */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* A uniform double in [0, 1) */
+static double next_unit(uint64_t *state) {
+    return (next_random(state) >> 11) / 9007199254740992.0;
+}
+
+static void shuffle(size_t *data, size_t n, uint64_t *state) {
+    for (size_t i = n; i > 1; i--) {
+        size_t j = next_random(state) % i;
+        size_t t = data[j];
+        data[j] = data[i - 1];
+        data[i - 1] = t;
+    }
+}
+
+/* The ramp of test_poisson_distribution() in test.c: each value is
+ * repeated 3 times more often than the previous one up to N/2, then
+ * 3 times less often */
+static void gen_poisson(size_t *data, size_t n, uint64_t *state) {
+    size_t len = 0, repeat = 1, number = 1;
+    int flipped = 0;
+    for (; len != n; ++number) {
+        for (size_t i = 0; i < repeat && len != n; ++i)
+            data[len++] = number;
+        if (len <= n / 2) {
+            repeat += 3;
+        } else {
+            if (!flipped)
+                repeat += 3;
+            flipped = 1;
+            repeat = repeat > 3 ? repeat - 3 : 2;
+        }
+    }
+    shuffle(data, n, state);
+}
+
+/* As test_geometric_distribution() in test.c: value i is repeated 2^i
+ * times */
+static void gen_geometric(size_t *data, size_t n, uint64_t *state) {
+    size_t len = 0, repeat = 1;
+    for (size_t number = 1; len != n; number++, repeat *= 2)
+        for (size_t i = 0; i < repeat && len != n; ++i)
+            data[len++] = number;
+    shuffle(data, n, state);
+}
+
+static void gen_uniform(size_t *data, size_t n, uint64_t *state) {
+    for (size_t i = 0; i < n; i++)
+        data[i] = next_random(state) % n;
+}
+
+/* Ranks 1..ZIPF_VALUES drawn by inverting the cumulative distribution */
+static void gen_zipf(size_t *data, size_t n, uint64_t *state) {
+    double *cdf = xmalloc(ZIPF_VALUES * sizeof(double));
+    double sum = 0.0;
+    for (size_t r = 0; r < ZIPF_VALUES; r++) {
+        sum += 1.0 / pow((double)(r + 1), ZIPF_EXPONENT);
+        cdf[r] = sum;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const double u = next_unit(state) * sum;
+        size_t lo = 0, hi = ZIPF_VALUES - 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        data[i] = lo + 1;
+    }
+    free(cdf);
+}
+
+/* Latency-like values: exp(N(ln 1000, 1)), Box-Muller transformed */
+static void gen_lognormal(size_t *data, size_t n, uint64_t *state) {
+    const double two_pi = 6.283185307179586;
+    for (size_t i = 0; i < n; i++) {
+        const double u1 = 1.0 - next_unit(state);
+        const double u2 = next_unit(state);
+        const double z = sqrt(-2.0 * log(u1)) * cos(two_pi * u2);
+        data[i] = (size_t)exp(log(1000.0) + z);
+    }
+}
+
+struct Distribution {
+    const char *name;
+    void (*generate)(size_t *data, size_t n, uint64_t *state);
+};
+
+static const struct Distribution DISTRIBUTIONS[] = {
+    {"poisson", gen_poisson},
+    {"geometric", gen_geometric},
+    {"uniform", gen_uniform},
+    {"zipf", gen_zipf},
+    {"lognormal", gen_lognormal},
+};
+
+static int compare_sizes(const void *a, const void *b) {
+    const size_t x = *(const size_t *)a;
+    const size_t y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Number of values of the sorted data lower than v (or at most v) */
+static size_t count_below(const size_t *sorted, size_t n, size_t v,
+                          int inclusive) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sorted[mid] < v || (inclusive && sorted[mid] == v))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static double elapsed(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void run(const char *name, const size_t *data, const size_t *sorted,
+                size_t n, size_t k) {
+    struct QDigest *q = create_tmp_q(k, 1);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < n; i++)
+        insert(q, data[i], 1, true);
+    const double seconds = elapsed(&start);
+    compress_now(q);
+
+    double max_err = 0.0, sum_err = 0.0;
+    int points = 0;
+    for (int i = 1; i < 100; i++, points++) {
+        const double p = i / 100.0;
+        const size_t v = percentile(q, p);
+        // any rank held by v is a correct answer
+        const double lo = count_below(sorted, n, v, 0);
+        const double hi = count_below(sorted, n, v, 1);
+        const double target = p * n;
+        double err = 0.0;
+        if (target < lo)
+            err = (lo - target) / n;
+        else if (target > hi)
+            err = (target - hi) / n;
+        if (err > max_err)
+            max_err = err;
+        sum_err += err;
+    }
+
+    char *text = xmalloc((q->num_nodes + 2) * TEXT_LINE_MAX);
+    size_t text_len, packed_len;
+    to_string(q, text, &text_len);
+    free(to_packed(q, 0, &packed_len));
+    const size_t memory = sizeof(struct QDigest) +
+                          q->num_nodes * sizeof(struct QDigestNode);
+
+    printf("%s,%zu,%zu,%.6f,%.6f,%zu,%zu,%zu,%zu,%.0f\n", name, n, k,
+           max_err, sum_err / points, q->num_nodes, memory, text_len,
+           packed_len, seconds > 0 ? n / seconds : 0.0);
+    fflush(stdout);
+    free(text);
+    delete_qdigest(q);
+}
+
+int main(int argc, char *argv[]) {
+    const size_t max_n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 377;
+    if (seed == 0)
+        seed = 377;
+
+    printf("distribution,N,K,max_rank_error,mean_rank_error,nodes,"
+           "memory_bytes,text_bytes,packed_bytes,inserts_per_sec\n");
+    const size_t n_dists = sizeof(DISTRIBUTIONS) / sizeof(DISTRIBUTIONS[0]);
+    for (size_t d = 0; d < n_dists; d++) {
+        for (size_t j = 0; j < sizeof(NS) / sizeof(NS[0]); j++) {
+            const size_t n = NS[j];
+            if (n > max_n)
+                break;
+            uint64_t state = seed;
+            size_t *data = xmalloc(n * sizeof(size_t));
+            size_t *sorted = xmalloc(n * sizeof(size_t));
+            DISTRIBUTIONS[d].generate(data, n, &state);
+            memcpy(sorted, data, n * sizeof(size_t));
+            qsort(sorted, n, sizeof(size_t), compare_sizes);
+            for (size_t i = 0; i < sizeof(KS) / sizeof(KS[0]); i++)
+                run(DISTRIBUTIONS[d].name, data, sorted, n, KS[i]);
+            free(sorted);
+            free(data);
+        }
+    }
+    return 0;
+}
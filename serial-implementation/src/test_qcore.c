@@ -1,8 +1,24 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../../include/memory_utils.h"
+#include "../../include/node_pool.h"
 #include "../../include/qcore.h"
 #include "../../include/queue.h"
+#include "../../include/qwindow.h"
+#include "../../include/qdecay.h"
+#include "../../include/qsnapshot.h"
+#include "../../include/qstore.h"
+#include "../../include/qpack.h"
+#include "../../include/qhybrid.h"
+#include "../../include/qblock.h"
+#include "../../include/qarray.h"
+#include "../../include/qkeymap.h"
+#include "../../include/qlive.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <unistd.h>
 
@@ -102,6 +118,322 @@ void test_compress(void) {
     delete_qdigest(q);
 }
 
+/* Test the compression policies */
+void test_compress_policy(void) {
+    print_sep("Testing compress policy");
+    // manual mode never compresses on insert
+    struct QDigest *q = create_tmp_q(1, 63);
+    set_compress_policy(q, COMPRESS_MANUAL, 0, 1.0);
+    for (size_t i = 0; i < 64; i++) insert(q, i, 1, true);
+    size_t uncompressed = q->num_nodes;
+    assert(uncompressed == 127);
+    compress_now(q);
+    assert(q->num_nodes < uncompressed);
+    assert(q->N == 64);
+    delete_qdigest(q);
+
+    // a node budget is a hard cap honoured down to the target ratio
+    q = create_tmp_q(64, 1023);
+    set_compress_policy(q, COMPRESS_BUDGET, 40, 0.5);
+    for (size_t i = 0; i < 1024; i++) {
+        insert(q, (i * 37) % 1024, 1, true);
+        assert(q->num_nodes <= 40);
+    }
+    assert(q->N == 1024);
+    printf("Budgeted digest holds %zu nodes\n", q->num_nodes);
+    delete_qdigest(q);
+
+    // a budget of 0 means no budget, not a compression per insert
+    q = create_tmp_q(1, 63);
+    set_compress_policy(q, COMPRESS_BUDGET, 0, 1.0);
+    for (size_t i = 0; i < 64; i++) insert(q, i, 1, true);
+    assert(q->num_nodes == uncompressed);
+    compress_now(q);
+    assert(q->num_nodes < uncompressed && q->N == 64);
+    delete_qdigest(q);
+
+    // byte budgets translate into node budgets and survive expansion
+    q = create_tmp_q(8, 1);
+    set_memory_budget(q, 16 * sizeof(struct QDigestNode), 0.75);
+    assert(q->policy.mode == COMPRESS_BUDGET && q->policy.max_nodes == 16);
+    for (size_t i = 0; i < 500; i++) insert(q, i, 1, true);
+    assert(q->policy.max_nodes == 16 && q->num_nodes <= 16);
+    delete_qdigest(q);
+    printf("Compress policy tests passed\n");
+}
+
+/* Test weighted inserts with 64-bit counts */
+void test_insert_weighted(void) {
+    print_sep("Testing insert_weighted");
+    struct QDigest *q = create_tmp_q(20, 1);
+    const size_t keys[] = {10, 20, 30, 40};
+    const uint64_t weights[] = {3000000000000000000ULL, 3000000000000000000ULL,
+                                3000000000000000000ULL, 1000000000000000000ULL};
+    assert(insert_histogram(q, keys, weights, 4));
+    assert(q->N == 10000000000000000000ULL);
+    assert(!q->saturated);
+    // ranks are exact far beyond 2^53
+    assert(percentile_exact(q, 3, 10) == 10);
+    assert(percentile_exact(q, 6, 10) == 20);
+    assert(percentile_exact(q, 95, 100) == 40);
+    assert(percentile(q, 0.5) == 20);
+    assert(mul_div_floor(SIZE_MAX, 1, 3) == SIZE_MAX / 3);
+    assert(mul_div_floor(10, 7, 7) == 10);
+
+    // overflowing N is detected and clamped instead of wrapping
+    assert(!insert_weighted(q, 40, 9000000000000000000ULL, true));
+    assert(q->saturated && q->N == SIZE_MAX);
+    delete_qdigest(q);
+
+    // expanding to a power of two key keeps the value in its own leaf
+    q = create_tmp_q(5, 1);
+    insert(q, 4, 1, false);
+    assert(q->root->upper_bound == 7);
+    assert(percentile(q, 1.0) == 4);
+    delete_qdigest(q);
+    printf("insert_weighted tests passed\n");
+}
+
+/* Test single-pass CDF and histogram export */
+void test_export(void) {
+    print_sep("Testing export_cdf and export_histogram");
+    struct QDigest *q = create_tmp_q(1000, 15);
+    for (size_t i = 0; i < 16; i++) insert(q, i, i + 1, false);
+
+    // enough room: one point per value, matching percentile()
+    size_t bounds[64], cum[64];
+    size_t len = export_cdf(q, bounds, cum, 64);
+    assert(len == 16);
+    assert(bounds[0] == 0 && cum[0] == 1);
+    assert(bounds[15] == 15 && cum[15] == q->N);
+    for (size_t i = 1; i < len; i++) {
+        assert(bounds[i] > bounds[i - 1] && cum[i] > cum[i - 1]);
+    }
+
+    // sampled: never more points than requested, still ends at N
+    len = export_cdf(q, bounds, cum, 4);
+    assert(len > 0 && len <= 4);
+    assert(cum[len - 1] == q->N);
+    for (size_t i = 0; i < len; i++) {
+        size_t c = 0;
+        for (size_t v = 0; v <= bounds[i]; v++) c += v + 1;
+        assert(c == cum[i]);
+    }
+
+    const size_t edges[] = {3, 7, 11};
+    size_t out[4];
+    export_histogram(q, edges, 3, out);
+    assert(out[0] == 1 + 2 + 3 + 4);
+    assert(out[1] == 5 + 6 + 7 + 8);
+    assert(out[2] == 9 + 10 + 11 + 12);
+    assert(out[3] == 13 + 14 + 15 + 16);
+    delete_qdigest(q);
+    printf("Export tests passed\n");
+}
+
+/* Recompute subtree counts from scratch and compare with the cache */
+size_t check_subtree_counts(struct QDigestNode *n) {
+    if (!n) return 0;
+    size_t total = n->count + check_subtree_counts(n->left) +
+                   check_subtree_counts(n->right);
+    assert(total == n->subtree_count);
+    return total;
+}
+
+/* Test rank and range_count */
+void test_rank(void) {
+    print_sep("Testing rank and range_count");
+    struct QDigest *q = create_tmp_q(1000, 1);
+    for (size_t i = 0; i < 100; i++) insert(q, i, 1, false);
+    check_subtree_counts(q->root);
+    assert(rank(q, 0) == 1);
+    assert(rank(q, 49) == 50);
+    assert(rank(q, 99) == 100);
+    assert(rank(q, 1000) == 100);
+    assert(range_count(q, 10, 19) == 10);
+    assert(range_count(q, 90, SIZE_MAX) == 10);
+    assert(range_count(q, 5, 4) == 0);
+    delete_qdigest(q);
+
+    // caches stay consistent through compression, expansion and merge
+    struct QDigest *q1 = create_tmp_q(5, 1);
+    struct QDigest *q2 = create_tmp_q(5, 1);
+    for (size_t i = 0; i < 2000; i++) {
+        insert(q1, (i * 7919) % 1000, 1, true);
+        insert(q2, (i * 104729) % 3000, 1, true);
+    }
+    check_subtree_counts(q1->root);
+    merge(q1, q2);
+    check_subtree_counts(q1->root);
+    assert(rank(q1, SIZE_MAX) == q1->N);
+    // rank is the inverse of percentile
+    size_t p90 = percentile(q1, 0.9);
+    assert(rank(q1, p90) >= (size_t)(0.9 * q1->N));
+    delete_qdigest(q1);
+    delete_qdigest(q2);
+    printf("rank tests passed\n");
+}
+
+/* Test the sliding window */
+void test_window(void) {
+    print_sep("Testing sliding window");
+    struct QWindow *w = create_window(3, 1000, 1023);
+    // interval t holds the values [100 * t, 100 * t + 99]
+    for (size_t t = 0; t < 10; t++) {
+        for (size_t v = 0; v < 100; v++) window_insert(w, 100 * t + v, 1);
+        struct QDigest *m = window_merged(w);
+        size_t live = (t < 2) ? t + 1 : 3;
+        size_t oldest = (t < 2) ? 0 : t - 2;
+        assert(m->N == 100 * live);
+        assert(range_count(m, 0, 100 * oldest) == 1);
+        assert(percentile(m, 1.0) == 100 * t + 99);
+        delete_qdigest(m);
+        window_advance(w);
+        assert(w->len <= 3);
+    }
+    // the fresh current bucket is empty, two sealed ones remain
+    assert(window_percentile(w, 0.5) == 899);
+    window_expire(w);
+    window_expire(w);
+    window_expire(w);
+    assert(w->len == 1);
+    assert(window_percentile(w, 0.5) == 0);
+    delete_window(w);
+    printf("Sliding window tests passed\n");
+}
+
+/* Test the forward-decay digest */
+void test_decay(void) {
+    print_sep("Testing forward decay");
+    struct QDecay *d = create_decay(100, 1023, 10.0, 0.0);
+    for (size_t i = 0; i < 1000; i++) decay_insert(d, 100, 0.0);
+    // ten half-lives later the old values weigh 1/1024 of the new ones
+    for (size_t i = 0; i < 100; i++) decay_insert(d, 500, 100.0);
+    assert(decay_percentile(d, 0.5) == 500);
+    assert(decay_percentile(d, 0.005) == 100);
+    double total = decay_total(d, 100.0);
+    assert(total > 100.9 && total < 101.1);
+
+    // past the horizon the counts are rescaled in bulk
+    decay_insert(d, 700, 300.0);
+    assert(d->landmark == 300.0);
+    check_subtree_counts(d->q->root);
+    assert(rank(d->q, 100) == 0);
+    assert(decay_percentile(d, 0.99) == 700);
+    delete_decay(d);
+    printf("Forward decay tests passed\n");
+}
+
+/* Test memory-mapped snapshots */
+void test_snapshot(void) {
+    print_sep("Testing snapshots");
+    struct QDigest *q = create_tmp_q(10, 1);
+    for (size_t i = 0; i < 5000; i++) insert(q, (i * 7919) % 4096, 1, true);
+
+    char path[] = "/tmp/qdigest_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(snapshot_write(q, path) == 0);
+
+    struct QSnapshot *s = snapshot_open(path);
+    assert(s != NULL);
+    assert(s->hdr->N == q->N && s->hdr->num_nodes == q->num_nodes);
+    for (double p = 0.05; p < 1.0; p += 0.05) {
+        assert(snapshot_percentile(s, p) == percentile(q, p));
+    }
+    for (size_t v = 0; v < 4096; v += 97) {
+        assert(snapshot_rank(s, v) == rank(q, v));
+    }
+    size_t b1[16], c1[16], b2[16], c2[16];
+    size_t len = snapshot_export_cdf(s, b1, c1, 16);
+    assert(len == export_cdf(q, b2, c2, 16));
+    for (size_t i = 0; i < len; i++) assert(b1[i] == b2[i] && c1[i] == c2[i]);
+
+    struct QDigest *thawed = snapshot_thaw(s);
+    assert(thawed->num_nodes == q->num_nodes && thawed->N == q->N);
+    check_subtree_counts(thawed->root);
+    delete_qdigest(thawed);
+    snapshot_close(s);
+
+    // lazily thawed on the first insert
+    struct QMapped *m = mapped_open(path);
+    assert(m != NULL && m->q == NULL);
+    assert(mapped_percentile(m, 0.5) == percentile(q, 0.5));
+    mapped_insert(m, 100, 1);
+    insert(q, 100, 1, true);
+    assert(m->q != NULL && m->snap == NULL);
+    assert(mapped_rank(m, 2048) == rank(q, 2048));
+    mapped_close(m);
+
+    // garbage is rejected
+    char junk[64] = "0 1 2 3\n";
+    assert(snapshot_view(junk, sizeof(junk)) == NULL);
+    unlink(path);
+    delete_qdigest(q);
+    printf("Snapshot tests passed\n");
+}
+
+/* Test the digest store */
+void test_store(void) {
+    print_sep("Testing digest store");
+    struct QDigestStore *a = create_store(4, 1000, 1023);
+    struct QDigestStore *b = create_store(4, 1000, 1023);
+    char key[32];
+    for (size_t k = 0; k < 200; k++) {
+        snprintf(key, sizeof(key), "svc%zu/GET/200", k);
+        for (size_t v = 0; v < 50; v++) {
+            store_insert(a, key, k + v, 1);
+            store_insert(b, key, k + v + 1000, 1);
+        }
+    }
+    snprintf(key, sizeof(key), "only-in-b");
+    store_insert(b, key, 7, 3);
+    assert(store_size(a) == 200 && store_size(b) == 201);
+    assert(store_get(a, "missing") == NULL);
+
+    store_merge(a, b);
+    assert(store_size(a) == 201);
+    struct QDigest *q = store_get(a, "svc3/GET/200");
+    assert(q && q->N == 100);
+    assert(rank(q, 999) == 50);
+    check_subtree_counts(q->root);
+    assert(store_get(a, "only-in-b")->N == 3);
+
+    // round trip through one sequential buffer
+    size_t len = store_serialized_size(a);
+    void *buf = xmalloc(len);
+    assert(store_serialize(a, buf) == len);
+    struct QDigestStore *c = store_deserialize(buf, len);
+    assert(c && store_size(c) == 201);
+    for (size_t k = 0; k < 200; k += 17) {
+        snprintf(key, sizeof(key), "svc%zu/GET/200", k);
+        struct QDigest *x = store_get(a, key);
+        struct QDigest *y = store_get(c, key);
+        assert(y && x->N == y->N && x->num_nodes == y->num_nodes);
+        assert(percentile(x, 0.9) == percentile(y, 0.9));
+    }
+    // digests of a loaded store keep growing in their shard pool
+    store_insert(c, "svc0/GET/200", 5000, 1);
+    assert(store_get(c, "svc0/GET/200")->N == 101);
+    assert(store_deserialize(buf, len / 2) == NULL);
+    // lengths that would wrap around once padded are rejected
+    uint64_t *lens = (uint64_t *)((char *)buf + sizeof(struct QStoreHeader));
+    const uint64_t key_len = lens[0], snap_len = lens[1];
+    lens[0] = SIZE_MAX;
+    assert(store_deserialize(buf, len) == NULL);
+    lens[0] = key_len;
+    lens[1] = SIZE_MAX;
+    assert(store_deserialize(buf, len) == NULL);
+    lens[1] = snap_len;
+    free(buf);
+
+    delete_store(a);
+    delete_store(b);
+    delete_store(c);
+    printf("Digest store tests passed\n");
+}
+
 /* Test merge */
 void test_merge(void) {
     print_sep("Testing merge");
@@ -118,6 +450,209 @@ void test_merge(void) {
     delete_qdigest(q2);
 }
 
+/* Flattens a tree in preorder */
+static void flatten(const struct QDigestNode *n, struct QFlatNode *out,
+                    size_t *len) {
+    if (!n) return;
+    out[*len].count = n->count;
+    out[*len].subtree_count = n->subtree_count;
+    out[*len].lower_bound = n->lower_bound;
+    out[*len].upper_bound = n->upper_bound;
+    (*len)++;
+    flatten(n->left, out, len);
+    flatten(n->right, out, len);
+}
+
+/* Test merging a flat node array */
+void test_merge_flat(void) {
+    print_sep("Testing merge_flat");
+    struct QDigest *a = create_tmp_q(50, 1);
+    struct QDigest *b = create_tmp_q(50, 1);
+    struct QDigest *c = create_tmp_q(20, 1);
+    for (size_t i = 0; i < 3000; i++) {
+        insert(a, (i * 7919) % 2048, 1, true);
+        insert(b, (i * 7919) % 2048, 1, true);
+        insert(c, (i * 104729) % 9000, 2, true);
+    }
+    struct QFlatNode *flat = xmalloc(c->num_nodes * sizeof(struct QFlatNode));
+    size_t len = 0;
+    flatten(c->root, flat, &len);
+    merge(a, c);
+    // the universe of c is larger, so b has to grow first
+    merge_flat(b, flat, len, c->K);
+    assert(b->N == a->N && b->K == 50);
+    assert(b->root->upper_bound == a->root->upper_bound);
+    check_subtree_counts(b->root);
+    for (double p = 0.1; p < 1.0; p += 0.2)
+        assert(percentile(a, p) == percentile(b, p));
+    free(flat);
+    delete_qdigest(a);
+    delete_qdigest(b);
+    delete_qdigest(c);
+    printf("merge_flat tests passed\n");
+}
+
+/* Test grafting digests over disjoint and overlapping ranges */
+void test_merge_graft(void) {
+    print_sep("Testing merge_graft");
+    struct NodePool *pool = create_pool(64);
+    struct QDigest *ref = create_tmp_q(20, 2047);
+    struct QDigest *a = create_pooled_q(20, 2047, pool);
+    struct QDigest *lo = create_pooled_q(20, 2047, pool);
+    struct QDigest *hi = create_tmp_q(20, 2047);
+    for (size_t i = 0; i < 3000; i++) {
+        size_t v = (i * 7919) % 1024;
+        insert(lo, v, 1, true);
+        insert(hi, 1024 + v / 2, 3, true);
+    }
+    merge(ref, lo);
+    merge(ref, hi);
+    // disjoint slices: lo is moved (same pool), hi is copied
+    merge_graft(a, lo);
+    merge_graft(a, hi);
+    assert(lo->N == 0 && lo->num_nodes == 1 && !lo->root->left);
+    assert(hi->N == 0 && hi->num_nodes == 1 && !hi->root->right);
+    assert(a->N == ref->N);
+    check_subtree_counts(a->root);
+    for (double p = 0.05; p < 1.0; p += 0.1)
+        assert(percentile(a, p) == percentile(ref, p));
+
+    // overlapping digest with a larger universe: same result as merge()
+    struct QDigest *c = create_tmp_q(20, 1);
+    for (size_t i = 0; i < 2000; i++)
+        insert(c, (i * 104729) % 5000, 2, true);
+    struct QDigest *c2 = create_tmp_q(20, 1);
+    for (size_t i = 0; i < 2000; i++)
+        insert(c2, (i * 104729) % 5000, 2, true);
+    merge(ref, c);
+    merge_graft(a, c2);
+    assert(a->N == ref->N && a->root->upper_bound == ref->root->upper_bound);
+    check_subtree_counts(a->root);
+    for (double p = 0.05; p < 1.0; p += 0.1)
+        assert(percentile(a, p) == percentile(ref, p));
+
+    delete_qdigest(c);
+    delete_qdigest(c2);
+    delete_qdigest(hi);
+    delete_qdigest(lo);
+    delete_qdigest(a);
+    delete_qdigest(ref);
+    delete_pool(pool);
+    printf("merge_graft tests passed\n");
+}
+
+/* Test copying a digest node by node */
+void test_clone(void) {
+    print_sep("Testing clone_qdigest");
+    struct QDigest *q = create_tmp_q(20, 1);
+    for (size_t i = 0; i < 50000; i++)
+        insert(q, (i * 7919) % 10007, 1, true);
+    struct QDigest *c = clone_qdigest(q);
+    assert(c->root != q->root && c->pool == q->pool);
+    assert(c->N == q->N && c->K == q->K && c->num_nodes == q->num_nodes);
+    assert(c->root->parent == NULL);
+    check_subtree_counts(c->root);
+
+    char *a = xmalloc((q->num_nodes + 2) * TEXT_LINE_MAX);
+    char *b = xmalloc((q->num_nodes + 2) * TEXT_LINE_MAX);
+    size_t len_a, len_b;
+    to_string(q, a, &len_a);
+    to_string(c, b, &len_b);
+    assert(len_a == len_b && memcmp(a, b, len_a) == 0);
+
+    // the copy is independent of the original
+    insert(c, 3, 1000, true);
+    assert(c->N == q->N + 1000 && rank(q, 3) < rank(c, 3));
+
+    // a pooled copy of a malloc-backed digest, and back
+    struct NodePool *pool = create_pool(256);
+    struct QDigest *pc = clone_qdigest_pooled(q, pool);
+    struct QDigest *mc = clone_qdigest_pooled(pc, NULL);
+    to_string(mc, b, &len_b);
+    assert(pc->pool == pool && mc->pool == NULL);
+    assert(len_a == len_b && memcmp(a, b, len_a) == 0);
+    delete_qdigest(pc);
+    delete_qdigest(mc);
+    delete_pool(pool);
+
+    free(a);
+    free(b);
+    delete_qdigest(c);
+    delete_qdigest(q);
+    printf("clone_qdigest tests passed\n");
+}
+
+/* Test removing digests merged earlier */
+void test_subtract(void) {
+    print_sep("Testing subtract");
+    // with no compression in between, subtracting undoes the merge
+    struct QDigest *q1 = create_tmp_q(1000, 1023);
+    struct QDigest *q2 = create_tmp_q(1000, 1023);
+    for (size_t i = 0; i < 300; i++) {
+        insert(q1, (i * 37) % 1024, 1, true);
+        insert(q2, (i * 101) % 512, 2, true);
+    }
+    size_t before[1024];
+    for (size_t v = 0; v < 1024; v++)
+        before[v] = rank(q1, v);
+    const size_t nodes = q1->num_nodes;
+    merge(q1, q2);
+    assert(q1->N == 900);
+    assert(subtract(q1, q2));
+    assert(q1->N == 300 && q1->num_nodes == nodes);
+    check_subtree_counts(q1->root);
+    for (size_t v = 0; v < 1024; v++)
+        assert(rank(q1, v) == before[v]);
+    // counts never merged are reported missing
+    struct QDigest *empty = create_tmp_q(1000, 1023);
+    assert(!subtract(empty, q2));
+    assert(empty->N == 0);
+    delete_qdigest(empty);
+    delete_qdigest(q1);
+    delete_qdigest(q2);
+
+    // a sliding window of 4 buckets kept with one merge and one subtract
+    // per tick, compressed all along, against the exact window
+    const size_t W = 4, ticks = 12, per_tick = 5000, K = 50;
+    struct QDigest *buckets[12];
+    size_t *values = xmalloc(ticks * per_tick * sizeof(size_t));
+    struct QDigest *agg = create_tmp_q(K, 65535);
+    for (size_t t = 0; t < ticks; t++) {
+        buckets[t] = create_tmp_q(K, 65535);
+        for (size_t i = 0; i < per_tick; i++) {
+            // the distribution drifts upwards tick after tick
+            size_t v = (t * 4000 + (i * 7919) % 20000) % 65536;
+            values[t * per_tick + i] = v;
+            insert(buckets[t], v, 1, true);
+        }
+        merge(agg, buckets[t]);
+        if (t >= W)
+            assert(subtract(agg, buckets[t - W]));
+        check_subtree_counts(agg->root);
+        const size_t first = t >= W ? t - W + 1 : 0;
+        const size_t n = (t + 1 - first) * per_tick;
+        assert(agg->N == n);
+
+        // exact ranks of the live values, against the bound of the
+        // largest N the aggregate had
+        const size_t bound = 16 * (W * per_tick + per_tick) / K;
+        for (size_t v = 0; v < 65536; v += 1021) {
+            size_t exact = 0;
+            for (size_t i = first * per_tick; i < (t + 1) * per_tick; i++)
+                exact += values[i] <= v;
+            const size_t r = rank(agg, v);
+            assert(r <= exact + bound && exact <= r + bound);
+        }
+    }
+    printf("window aggregate after %zu ticks: %zu nodes\n", ticks,
+           agg->num_nodes);
+    for (size_t t = 0; t < ticks; t++)
+        delete_qdigest(buckets[t]);
+    delete_qdigest(agg);
+    free(values);
+    printf("subtract tests passed\n");
+}
+
 /* Test swap_q */
 void test_swap_q(void) {
     print_sep("Testing swap_q");
@@ -160,6 +695,565 @@ void test_serialization(void) {
     delete_qdigest(q2);
 }
 
+/* Test parallel serialization against the serial reader and writer */
+void test_parallel_serialization(void) {
+    print_sep("Testing parallel serialization and deserialization");
+    struct QDigest *q = create_tmp_q(5000, 1);
+    for (size_t i = 0; i < 50000; i++)
+        insert(q, (i * 2654435761u) % 1000003, 1 + i % 3, false);
+    compress_now(q);
+
+    size_t cap = (q->num_nodes + 1) * TEXT_LINE_MAX;
+    char *serial = xmalloc(cap);
+    char *parallel = xmalloc(cap);
+    size_t serial_len, parallel_len;
+    to_string(q, serial, &serial_len);
+    printf("serialized %zu nodes into %zu chars\n", q->num_nodes, serial_len);
+    int depths[] = {0, 1, 4, 9, 40};
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        to_string_parallel(q, parallel, &parallel_len, depths[d]);
+        assert(parallel_len == serial_len);
+        assert(strcmp(serial, parallel) == 0);
+
+        struct QDigest *r = from_string_parallel(parallel, depths[d]);
+        assert(r && r->N == q->N && r->num_nodes <= q->num_nodes);
+        check_subtree_counts(r->root);
+        to_string(r, parallel, &parallel_len);
+        assert(strcmp(serial, parallel) == 0);
+        assert(percentile(r, 0.5) == percentile(q, 0.5));
+        delete_qdigest(r);
+    }
+    // a digest whose universe does not reach the split depth
+    struct QDigest *small = create_tmp_q(10, 1);
+    insert(small, 1, 2, false);
+    to_string_parallel(small, parallel, &parallel_len, 8);
+    struct QDigest *r = from_string_parallel(parallel, 8);
+    assert(r && r->N == 2 && rank(r, 1) == 2);
+    delete_qdigest(r);
+    assert(from_string_parallel("garbage", 4) == NULL);
+
+    delete_qdigest(small);
+    free(serial);
+    free(parallel);
+    delete_qdigest(q);
+    printf("Parallel serialization tests passed\n");
+}
+
+/* Number of node lines in a to_delta() text */
+static size_t delta_lines(const char *buf) {
+    size_t lines = 0;
+    for (; *buf; buf++)
+        lines += *buf == '\n';
+    return lines - 1;
+}
+
+/* Checks that the replica serializes exactly like the sender */
+static void check_replica(struct QDigest *q, struct QDigest *r) {
+    size_t cap = (q->num_nodes + r->num_nodes + 1) * TEXT_LINE_MAX;
+    char *a = xmalloc(cap);
+    char *b = xmalloc(cap);
+    size_t len;
+    to_string(q, a, &len);
+    to_string(r, b, &len);
+    assert(strcmp(a, b) == 0);
+    check_subtree_counts(r->root);
+    free(a);
+    free(b);
+}
+
+/* Test delta serialization */
+void test_delta(void) {
+    print_sep("Testing delta serialization");
+    struct QDigest *q = create_tmp_q(20, 1);
+    struct QDigest *r = create_tmp_q(20, 1);
+    for (size_t i = 0; i < 2000; i++)
+        insert(q, (i * 7919) % 4096, 1, true);
+
+    char *buf = xmalloc(delta_max_size(q));
+    size_t len;
+    uint64_t v = to_delta(q, 0, buf, &len);
+    size_t full_lines = delta_lines(buf);
+    assert(apply_delta(r, buf) == v);
+    check_replica(q, r);
+
+    // a few more values only touch a few nodes
+    for (size_t i = 0; i < 300; i++)
+        insert(q, 100 + i % 5, 1, false);
+    uint64_t v2 = to_delta(q, v, buf, &len);
+    assert(v2 > v && delta_lines(buf) < full_lines);
+    assert(apply_delta(r, buf) == v2);
+    check_replica(q, r);
+
+    // compression removes nodes, which the delta carries as tombstones
+    compress_now(q);
+    assert(q->log.len > 0);
+    v2 = to_delta(q, v2, buf, &len);
+    assert(apply_delta(r, buf) == v2);
+    check_replica(q, r);
+
+    // nothing changed: an empty delta
+    uint64_t v3 = to_delta(q, v2, buf, &len);
+    assert(delta_lines(buf) == 0 && apply_delta(r, buf) == v3);
+
+    // merges and universe growth travel as deltas too
+    struct QDigest *other = create_tmp_q(20, 1);
+    for (size_t i = 0; i < 50; i++)
+        insert(other, 3 * i, 2, true);
+    merge(q, other);
+    insert(q, 10000, 1, true);
+    free(buf);
+    buf = xmalloc(delta_max_size(q));
+    uint64_t v4 = to_delta(q, v3, buf, &len);
+    assert(apply_delta(r, buf) == v4);
+    check_replica(q, r);
+    assert(r->N == q->N);
+
+    // once the receivers' history is trimmed, older bases get full deltas
+    compress_now(q);
+    insert(q, 1, 1, false);
+    trim_tombstones(q, v4 + 100);
+    to_delta(q, v, buf, &len);
+    int full = 0;
+    assert(sscanf(buf, "%*s %*s %d", &full) == 1 && full == 1);
+    assert(apply_delta(r, buf) > v4);
+    check_replica(q, r);
+    assert(apply_delta(r, "nonsense") == 0);
+
+    free(buf);
+    delete_qdigest(other);
+    delete_qdigest(q);
+    delete_qdigest(r);
+
+    // the log trims itself even when a compress deletes past the limit
+    // in one go: len grows while num_nodes shrinks, so an odd gap
+    // between them never makes the two equal
+    q = create_tmp_q(20, 4095);
+    set_compress_policy(q, COMPRESS_MANUAL, 0, 1.0);
+    buf = NULL;
+    size_t peak = DELTA_MIN_TOMBSTONES;
+    for (size_t round = 0; round < 200; round++) {
+        for (size_t i = 0; i < 3000; i++)
+            insert(q, (round * 3001 + i * 7919) % 4096, 1, false);
+        if (q->num_nodes > peak)
+            peak = q->num_nodes;
+        buf = realloc(buf, delta_max_size(q));
+        to_delta(q, 0, buf, &len);
+        compress_now(q);
+        assert(q->log.len <= peak);
+    }
+    free(buf);
+    delete_qdigest(q);
+    printf("Delta serialization tests passed\n");
+}
+
+/* Test block compression of serialized digests */
+void test_pack(void) {
+    print_sep("Testing block compression");
+    // repetitive text, long overlapping runs, noise and the empty block
+    size_t n = 100000;
+    uint8_t *raw = xmalloc(n);
+    for (size_t i = 0; i < n; i++)
+        raw[i] = (i < n / 2) ? "12 13 7\n"[i % 8] : (uint8_t)'a';
+    uint8_t *noise = xmalloc(n);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        noise[i] = (uint8_t)(x >> 32);
+    }
+    uint8_t *out = xmalloc(pack_bound(n));
+    uint8_t *back = xmalloc(n);
+    size_t len = lz_compress(raw, n, out);
+    assert(len < n / 20 && lz_decompress(out, len, back, n));
+    assert(memcmp(raw, back, n) == 0);
+    len = lz_compress(noise, n, out);
+    assert(len <= lz_bound(n) && lz_decompress(out, len, back, n));
+    assert(memcmp(noise, back, n) == 0);
+    len = lz_compress(raw, 0, out);
+    assert(lz_decompress(out, len, back, 0));
+
+    // small or incompressible inputs are stored raw, flagged as such
+    struct PackHeader hdr;
+    size_t raw_len;
+    len = pack(raw, 100, out, PACK_DEFAULT_THRESHOLD);
+    memcpy(&hdr, out, sizeof(hdr));
+    assert(len == sizeof(hdr) + 100 && hdr.flags == 0);
+    len = pack(noise, n, out, PACK_DEFAULT_THRESHOLD);
+    memcpy(&hdr, out, sizeof(hdr));
+    assert(hdr.flags == 0);
+    len = pack(raw, n, out, PACK_DEFAULT_THRESHOLD);
+    memcpy(&hdr, out, sizeof(hdr));
+    assert(hdr.flags == PACK_FLAG_LZ && is_packed(out, len));
+    uint8_t *unpacked = unpack_alloc(out, len, &raw_len);
+    assert(unpacked && raw_len == n && memcmp(unpacked, raw, n) == 0);
+    free(unpacked);
+    // truncated or damaged buffers are rejected
+    assert(unpack_alloc(out, len - 1, &raw_len) == NULL);
+    out[sizeof(hdr) + 3] ^= 0x5a;
+    unpacked = unpack_alloc(out, len, &raw_len);
+    assert(!unpacked || memcmp(unpacked, raw, n) != 0);
+    free(unpacked);
+    assert(!is_packed("QDPX", 4));
+
+    // digests
+    struct QDigest *q = create_tmp_q(1000, 1);
+    for (size_t i = 0; i < 20000; i++)
+        insert(q, (i * 7919) % 100003, 1, true);
+    size_t packed_len;
+    void *packed = to_packed(q, PACK_DEFAULT_THRESHOLD, &packed_len);
+    struct QDigest *r = from_packed(packed, packed_len);
+    assert(r && r->N == q->N && r->num_nodes == q->num_nodes);
+    assert(percentile(r, 0.9) == percentile(q, 0.9));
+    size_t text_len;
+    char *text = xmalloc((q->num_nodes + 2) * TEXT_LINE_MAX);
+    to_string(q, text, &text_len);
+    printf("digest text %zu bytes, packed %zu bytes\n", text_len, packed_len);
+    assert(packed_len < text_len);
+    free(text);
+    free(packed);
+    delete_qdigest(r);
+    delete_qdigest(q);
+
+    // stores are packed on disk
+    struct QDigestStore *s = create_store(2, 100, 1023);
+    char key[32];
+    for (size_t k = 0; k < 100; k++) {
+        snprintf(key, sizeof(key), "svc%zu", k);
+        store_insert(s, key, k, 1);
+    }
+    char path[] = "/tmp/qpack_testXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(store_save(s, path) == 0);
+    struct QDigestStore *loaded = store_load(path);
+    assert(loaded && store_size(loaded) == 100);
+    assert(store_get(loaded, "svc42")->N == 1);
+    unlink(path);
+    delete_store(loaded);
+    delete_store(s);
+
+    free(raw);
+    free(noise);
+    free(out);
+    free(back);
+    printf("Block compression tests passed\n");
+}
+
+/* Test the exact small-N state and its promotion */
+void test_hybrid(void) {
+    print_sep("Testing exact small-N digests");
+    struct QHybrid *h = create_hybrid(5, 99, 64);
+    // 300 values over 50 distinct keys, inserted out of order
+    for (size_t i = 0; i < 300; i++)
+        hybrid_insert(h, (i * 37) % 50, 1 + i % 2);
+    assert(hybrid_is_exact(h) && h->N == 450);
+    // the median is the first key whose rank reaches half of N
+    size_t cum = 0, key = 0;
+    for (; key < 50; key++) {
+        cum = hybrid_rank(h, key);
+        if (cum >= 225)
+            break;
+    }
+    assert(hybrid_percentile(h, 0.5) == key);
+    assert(hybrid_rank(h, 49) == 450 && hybrid_rank(h, 1000) == 450);
+
+    // the text is a tree of leaves that from_string() reads as well
+    char *buf = xmalloc(hybrid_max_string(h));
+    size_t len;
+    hybrid_to_string(h, buf, &len);
+    struct QDigest *q = from_string(buf);
+    assert(q->N == 450 && percentile(q, 0.5) == key);
+    struct QHybrid *copy = hybrid_from_string(buf, 64);
+    assert(hybrid_is_exact(copy) && copy->N == 450);
+    assert(hybrid_percentile(copy, 0.9) == hybrid_percentile(h, 0.9));
+    // a smaller limit has to rebuild the tree
+    struct QHybrid *tree = hybrid_from_string(buf, 10);
+    assert(!hybrid_is_exact(tree) && hybrid_digest(tree)->N == 450);
+    delete_qdigest(q);
+    free(buf);
+
+    // exact + exact stays exact while the union fits
+    hybrid_merge(h, copy);
+    assert(hybrid_is_exact(h) && h->N == 900 && hybrid_rank(h, 10) ==
+           2 * hybrid_rank(copy, 10));
+
+    // more distinct values than the limit promote it in one build
+    for (size_t i = 0; i < 1000; i++)
+        hybrid_insert(h, 100 + i, 1);
+    assert(!hybrid_is_exact(h) && h->q->N == 1900);
+    assert(h->q->root->upper_bound == 2047);
+    check_subtree_counts(h->q->root);
+    assert(hybrid_rank(h, 2047) == 1900);
+
+    // exact into promoted, promoted into exact
+    hybrid_merge(h, copy);
+    assert(h->q->N == 2350);
+    hybrid_merge(copy, h);
+    assert(!hybrid_is_exact(copy) && copy->q->N == 2800);
+    check_subtree_counts(copy->q->root);
+
+    delete_hybrid(tree);
+    delete_hybrid(copy);
+    delete_hybrid(h);
+    printf("Exact small-N tests passed\n");
+}
+
+/* Test dense leaf blocks against the plain insert path */
+void test_blocked(void) {
+    print_sep("Testing dense leaf blocks");
+    // a dense stream over [0, 4096), flushed every 16 blocks
+    struct QBlocked *b = create_blocked(100, 1, 6, 16);
+    struct QDigest *plain = create_tmp_q(100, 4095);
+    const size_t n = 200000;
+    for (size_t i = 0; i < n; i++) {
+        size_t v = (i * 7919) % 4096;
+        blocked_insert(b, v, 1);
+        insert(plain, v, 1, true);
+    }
+    struct QDigest *q = blocked_digest(b);
+    assert(q->N == n && b->live == 0 && b->pending == 0);
+    assert(q->root->upper_bound == 4095);
+    check_subtree_counts(q->root);
+    compress_now(plain);
+    printf("blocked digest: %zu nodes, plain inserts: %zu nodes\n",
+           q->num_nodes, plain->num_nodes);
+    assert(q->num_nodes <= plain->num_nodes);
+    // both stay within the q-digest error bound of log2(U) * N / K
+    const size_t bound = 12 * n / 100;
+    for (double p = 0.05; p < 1.0; p += 0.1) {
+        size_t exact_rank = (size_t)(p * n);
+        size_t r = blocked_rank(b, blocked_percentile(b, p));
+        assert(r + bound >= exact_rank && r <= exact_rank + bound);
+    }
+
+    // keys past the universe grow the tree as insert() would
+    blocked_insert(b, 100000, 3);
+    assert(blocked_rank(b, 200000) == n + 3);
+    assert(blocked_digest(b)->root->upper_bound == 131071);
+    delete_qdigest(plain);
+    delete_blocked(b);
+    printf("Dense leaf block tests passed\n");
+}
+
+/* Test flat array digests against the tree engine */
+void test_qarray(void) {
+    print_sep("Testing flat array digests");
+    struct QArray *a = create_array_q(20, 1000);
+    struct QArray *b = create_array_q(20, 100);
+    assert(a->width == 1024 && b->width == 128);
+    assert(!create_array_q(20, (size_t)1 << ARRAY_MAX_HEIGHT));
+    for (size_t i = 0; i < 5000; i++) {
+        assert(array_insert(a, (i * 31) % 1000, 1));
+        assert(array_insert(b, (i * 17) % 100, 2));
+    }
+    assert(!array_insert(a, (size_t)1 << ARRAY_MAX_HEIGHT, 1));
+    // uncompressed, every count is on its leaf
+    assert(array_rank(b, 49) == 5000);
+    assert(array_percentile(b, 0.5) == 49);
+
+    // merging grows b to the universe of a
+    array_merge(b, a);
+    assert(b->width == 1024 && b->N == 15000);
+    assert(array_rank(b, 99) == 10000 + array_rank(a, 99));
+    array_compress(b);
+    assert(b->N == 15000 && array_rank(b, 1023) == 15000);
+
+    // the tree holding the same nodes gives the same answers and text
+    struct QDigest *q = array_to_digest(b);
+    assert(q->N == b->N && q->root->upper_bound == 1023);
+    check_subtree_counts(q->root);
+    for (double p = 0.0; p <= 1.0; p += 0.05)
+        assert(array_percentile(b, p) == percentile(q, p));
+    for (size_t v = 0; v < 1024; v += 7)
+        assert(array_rank(b, v) == rank(q, v));
+    char *text_a = xmalloc(array_max_string(b));
+    char *text_q = xmalloc(array_max_string(b));
+    size_t len_a, len_q;
+    array_to_string(b, text_a, &len_a);
+    to_string(q, text_q, &len_q);
+    assert(len_a == len_q && memcmp(text_a, text_q, len_a) == 0);
+
+    // text and binary round trips
+    struct QArray *c = array_from_string(text_q);
+    assert(c && c->N == b->N && c->width == b->width);
+    assert(memcmp(c->counts, b->counts, 2 * b->width * sizeof(size_t)) == 0);
+    delete_array_q(c);
+    c = array_from_digest(q);
+    assert(c && memcmp(c->counts, b->counts,
+                       2 * b->width * sizeof(size_t)) == 0);
+    delete_array_q(c);
+    size_t size = array_encoded_size(b);
+    void *bin = xmalloc(size);
+    assert(array_encode(b, bin) == size);
+    printf("array: %zu text bytes, %zu binary bytes\n", len_a, size);
+    c = array_decode(bin, size);
+    assert(c && c->N == b->N && c->K == b->K);
+    assert(memcmp(c->counts, b->counts, 2 * b->width * sizeof(size_t)) == 0);
+    delete_array_q(c);
+    assert(!array_decode(bin, size - 1));
+    assert(!array_decode(bin, sizeof(struct ArrayHeader) - 1));
+    // K == 0 is rejected rather than dividing by zero on compression
+    assert(!array_from_string("5 0 0 7\n0 7 5\n"));
+    struct ArrayHeader *hdr = bin;
+    hdr->K = 0;
+    assert(!array_decode(bin, size));
+
+    // merged counts clamp at SIZE_MAX instead of wrapping around
+    struct QArray *x = create_array_q(20, 7);
+    struct QArray *y = create_array_q(20, 7);
+    x->counts[x->width + 3] = SIZE_MAX - 1;
+    x->N = SIZE_MAX - 1;
+    array_insert(y, 3, 5);
+    array_insert(y, 2, 5);
+    array_merge(x, y);
+    assert(x->counts[x->width + 3] == SIZE_MAX && x->N == SIZE_MAX);
+    // and a saturated pair of leaves is not folded as a small sum
+    array_compress(x);
+    assert(x->counts[x->width + 3] == SIZE_MAX && x->counts[1] == 0);
+    delete_array_q(x);
+    delete_array_q(y);
+
+    // a universe that is not a power of two has no flat layout
+    struct QDigest *odd = create_tmp_q(20, 99);
+    assert(!array_from_digest(odd));
+    delete_qdigest(odd);
+
+    free(bin);
+    free(text_a);
+    free(text_q);
+    delete_qdigest(q);
+    delete_array_q(a);
+    delete_array_q(b);
+    printf("Flat array digest tests passed\n");
+}
+
+/* Test order-preserving key maps */
+void test_keymap(void) {
+    print_sep("Testing order-preserving key maps");
+    const unsigned bits = KEYMAP_DEFAULT_BITS;
+    // integers: small values exact, larger ones within 2^-(bits + 1)
+    for (size_t v = 0; v < 1000000; v += 7) {
+        assert(log_key(v, bits) <= log_key(v + 1, bits));
+        const size_t back = log_value(log_key(v, bits), bits);
+        assert(log_key(back, bits) == log_key(v, bits));
+        assert((back > v ? back - v : v - back) <= v >> (bits + 1));
+        if (v < ((size_t)1 << bits))
+            assert(back == v);
+    }
+    assert(log_key(SIZE_MAX, bits) == log_upper_bound(bits));
+    assert(log_value(log_upper_bound(bits), bits) <= SIZE_MAX);
+
+    // latencies in nanoseconds, from 1 us to about 10 s
+    struct QDigest *plain = create_tmp_q(1000, 1);
+    struct QDigest *mapped = create_tmp_q(1000, 1);
+    const size_t n = 100000;
+    size_t *keys = xmalloc(n * sizeof(size_t));
+    size_t seed = 12345;
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const size_t v = (size_t)(1000.0 * pow(10.0, 7.0 * (seed >> 11) /
+                                                      9007199254740992.0));
+        insert(plain, v, 1, true);
+        insert_log(mapped, v, 1, bits);
+        keys[i] = log_key(v, bits);
+    }
+    const size_t plain_depth = log_2_ceil(plain->root->upper_bound + 1);
+    const size_t mapped_depth = log_2_ceil(mapped->root->upper_bound + 1);
+    printf("plain tree depth: %zu, mapped tree depth: %zu\n", plain_depth,
+           mapped_depth);
+    assert(2 * mapped_depth < plain_depth);
+    // the mapped percentiles are within the digest bound in key space
+    const size_t bound = mapped_depth * n / 1000;
+    for (double p = 0.05; p < 1.0; p += 0.1) {
+        const size_t v = percentile_log(mapped, p, bits);
+        size_t below = 0;
+        for (size_t i = 0; i < n; i++)
+            below += keys[i] <= log_key(v, bits);
+        const size_t exact = (size_t)(p * n);
+        assert(below + bound >= exact && below <= exact + bound);
+    }
+    free(keys);
+    delete_qdigest(plain);
+    delete_qdigest(mapped);
+
+    // doubles in [1e-6, 1e3], negative ones mirrored
+    struct KeyMap map;
+    assert(!keymap_init(&map, 53, 1.0, 2.0, false));
+    assert(!keymap_init(&map, bits, 0.0, 2.0, false));
+    assert(!keymap_init(&map, bits, 2.0, 1.0, false));
+    assert(keymap_init(&map, bits, 1e-6, 1e3, true));
+    const size_t zero = keymap_key(&map, 0.0);
+    assert(zero == map.span && keymap_value(&map, zero) == 0.0);
+    assert(keymap_key(&map, 1e-9) == zero && keymap_key(&map, -1e-9) == zero);
+    assert(keymap_key(&map, 1e9) == keymap_upper_bound(&map));
+    assert(keymap_key(&map, -1e9) == 0);
+    for (double m = 1e-6; m <= 1e3; m *= 1.03) {
+        const size_t k = keymap_key(&map, m);
+        assert(k > zero && k <= keymap_key(&map, m * 1.03));
+        assert(keymap_key(&map, -m) == 2 * zero - k);
+        const double back = keymap_value(&map, k);
+        assert(fabs(back - m) <= m / (1 << (bits + 1)));
+        assert(keymap_value(&map, 2 * zero - k) == -back);
+    }
+    struct QDigest *q = create_tmp_q(100, keymap_upper_bound(&map));
+    for (int i = -500; i < 500; i++)
+        insert_double(q, &map, i * 0.25, 1);
+    assert(rank_double(q, &map, 1e9) == 1000);
+    const double median = percentile_double(q, &map, 0.5);
+    assert(median > -5.0 && median < 5.0);
+    delete_qdigest(q);
+    printf("Key map tests passed\n");
+}
+
+/* The writer side of test_live() */
+static void *live_writer(void *arg) {
+    struct QLive *l = arg;
+    for (size_t i = 0; i < 400000; i++)
+        live_insert(l, (i * 7919) % 100000, 1);
+    live_publish(l);
+    return NULL;
+}
+
+/* Test snapshots read while a writer inserts */
+void test_live(void) {
+    print_sep("Testing snapshots during ingest");
+    struct QLive *l = create_live(100, 1, 1000);
+    struct QView *empty = qdigest_snapshot(l);
+    assert(empty->snap->hdr->N == 0);
+
+    pthread_t writer;
+    assert(pthread_create(&writer, NULL, live_writer, l) == 0);
+    // readers keep querying views while the writer inserts
+    uint64_t last_serial = 0;
+    size_t last_n = 0, views = 0;
+    while (last_n < 400000) {
+        struct QView *v = qdigest_snapshot(l);
+        const struct QSnapshot *s = v->snap;
+        assert(v->serial >= last_serial && s->hdr->N >= last_n);
+        assert(snapshot_rank(s, SIZE_MAX) == s->hdr->N);
+        if (s->hdr->N > 0)
+            assert(snapshot_percentile(s, 0.5) < 131072);
+        views += v->serial != last_serial;
+        last_serial = v->serial;
+        last_n = s->hdr->N;
+        view_release(l, v);
+    }
+    assert(pthread_join(writer, NULL) == 0);
+    printf("reader saw %zu distinct views\n", views);
+
+    // an old view is unchanged and outlives the publications after it
+    assert(empty->serial == 1 && empty->snap->hdr->N == 0);
+    view_release(l, empty);
+    struct QView *v = qdigest_snapshot(l);
+    assert(v->snap->hdr->N == l->q->N && v->serial == l->serial);
+    assert(snapshot_percentile(v->snap, 0.5) == percentile(l->q, 0.5));
+    view_release(l, v);
+    delete_live(l);
+    printf("Snapshot during ingest tests passed\n");
+}
+
 int main(void) {
     test_log_2_ceil();
     test_node_create_delete();
@@ -168,9 +1262,29 @@ int main(void) {
     test_insert_node_and_traversal();
     test_expand_tree();
     test_compress();
+    test_compress_policy();
+    test_insert_weighted();
+    test_export();
+    test_rank();
+    test_window();
+    test_decay();
+    test_snapshot();
+    test_store();
     test_merge();
+    test_merge_flat();
+    test_merge_graft();
+    test_clone();
+    test_subtract();
     test_swap_q();
     test_serialization();
+    test_parallel_serialization();
+    test_delta();
+    test_pack();
+    test_hybrid();
+    test_blocked();
+    test_qarray();
+    test_keymap();
+    test_live();
 
     printf("\nAll tests completed successfully.\n");
 
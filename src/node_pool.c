@@ -0,0 +1,75 @@
+#include "../include/node_pool.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <stdlib.h>
+
+struct NodePool *create_pool(size_t slab_nodes) {
+  struct NodePool *p = xmalloc(sizeof(struct NodePool));
+  p->slabs = NULL;
+  p->free_list = NULL;
+  p->slab_nodes = slab_nodes > 0 ? slab_nodes : 1;
+  // force a new slab on the first allocation
+  p->slab_used = p->slab_nodes;
+  p->in_use = 0;
+  return p;
+}
+
+void delete_pool(struct NodePool *p) {
+  if (!p)
+    return;
+  struct NodeSlab *s = p->slabs;
+  while (s) {
+    struct NodeSlab *next = s->next;
+    free(s);
+    s = next;
+  }
+  free(p);
+}
+
+struct QDigestNode *pool_alloc(struct NodePool *p, size_t lower_bound,
+                               size_t upper_bound) {
+  if (!p)
+    return create_node(lower_bound, upper_bound);
+
+  struct QDigestNode *ret;
+  if (p->free_list) {
+    ret = p->free_list;
+    p->free_list = ret->left;
+  } else {
+    if (p->slab_used == p->slab_nodes) {
+      struct NodeSlab *s = xmalloc(sizeof(struct NodeSlab) +
+                                   p->slab_nodes * sizeof(struct QDigestNode));
+      s->next = p->slabs;
+      p->slabs = s;
+      p->slab_used = 0;
+    }
+    ret = &p->slabs->nodes[p->slab_used++];
+  }
+  p->in_use++;
+
+  ret->left = ret->right = ret->parent = NULL;
+  ret->count = 0;
+  ret->version = 0;
+  ret->subtree_count = 0;
+  ret->lower_bound = lower_bound;
+  ret->upper_bound = upper_bound;
+  return ret;
+}
+
+void pool_free(struct NodePool *p, struct QDigestNode *n) {
+  if (!p) {
+    delete_node(n);
+    return;
+  }
+  n->left = p->free_list;
+  p->free_list = n;
+  p->in_use--;
+}
+
+void pool_free_tree(struct NodePool *p, struct QDigestNode *n) {
+  if (!n)
+    return;
+  pool_free_tree(p, n->left);
+  pool_free_tree(p, n->right);
+  pool_free(p, n);
+}
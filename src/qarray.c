@@ -0,0 +1,386 @@
+#include "../include/qarray.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Allocates zeroed counts for a tree of the given width */
+static size_t *alloc_counts(size_t width) {
+    size_t *counts = xmalloc(2 * width * sizeof(size_t));
+    memset(counts, 0, 2 * width * sizeof(size_t));
+    return counts;
+}
+
+struct QArray *create_array_q(size_t K, size_t upper_bound) {
+    if (upper_bound >= ((size_t)1 << ARRAY_MAX_HEIGHT))
+        return NULL;
+    struct QArray *a = xmalloc(sizeof(struct QArray));
+    a->width = (size_t)1 << log_2_ceil(upper_bound + 1);
+    a->counts = alloc_counts(a->width);
+    a->N = 0;
+    a->K = K;
+    return a;
+}
+
+void delete_array_q(struct QArray *a) {
+    free(a->counts);
+    free(a);
+}
+
+/* Heap index of the node [lower, upper], 0 if it is not a node of a
+ * tree with `width` leaves */
+static size_t node_index(size_t width, size_t lower, size_t upper) {
+    if (lower > upper || upper >= width)
+        return 0;
+    const size_t span = upper - lower + 1;
+    if ((span & (span - 1)) != 0 || lower % span != 0)
+        return 0;
+    return width / span + lower / span;
+}
+
+/* Adds the counts of a tree of width `from` to those of a tree of width
+ * `to` >= `from`, whose root is the leftmost node of the same span: the
+ * nodes of level l sit at index 2^l * to/from in the larger tree.
+ * Sums clamp at SIZE_MAX. */
+static void add_counts(size_t *dst, size_t to, const size_t *src,
+                       size_t from) {
+    const size_t f = to / from;
+    for (size_t l = 1; l <= from; l *= 2) {
+        size_t *d = dst + l * f;
+        const size_t *s = src + l;
+        #pragma omp simd
+        for (size_t i = 0; i < l; i++) {
+            // saturating, like add_saturating(), without a branch
+            const size_t sum = d[i] + s[i];
+            d[i] = sum < d[i] ? SIZE_MAX : sum;
+        }
+    }
+}
+
+/* Grows the universe to `width` leaves, the old root becoming the
+ * leftmost node of its span */
+static void grow(struct QArray *a, size_t width) {
+    size_t *counts = alloc_counts(width);
+    add_counts(counts, width, a->counts, a->width);
+    free(a->counts);
+    a->counts = counts;
+    a->width = width;
+}
+
+bool array_insert(struct QArray *a, size_t key, unsigned int count) {
+    if (key >= a->width) {
+        if (key >= ((size_t)1 << ARRAY_MAX_HEIGHT))
+            return false;
+        grow(a, (size_t)1 << log_2_ceil(key + 1));
+    }
+    add_saturating(&a->counts[a->width + key], count);
+    add_saturating(&a->N, count);
+    return true;
+}
+
+void array_compress(struct QArray *a) {
+    compress_implicit(a->counts, a->width, a->N / a->K);
+}
+
+/* The counts of the nodes ending at value v, in postorder: the leaf,
+ * then each ancestor of which it is the last leaf */
+#define FOR_NODES_ENDING_AT(a, v, i)                                        \
+    for (size_t i = (a)->width + (v), _more = 1; _more;                     \
+         _more = (i & 1), i >>= 1)
+
+size_t array_percentile(const struct QArray *a, double p) {
+    if (p <= 0.0) p = 0.0;
+    if (p >= 1.0) p = 1.0;
+    size_t req_rank;
+    if (a->N <= ((size_t)1 << 53)) {
+        req_rank = p * a->N;
+    } else {
+        const uint64_t den = (uint64_t)1 << 53;
+        req_rank = mul_div_floor(a->N, (uint64_t)(p * den), den);
+    }
+    if (req_rank == 0)
+        return 0;
+    // walks the nodes in the order postorder_by_rank() visits them
+    size_t curr_rank = 0;
+    for (size_t v = 0; v < a->width; v++) {
+        FOR_NODES_ENDING_AT(a, v, i) {
+            add_saturating(&curr_rank, a->counts[i]);
+            if (curr_rank >= req_rank)
+                return v;
+            if (i == 1)
+                break;
+        }
+    }
+    return a->width - 1;
+}
+
+size_t array_rank(const struct QArray *a, size_t value) {
+    if (value >= a->width)
+        value = a->width - 1;
+    size_t r = 0;
+    for (size_t v = 0; v <= value; v++) {
+        FOR_NODES_ENDING_AT(a, v, i) {
+            add_saturating(&r, a->counts[i]);
+            if (i == 1)
+                break;
+        }
+    }
+    return r;
+}
+
+void array_merge(struct QArray *a1, const struct QArray *a2) {
+    if (a2->width > a1->width)
+        grow(a1, a2->width);
+    add_counts(a1->counts, a1->width, a2->counts, a2->width);
+    add_saturating(&a1->N, a2->N);
+    if (a2->K > a1->K)
+        a1->K = a2->K;
+}
+
+/* Calls visit() on the non-empty nodes in the preorder of to_string() */
+static void preorder_nodes(const struct QArray *a,
+                           void (*visit)(const struct QArray *, size_t,
+                                         void *),
+                           void *ctx) {
+    // at most one pending right sibling per level
+    size_t stack[ARRAY_MAX_HEIGHT + 2];
+    size_t top = 0;
+    stack[top++] = 1;
+    while (top > 0) {
+        const size_t i = stack[--top];
+        if (a->counts[i] > 0)
+            visit(a, i, ctx);
+        if (i < a->width) {
+            stack[top++] = 2 * i + 1;
+            stack[top++] = 2 * i;
+        }
+    }
+}
+
+/* Bounds of the node at heap index i */
+static void node_bounds(size_t width, size_t i, size_t *lower,
+                        size_t *upper) {
+    size_t level_start = 1;
+    while (level_start * 2 <= i)
+        level_start *= 2;
+    const size_t span = width / level_start;
+    *lower = (i - level_start) * span;
+    *upper = *lower + span - 1;
+}
+
+size_t array_max_string(const struct QArray *a) {
+    size_t lines = 0;
+    for (size_t i = 1; i < 2 * a->width; i++)
+        lines += a->counts[i] > 0;
+    // the header line takes at most two node lines
+    return (lines + 2) * TEXT_LINE_MAX;
+}
+
+struct TextCursor {
+    char *buf;
+    size_t len;
+};
+
+static void write_line(const struct QArray *a, size_t i, void *ctx) {
+    struct TextCursor *c = ctx;
+    size_t lower, upper;
+    node_bounds(a->width, i, &lower, &upper);
+    c->len += sprintf(c->buf + c->len, "%zu %zu %zu\n", lower, upper,
+                      a->counts[i]);
+}
+
+void array_to_string(const struct QArray *a, char *buf, size_t *buf_length) {
+    struct TextCursor c = {buf, 0};
+    c.len = sprintf(buf, "%zu %zu %d %zu\n", a->N, a->K, 0, a->width - 1);
+    preorder_nodes(a, write_line, &c);
+    *buf_length = c.len;
+}
+
+struct QArray *array_from_string(const char *buf) {
+    size_t N, K, lower_bound, upper_bound;
+    int chars = 0;
+    if (sscanf(buf, "%zu %zu %zu %zu\n%n", &N, &K, &lower_bound,
+               &upper_bound, &chars) != 4)
+        return NULL;
+    // K == 0 would divide by zero in array_compress()
+    if (K == 0 || lower_bound != 0 || ((upper_bound + 1) & upper_bound) != 0)
+        return NULL;
+    struct QArray *a = create_array_q(K, upper_bound);
+    if (!a)
+        return NULL;
+
+    // the same lines from_string() reads, up to the first malformed one
+    const char *p = buf + chars;
+    const char *end = p + strlen(p);
+    size_t v[3];
+    while (parse_node_line(&p, end, v)) {
+        const size_t idx = node_index(a->width, v[0], v[1]);
+        if (idx == 0) {
+            delete_array_q(a);
+            return NULL;
+        }
+        add_saturating(&a->counts[idx], v[2]);
+        add_saturating(&a->N, v[2]);
+    }
+    return a;
+}
+
+/* Calls run() on every maximal run of non-zero counts */
+static void for_each_run(const struct QArray *a,
+                         void (*run)(const struct QArray *, size_t, size_t,
+                                     void *),
+                         void *ctx) {
+    size_t i = 1;
+    const size_t end = 2 * a->width;
+    while (i < end) {
+        while (i < end && a->counts[i] == 0) i++;
+        const size_t start = i;
+        while (i < end && a->counts[i] != 0) i++;
+        if (i > start)
+            run(a, start, i - start, ctx);
+    }
+}
+
+static void count_run(const struct QArray *a, size_t start, size_t len,
+                      void *ctx) {
+    (void)a;
+    (void)start;
+    size_t *sizes = ctx;
+    sizes[0]++;
+    sizes[1] += (2 + len) * sizeof(uint64_t);
+}
+
+size_t array_encoded_size(const struct QArray *a) {
+    size_t sizes[2] = {0, sizeof(struct ArrayHeader)};
+    for_each_run(a, count_run, sizes);
+    return sizes[1];
+}
+
+static void write_run(const struct QArray *a, size_t start, size_t len,
+                      void *ctx) {
+    uint8_t **out = ctx;
+    const uint64_t hdr[2] = {start, len};
+    memcpy(*out, hdr, sizeof(hdr));
+    *out += sizeof(hdr);
+    if (sizeof(size_t) == sizeof(uint64_t)) {
+        memcpy(*out, a->counts + start, len * sizeof(uint64_t));
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            const uint64_t c = a->counts[start + i];
+            memcpy(*out + i * sizeof(uint64_t), &c, sizeof(c));
+        }
+    }
+    *out += len * sizeof(uint64_t);
+}
+
+size_t array_encode(const struct QArray *a, void *buf) {
+    size_t sizes[2] = {0, sizeof(struct ArrayHeader)};
+    for_each_run(a, count_run, sizes);
+
+    struct ArrayHeader hdr;
+    memcpy(hdr.magic, ARRAY_MAGIC, sizeof(hdr.magic));
+    hdr.height = (uint32_t)log_2_ceil(a->width);
+    hdr.N = a->N;
+    hdr.K = a->K;
+    hdr.runs = sizes[0];
+    // buf may not be aligned for the header
+    memcpy(buf, &hdr, sizeof(hdr));
+    uint8_t *out = (uint8_t *)buf + sizeof(hdr);
+    for_each_run(a, write_run, &out);
+    return sizes[1];
+}
+
+struct QArray *array_decode(const void *buf, size_t len) {
+    struct ArrayHeader hdr;
+    if (len < sizeof(hdr))
+        return NULL;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (memcmp(hdr.magic, ARRAY_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.height > ARRAY_MAX_HEIGHT || hdr.K == 0)
+        return NULL;
+    struct QArray *a = create_array_q((size_t)hdr.K,
+                                      ((size_t)1 << hdr.height) - 1);
+    const uint8_t *p = (const uint8_t *)buf + sizeof(hdr);
+    const uint8_t *end = (const uint8_t *)buf + len;
+    for (uint64_t r = 0; r < hdr.runs; r++) {
+        uint64_t run[2];
+        if ((size_t)(end - p) < sizeof(run))
+            goto malformed;
+        memcpy(run, p, sizeof(run));
+        p += sizeof(run);
+        if (run[0] == 0 || run[0] >= 2 * a->width ||
+            run[1] > 2 * a->width - run[0] ||
+            (size_t)(end - p) / sizeof(uint64_t) < run[1])
+            goto malformed;
+        for (uint64_t i = 0; i < run[1]; i++) {
+            uint64_t c;
+            memcpy(&c, p + i * sizeof(uint64_t), sizeof(c));
+            a->counts[run[0] + i] = (size_t)c;
+            add_saturating(&a->N, c);
+        }
+        p += run[1] * sizeof(uint64_t);
+    }
+    return a;
+
+malformed:
+    delete_array_q(a);
+    return NULL;
+}
+
+struct FlatCursor {
+    struct QFlatNode *nodes;
+    size_t len;
+};
+
+static void write_flat(const struct QArray *a, size_t i, void *ctx) {
+    struct FlatCursor *c = ctx;
+    struct QFlatNode *n = &c->nodes[c->len++];
+    n->count = n->subtree_count = a->counts[i];
+    node_bounds(a->width, i, &n->lower_bound, &n->upper_bound);
+}
+
+struct QDigest *array_to_digest(const struct QArray *a) {
+    size_t live = 0;
+    for (size_t i = 1; i < 2 * a->width; i++)
+        live += a->counts[i] > 0;
+    struct FlatCursor c = {
+        xmalloc((live > 0 ? live : 1) * sizeof(struct QFlatNode)), 0};
+    preorder_nodes(a, write_flat, &c);
+
+    struct QDigest *q = create_tmp_q(a->K, a->width - 1);
+    // the same nodes, so no compression on the way in
+    const struct CompressPolicy policy = q->policy;
+    q->policy.mode = COMPRESS_MANUAL;
+    merge_flat(q, c.nodes, c.len, a->K);
+    q->policy = policy;
+    free(c.nodes);
+    return q;
+}
+
+/* Adds the counts of the subtree below n */
+static void copy_nodes(struct QArray *a, const struct QDigestNode *n) {
+    if (!n)
+        return;
+    if (n->count > 0)
+        add_saturating(&a->counts[node_index(a->width, n->lower_bound,
+                                             n->upper_bound)],
+                       n->count);
+    copy_nodes(a, n->left);
+    copy_nodes(a, n->right);
+}
+
+struct QArray *array_from_digest(const struct QDigest *q) {
+    const size_t upper = q->root->upper_bound;
+    if (q->root->lower_bound != 0 || ((upper + 1) & upper) != 0)
+        return NULL;
+    struct QArray *a = create_array_q(q->K, upper);
+    if (!a)
+        return NULL;
+    copy_nodes(a, q->root);
+    a->N = q->N;
+    return a;
+}
@@ -0,0 +1,174 @@
+#include "../include/qblock.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Returned by find_block() when a new block would exceed the budget */
+#define NO_BLOCK SIZE_MAX
+
+struct QBlocked *create_blocked(size_t K, size_t upper_bound, unsigned height,
+                                size_t budget) {
+    assert(budget > 0);
+    assert(height < sizeof(size_t) * 8 - 1);
+    const size_t width = (size_t)1 << height;
+    if (upper_bound < width - 1)
+        upper_bound = width - 1;
+    assert(upper_bound + 1 != 0);
+    upper_bound = ((size_t)1 << log_2_ceil(upper_bound + 1)) - 1;
+
+    struct QBlocked *b = xmalloc(sizeof(struct QBlocked));
+    b->q = create_tmp_q(K, upper_bound);
+    b->height = height;
+    b->budget = budget;
+    b->counts = xmalloc(budget * width * sizeof(size_t));
+    memset(b->counts, 0, budget * width * sizeof(size_t));
+    b->index = xmalloc(budget * sizeof(size_t));
+    // at most half full, so that probes stay short
+    b->table_size = (size_t)1 << log_2_ceil(2 * budget);
+    b->slots = xmalloc(b->table_size * sizeof(size_t));
+    memset(b->slots, 0, b->table_size * sizeof(size_t));
+    b->live = 0;
+    b->pending = 0;
+    return b;
+}
+
+void delete_blocked(struct QBlocked *b) {
+    delete_qdigest(b->q);
+    free(b->counts);
+    free(b->index);
+    free(b->slots);
+    free(b);
+}
+
+/* The live block covering values [idx << height, (idx + 1) << height),
+ * created if needed; NO_BLOCK if the budget is used up */
+static size_t find_block(struct QBlocked *b, size_t idx) {
+    const size_t mask = b->table_size - 1;
+    size_t pos = (size_t)(((uint64_t)idx * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+    while (b->slots[pos] != 0) {
+        if (b->index[b->slots[pos] - 1] == idx)
+            return b->slots[pos] - 1;
+        pos = (pos + 1) & mask;
+    }
+    if (b->live == b->budget)
+        return NO_BLOCK;
+    b->index[b->live] = idx;
+    b->slots[pos] = ++b->live;
+    return b->live - 1;
+}
+
+void blocked_insert(struct QBlocked *b, size_t key, unsigned int count) {
+    const size_t idx = key >> b->height;
+    size_t id = find_block(b, idx);
+    if (id == NO_BLOCK) {
+        blocked_flush(b);
+        id = find_block(b, idx);
+    }
+    const size_t leaf = key & (((size_t)1 << b->height) - 1);
+    add_saturating(&b->counts[(id << b->height) + leaf], count);
+    add_saturating(&b->pending, count);
+}
+
+/* A live block and the values it covers, for sorting */
+struct BlockRef {
+    size_t index;
+    size_t id;
+};
+
+static int compare_blocks(const void *a, const void *b) {
+    const size_t x = ((const struct BlockRef *)a)->index;
+    const size_t y = ((const struct BlockRef *)b)->index;
+    return (x > y) - (x < y);
+}
+
+/* Appends the non-empty nodes of a folded block in preorder */
+static size_t emit_block(const size_t *t, unsigned height, size_t base,
+                         struct QFlatNode *out) {
+    size_t stack_i[2 * sizeof(size_t) * 8];
+    unsigned stack_l[2 * sizeof(size_t) * 8];
+    size_t top = 0, len = 0;
+    stack_i[top] = 1;
+    stack_l[top++] = 0;
+    while (top > 0) {
+        const size_t i = stack_i[--top];
+        const unsigned l = stack_l[top];
+        if (t[i] > 0) {
+            const size_t span = (size_t)1 << (height - l);
+            const size_t lower = base + (i - ((size_t)1 << l)) * span;
+            out[len].count = t[i];
+            out[len].subtree_count = t[i];
+            out[len].lower_bound = lower;
+            out[len].upper_bound = lower + span - 1;
+            len++;
+        }
+        if (l < height) {
+            stack_i[top] = 2 * i + 1;
+            stack_l[top++] = l + 1;
+            stack_i[top] = 2 * i;
+            stack_l[top++] = l + 1;
+        }
+    }
+    return len;
+}
+
+void blocked_flush(struct QBlocked *b) {
+    if (b->live == 0)
+        return;
+    const size_t width = (size_t)1 << b->height;
+    size_t total = b->q->N;
+    add_saturating(&total, b->pending);
+    const size_t nDivk = total / b->q->K;
+
+    // blocks by increasing value, so that merge_flat() gets a preorder
+    struct BlockRef *order = xmalloc(b->live * sizeof(struct BlockRef));
+    for (size_t id = 0; id < b->live; id++) {
+        order[id].index = b->index[id];
+        order[id].id = id;
+    }
+    qsort(order, b->live, sizeof(struct BlockRef), compare_blocks);
+
+    size_t *t = xmalloc(2 * width * sizeof(size_t));
+    struct QFlatNode *nodes =
+        xmalloc(b->live * (2 * width - 1) * sizeof(struct QFlatNode));
+    size_t len = 0;
+    for (size_t k = 0; k < b->live; k++) {
+        const size_t id = order[k].id;
+        memset(t, 0, width * sizeof(size_t));
+        memcpy(t + width, b->counts + (id << b->height),
+               width * sizeof(size_t));
+        compress_implicit(t, width, nDivk);
+        len += emit_block(t, b->height, b->index[id] << b->height,
+                          nodes + len);
+    }
+    merge_flat(b->q, nodes, len, b->q->K);
+    // blocks flushed earlier were folded with a smaller N/K; refold the
+    // whole tree with the N it holds now
+    if (b->q->policy.mode != COMPRESS_MANUAL)
+        compress_now(b->q);
+
+    memset(b->counts, 0, b->live * width * sizeof(size_t));
+    memset(b->slots, 0, b->table_size * sizeof(size_t));
+    b->live = 0;
+    b->pending = 0;
+    free(nodes);
+    free(t);
+    free(order);
+}
+
+struct QDigest *blocked_digest(struct QBlocked *b) {
+    blocked_flush(b);
+    return b->q;
+}
+
+size_t blocked_percentile(struct QBlocked *b, double p) {
+    return percentile(blocked_digest(b), p);
+}
+
+size_t blocked_rank(struct QBlocked *b, size_t value) {
+    return rank(blocked_digest(b), value);
+}
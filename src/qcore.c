@@ -4,10 +4,13 @@
 
 #include "../include/qcore.h"
 #include "../include/memory_utils.h"
+#include "../include/node_pool.h"
 #include "../include/queue.h"
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +40,8 @@ struct QDigestNode *create_node(size_t lower_bound, size_t upper_bound) {
     ret->left = ret->right = ret->parent = NULL;
     // make count start from 0
     ret->count = 0;
+    ret->subtree_count = 0;
+    ret->version = 0;
 
     // assign both a lower and upper bound to respective struct members
     ret->lower_bound = lower_bound;
@@ -48,6 +53,30 @@ struct QDigestNode *create_node(size_t lower_bound, size_t upper_bound) {
 /* This function deletes a node and frees the memory that was allocated to it */
 void delete_node(struct QDigestNode *n) { free(n); }
 
+/* Every digest starts with the original behaviour: compress at 6 * K nodes
+ * with a single pass and no hard cap. */
+void init_policy(struct CompressPolicy *p) {
+    p->mode = COMPRESS_AUTO;
+    p->max_nodes = 0;
+    p->target_ratio = 1.0;
+}
+
+static void init_log(struct DeltaLog *log) {
+    log->version = 1;
+    log->trimmed_version = 0;
+    log->tombstones = NULL;
+    log->len = 0;
+    log->capacity = 0;
+}
+
+/* Hands the change history of src over to dst, which is about to
+ * replace it through swap_q() */
+static void move_log(struct QDigest *dst, struct QDigest *src) {
+    free(dst->log.tombstones);
+    dst->log = src->log;
+    init_log(&src->log);
+}
+
 struct QDigest *create_q(struct QDigestNode *root, size_t num_nodes, size_t N,
                          size_t K, size_t num_inserts) {
     struct QDigest *ret = xmalloc(sizeof(struct QDigest));
@@ -56,21 +85,94 @@ struct QDigest *create_q(struct QDigestNode *root, size_t num_nodes, size_t N,
     ret->N = N;
     ret->K = K;
     ret->num_inserts = num_inserts;
+    ret->saturated = false;
+    ret->pool = NULL;
+    init_policy(&ret->policy);
+    init_log(&ret->log);
 
     return ret;
 }
 
 /* Constructor for a special case used inside the expand_tree function */
 struct QDigest *create_tmp_q(size_t K, size_t upper_bound) {
+    return create_pooled_q(K, upper_bound, NULL);
+}
+
+/* Same as create_tmp_q, but every node comes from (and returns to) pool */
+struct QDigest *create_pooled_q(size_t K, size_t upper_bound,
+                                struct NodePool *pool) {
     struct QDigest *tmp = xmalloc(sizeof(struct QDigest));
-    struct QDigestNode *n = create_node(0, upper_bound);
-    tmp->root = n;
-    tmp->num_nodes = 1;
-    tmp->N = 0;
-    tmp->K = K;
+    init_q(tmp, K, upper_bound, pool);
     return tmp;
 }
 
+/* Initializes a digest header that lives in caller-owned memory */
+void init_q(struct QDigest *q, size_t K, size_t upper_bound,
+            struct NodePool *pool) {
+    q->root = pool_alloc(pool, 0, upper_bound);
+    q->num_nodes = 1;
+    q->N = 0;
+    q->K = K;
+    q->num_inserts = 0;
+    q->saturated = false;
+    q->pool = pool;
+    init_policy(&q->policy);
+    init_log(&q->log);
+}
+
+/* Copies the tree below root in preorder, each node with one struct
+ * copy whose links are then pointed at the new nodes. The pending right
+ * children, at most one per level, wait on an explicit stack. */
+static struct QDigestNode *clone_tree(const struct QDigestNode *root,
+                                      struct NodePool *pool) {
+    const struct QDigestNode *pending[sizeof(size_t) * 8 + 1];
+    struct QDigestNode *pending_parent[sizeof(size_t) * 8 + 1];
+    size_t top = 0;
+    const struct QDigestNode *n = root;
+    struct QDigestNode *parent = NULL;
+    struct QDigestNode *ret = NULL;
+    struct QDigestNode **link = &ret;   // where the next copy is hooked
+    for (;;) {
+        struct QDigestNode *c = pool_alloc(pool, n->lower_bound, n->upper_bound);
+        *c = *n;
+        c->parent = parent;
+        c->left = c->right = NULL;
+        *link = c;
+        if (n->right) {
+            pending[top] = n->right;
+            pending_parent[top++] = c;
+        }
+        if (n->left) {
+            n = n->left;
+            parent = c;
+            link = &c->left;
+        } else if (top > 0) {
+            n = pending[--top];
+            parent = pending_parent[top];
+            link = &parent->right;
+        } else {
+            return ret;
+        }
+    }
+}
+
+struct QDigest *clone_qdigest(const struct QDigest *q) {
+    return clone_qdigest_pooled(q, q->pool);
+}
+
+struct QDigest *clone_qdigest_pooled(const struct QDigest *q,
+                                     struct NodePool *pool) {
+    struct QDigest *c = xmalloc(sizeof(struct QDigest));
+    *c = *q;
+    c->root = clone_tree(q->root, pool);
+    c->pool = pool;
+    // the copy has no replica yet: its first delta is a full one
+    init_log(&c->log);
+    c->log.version = q->log.version;
+    c->log.trimmed_version = q->log.version;
+    return c;
+}
+
 /* Frees memory that was allocated to the QDigest tree */
 void free_tree(struct QDigestNode *n) {
     // if NULL pointer no need to free memory
@@ -86,7 +188,8 @@ void free_tree(struct QDigestNode *n) {
 /* Deletes the entire QDigest by starting from the root
  * node and freeing recursively the left and right subtree */
 void delete_qdigest(struct QDigest *q) {
-    free_tree(q->root);
+    pool_free_tree(q->pool, q->root);
+    free(q->log.tombstones);
     free(q);
 }
 
@@ -104,6 +207,37 @@ size_t node_and_sibling_count(struct QDigestNode *n) {
     return ret;
 }
 
+/* Remembers that the range of n is going away, if any replica may
+ * still hold it */
+static void log_tombstone(struct QDigest *q, const struct QDigestNode *n) {
+    struct DeltaLog *log = &q->log;
+    // no delta has been taken yet, so every receiver starts from scratch
+    if (log->version == 1)
+        return;
+    size_t limit = q->num_nodes > DELTA_MIN_TOMBSTONES ? q->num_nodes
+                                                       : DELTA_MIN_TOMBSTONES;
+    if (log->len >= limit) {
+        // a full delta is now cheaper than the history
+        log->len = 0;
+        log->trimmed_version = log->version;
+        return;
+    }
+    if (log->len == log->capacity) {
+        log->capacity = log->capacity ? 2 * log->capacity : DELTA_MIN_TOMBSTONES;
+        struct Tombstone *grown = realloc(log->tombstones,
+                                          log->capacity * sizeof(struct Tombstone));
+        if (!grown) {
+            fprintf(stderr, "OOM error while calling realloc\n");
+            exit(EXIT_FAILURE);
+        }
+        log->tombstones = grown;
+    }
+    struct Tombstone *t = &log->tombstones[log->len++];
+    t->lower_bound = n->lower_bound;
+    t->upper_bound = n->upper_bound;
+    t->version = log->version;
+}
+
 /* Determines which tree nodes can be deleted.
  * A tree node which has a count of 0 can be deleted only if it has no children.
  *
@@ -112,6 +246,7 @@ size_t node_and_sibling_count(struct QDigestNode *n) {
  * */
 bool delete_node_if_needed(struct QDigest *q, struct QDigestNode *n, int level, int l_max) {
     if (n->count == 0 && (!n->left && !n->right)) {
+        log_tombstone(q, n);
         if (n->parent) {
             if (n->parent->left == n) {
                 n->parent->left = NULL;
@@ -120,7 +255,7 @@ bool delete_node_if_needed(struct QDigest *q, struct QDigestNode *n, int level,
             }
         }
 
-        delete_node(n);
+        pool_free(q->pool, n);
         (q->num_nodes)--;
         return true;
     }
@@ -139,13 +274,20 @@ void compress(struct QDigest *q, struct QDigestNode *n, int level, int l_max, si
         if (!deleted && node_and_sibling_count(n->parent) < nDivk) {
             struct QDigestNode *par = n->parent;
             par->count = node_and_sibling_count(par);
+            par->version = q->log.version;
 
+            // the counts move up into par, so par's subtree total is
+            // unchanged while each child's own total shrinks
             if (par->left) {
+                par->left->subtree_count -= par->left->count;
                 par->left->count = 0;
+                par->left->version = q->log.version;
                 delete_node_if_needed(q, par->left, level, l_max);
             }
             if (par->right) {
+                par->right->subtree_count -= par->right->count;
                 par->right->count = 0;
+                par->right->version = q->log.version;
                 delete_node_if_needed(q, par->right, level, l_max);
             }
 
@@ -178,35 +320,170 @@ void swap_q(struct QDigest *a, struct QDigest *b) {
     size_t tmp_inserts = a->num_inserts;
     a->num_inserts = b->num_inserts;
     b->num_inserts = tmp_inserts;
+
+    bool tmp_saturated = a->saturated;
+    a->saturated = b->saturated;
+    b->saturated = tmp_saturated;
+
+    struct NodePool *tmp_pool = a->pool;
+    a->pool = b->pool;
+    b->pool = tmp_pool;
+
+    struct CompressPolicy tmp_policy = a->policy;
+    a->policy = b->policy;
+    b->policy = tmp_policy;
+
+    struct DeltaLog tmp_log = a->log;
+    a->log = b->log;
+    b->log = tmp_log;
 }
 
-void compress_if_needed(struct QDigest *q) {
-    if (q->num_nodes >= (q->K * 6)) {
-        const size_t nDivk = (q->N / q->K);
-        const int l_max = log_2_ceil(q->root->upper_bound + 1);
+void set_compress_policy(struct QDigest *q, enum CompressMode mode,
+                         size_t max_nodes, double target_ratio) {
+    if (!(target_ratio > 0.0) || target_ratio > 1.0)
+        target_ratio = 1.0;
+    q->policy.mode = mode;
+    q->policy.max_nodes = max_nodes;
+    q->policy.target_ratio = target_ratio;
+}
+
+void set_memory_budget(struct QDigest *q, size_t max_bytes,
+                       double target_ratio) {
+    size_t max_nodes = max_bytes / sizeof(struct QDigestNode);
+    // the root alone always has to fit
+    if (max_nodes == 0)
+        max_nodes = 1;
+    set_compress_policy(q, COMPRESS_BUDGET, max_nodes, target_ratio);
+}
+
+void compress_now(struct QDigest *q) {
+    const int l_max = log_2_ceil(q->root->upper_bound + 1);
+    size_t nDivk = (q->N / q->K);
+    compress(q, q->root, 0, l_max, nDivk);
+
+    if (q->policy.max_nodes == 0)
+        return;
+
+    size_t target = (size_t)(q->policy.target_ratio * q->policy.max_nodes);
+    if (target == 0)
+        target = 1;
+
+    // Keep doubling the threshold until the tree fits the budget. Once
+    // nDivk exceeds N a single pass folds everything into the root, so
+    // the loop always terminates.
+    if (nDivk == 0)
+        nDivk = 1;
+    while (q->num_nodes > target && nDivk <= q->N) {
+        nDivk *= 2;
         compress(q, q->root, 0, l_max, nDivk);
     }
 }
 
+void compress_implicit(size_t *t, size_t width, size_t nDivk) {
+    for (size_t l = width / 2; l >= 1; l /= 2) {
+        #pragma omp simd
+        for (size_t i = l; i < 2 * l; i++) {
+            // saturating: a wrapped sum would pass for a small one
+            const size_t c = t[2 * i] + t[2 * i + 1];
+            const size_t c_sat = c < t[2 * i] ? SIZE_MAX : c;
+            const size_t sum = c_sat + t[i];
+            const size_t s = sum < c_sat ? SIZE_MAX : sum;
+            // all ones when the children fold into t[i]
+            const size_t fold = (size_t)0 - (size_t)(s < nDivk);
+            t[i] = (s & fold) | (t[i] & ~fold);
+            t[2 * i] &= ~fold;
+            t[2 * i + 1] &= ~fold;
+        }
+    }
+}
+
+void compress_if_needed(struct QDigest *q) {
+    size_t threshold;
+    switch (q->policy.mode) {
+    case COMPRESS_MANUAL:
+        return;
+    case COMPRESS_BUDGET:
+        // no budget: only compress_now() and serialization compress
+        if (q->policy.max_nodes == 0)
+            return;
+        threshold = q->policy.max_nodes;
+        break;
+    case COMPRESS_AUTO:
+    default:
+        threshold = q->K * 6;
+        break;
+    }
+    if (q->num_nodes >= threshold) {
+        compress_now(q);
+    }
+}
+
 void expand_tree(struct QDigest *q, size_t upper_bound);
 
-/* Bump up the count for key by count.
+/* Adds w to *dst without wrapping around. If the sum does not fit in
+ * a size_t the destination is clamped to SIZE_MAX and false is returned. */
+bool add_saturating(size_t *dst, uint64_t w) {
+    if (w > (uint64_t)(SIZE_MAX - *dst)) {
+        *dst = SIZE_MAX;
+        return false;
+    }
+    *dst += (size_t)w;
+    return true;
+}
+
+/* Computes floor(a * num / den) for num <= den without any intermediate
+ * overflow. The product is built bit by bit (Horner's scheme on num)
+ * while being kept as a quotient/remainder pair with respect to den. */
+size_t mul_div_floor(size_t a, uint64_t num, uint64_t den) {
+    assert(den > 0 && num <= den);
+    const uint64_t a_quot = a / den;
+    const uint64_t a_rem = a % den;
+    uint64_t quot = 0, rem = 0;
+    for (int bit = 63; bit >= 0; bit--) {
+        // (quot, rem) *= 2
+        quot <<= 1;
+        if (rem >= den - rem) {
+            rem -= den - rem;
+            quot++;
+        } else {
+            rem += rem;
+        }
+        // (quot, rem) += a
+        if ((num >> bit) & 1) {
+            quot += a_quot;
+            if (rem >= den - a_rem) {
+                rem -= den - a_rem;
+                quot++;
+            } else {
+                rem += a_rem;
+            }
+        }
+    }
+    return (size_t)quot;
+}
+
+/* Adds w to the subtree count of n and of all its ancestors */
+void add_to_path(struct QDigestNode *n, uint64_t w) {
+    for (; n; n = n->parent)
+        add_saturating(&n->subtree_count, w);
+}
+
+/* Bump up the count for key by weight.
  *
  * If try_compact is true then attempt compaction if
  * applicable. Don't compact when we want to build a tree
  * which has a specific shape since it is assumed that certain
  * nodes will be present at specific positions (for example when called by
  * expand_tree()).
+ *
+ * Returns false if either the leaf count or N had to be clamped.
  * */
-void insert(struct QDigest *q, size_t key, unsigned int count,
-            bool try_compress) {
+bool insert_weighted(struct QDigest *q, size_t key, uint64_t weight,
+                     bool try_compress) {
     if (key > q->root->upper_bound) {
-        size_t new_upper_bound_plus_one = 1 << log_2_ceil(key);
-        if (q->root->upper_bound + 1 == new_upper_bound_plus_one) {
-            new_upper_bound_plus_one *= 2;
-        }
-        // printf("DEBUG: before expand tree\n");
-        expand_tree(q, new_upper_bound_plus_one);
+        // grow to the smallest power of two universe that contains key
+        assert(key + 1 != 0);
+        expand_tree(q, (size_t)1 << log_2_ceil(key + 1));
     }
     size_t lower_bound = 0;
     size_t upper_bound = q->root->upper_bound;
@@ -220,7 +497,7 @@ void insert(struct QDigest *q, size_t key, unsigned int count,
         if (key <= mid) {
             // go left
             if (!curr->left) {
-                struct QDigestNode *new_node = create_node(lower_bound, mid);
+                struct QDigestNode *new_node = pool_alloc(q->pool, lower_bound, mid);
                 prev->left = new_node;
                 prev->left->parent = prev;
                 (q->num_nodes)++;
@@ -231,7 +508,7 @@ void insert(struct QDigest *q, size_t key, unsigned int count,
             // go right
             assert(mid + 1 <= upper_bound);
             if (!curr->right) {
-                struct QDigestNode *new_node = create_node(mid + 1, upper_bound);
+                struct QDigestNode *new_node = pool_alloc(q->pool, mid + 1, upper_bound);
                 prev->right = new_node;
                 prev->right->parent = prev;
                 (q->num_nodes)++;
@@ -240,39 +517,57 @@ void insert(struct QDigest *q, size_t key, unsigned int count,
             lower_bound = mid + 1;
         }
     } // while()
-    curr->count += count;
-    q->N += count;
+    bool ok = add_saturating(&curr->count, weight);
+    curr->version = q->log.version;
+    ok = add_saturating(&q->N, weight) && ok;
+    add_to_path(curr, weight);
+    if (!ok)
+        q->saturated = true;
     if (try_compress) {
         compress_if_needed(q);
     }
+    return ok;
 }
 
-/*
- * Insert the equivalent of the values present in node n into
- * the current tree. This will either create new nodes along the
- * way and then create the final node or will update the count in
- * the destination node if that node is already present in the
- * tree. No compression is attempted after the new node is inserted
- * since this function is assumed to be called by the
- * deserialization routine.
- * */
-void insert_node(struct QDigest *q, const struct QDigestNode *n) {
-    struct QDigestNode *r = q->root;
-    assert(n->lower_bound >= r->lower_bound);
-    assert(n->upper_bound <= r->upper_bound);
+void insert(struct QDigest *q, size_t key, unsigned int count,
+            bool try_compress) {
+    insert_weighted(q, key, count, try_compress);
+}
 
-    struct QDigestNode *prev = q->root;
+/* Ingest a pre-aggregated histogram: n (key, weight) pairs are added
+ * without compressing in between, and the policy is consulted once at
+ * the end. */
+bool insert_histogram(struct QDigest *q, const size_t *keys,
+                      const uint64_t *weights, size_t n) {
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        if (weights[i] == 0)
+            continue;
+        ok = insert_weighted(q, keys[i], weights[i], false) && ok;
+    }
+    compress_if_needed(q);
+    return ok;
+}
+
+/* Walks down from `from` to the node covering exactly [lower, upper],
+ * creating the missing nodes on the way */
+static struct QDigestNode *locate_below(struct QDigest *q,
+                                        struct QDigestNode *from,
+                                        size_t lower, size_t upper) {
+    assert(lower >= from->lower_bound);
+    assert(upper <= from->upper_bound);
+
+    struct QDigestNode *prev = from;
     struct QDigestNode *curr = prev;
 
-    while (curr->lower_bound != n->lower_bound ||
-        n->upper_bound != curr->upper_bound) {
+    while (curr->lower_bound != lower || upper != curr->upper_bound) {
         size_t mid =
             curr->lower_bound + (curr->upper_bound - curr->lower_bound) / 2;
         prev = curr;
-        if (n->upper_bound <= mid) {
+        if (upper <= mid) {
             // go left
             if (!prev->left) {
-                struct QDigestNode *new_node = create_node(curr->lower_bound, mid);
+                struct QDigestNode *new_node = pool_alloc(q->pool, curr->lower_bound, mid);
                 prev->left = new_node;
                 prev->left->parent = prev;
                 (q->num_nodes)++;
@@ -282,7 +577,7 @@ void insert_node(struct QDigest *q, const struct QDigestNode *n) {
             // go right
             assert(mid + 1 <= curr->upper_bound);
             if (!prev->right) {
-                struct QDigestNode *new_node = create_node(mid + 1, curr->upper_bound);
+                struct QDigestNode *new_node = pool_alloc(q->pool, mid + 1, curr->upper_bound);
                 prev->right = new_node;
                 prev->right->parent = prev;
                 (q->num_nodes)++;
@@ -290,11 +585,54 @@ void insert_node(struct QDigest *q, const struct QDigestNode *n) {
             curr = prev->right;
         }
     } // while()
-    assert(curr->lower_bound == n->lower_bound);
+    assert(curr->lower_bound == lower);
+    return curr;
+}
+
+static struct QDigestNode *locate_node(struct QDigest *q, size_t lower,
+                                       size_t upper) {
+    return locate_below(q, q->root, lower, upper);
+}
+
+/* locate_node() starting from a node close to the target: climbs from
+ * finger to the closest ancestor covering [lower, upper] and descends
+ * from there. Visiting nodes in preorder costs O(1) amortized each. */
+static struct QDigestNode *locate_near(struct QDigest *q,
+                                       struct QDigestNode *finger,
+                                       size_t lower, size_t upper) {
+    while (finger->parent &&
+           (lower < finger->lower_bound || upper > finger->upper_bound))
+        finger = finger->parent;
+    return locate_below(q, finger, lower, upper);
+}
+
+/* insert_node() returning the node that received the count */
+static struct QDigestNode *add_node(struct QDigest *q,
+                                    const struct QDigestNode *n) {
+    struct QDigestNode *curr = locate_node(q, n->lower_bound, n->upper_bound);
 
     // curr should get the contents of n
-    curr->count += n->count;
-    q->N += n->count;
+    bool ok = add_saturating(&curr->count, n->count);
+    ok = add_saturating(&q->N, n->count) && ok;
+    add_to_path(curr, n->count);
+    if (n->count > 0)
+        curr->version = q->log.version;
+    if (!ok)
+        q->saturated = true;
+    return curr;
+}
+
+/*
+ * Insert the equivalent of the values present in node n into
+ * the current tree. This will either create new nodes along the
+ * way and then create the final node or will update the count in
+ * the destination node if that node is already present in the
+ * tree. No compression is attempted after the new node is inserted
+ * since this function is assumed to be called by the
+ * deserialization routine.
+ * */
+void insert_node(struct QDigest *q, const struct QDigestNode *n) {
+    add_node(q, n);
 }
 
 void expand_tree(struct QDigest *q, size_t upper_bound) {
@@ -304,7 +642,10 @@ void expand_tree(struct QDigest *q, size_t upper_bound) {
 
     upper_bound--;
 
-    struct QDigest *tmp = create_tmp_q(q->K, upper_bound);
+    struct QDigest *tmp = create_pooled_q(q->K, upper_bound, q->pool);
+    tmp->policy = q->policy;
+    // the grafted nodes keep their versions, the new ancestors are empty
+    move_log(tmp, q);
 
     if (q->N == 0) {
         struct QDigest *old = tmp;
@@ -327,12 +668,18 @@ void expand_tree(struct QDigest *q, size_t upper_bound) {
         n = n->left;
     }
     struct QDigestNode *par = n->parent;
+    struct QDigestNode *stale = n;
     int to_remove = 0;
     while (n) {
         n = n->right;
         ++to_remove;
     }
+    // the placeholder chain is replaced by the original tree
+    pool_free_tree(q->pool, stale);
     par->left = q->root;
+    // the new ancestors only hold what lies below the grafted root
+    for (struct QDigestNode *a = par; a; a = a->parent)
+        a->subtree_count = q->root->subtree_count;
 
     // this is a workaround to emulate what .release() does in C++ for smart
     // pointers
@@ -342,6 +689,7 @@ void expand_tree(struct QDigest *q, size_t upper_bound) {
     tmp->num_nodes -= to_remove;
     tmp->num_nodes += q->num_nodes;
     tmp->N = q->N;
+    tmp->saturated = q->saturated;
 
     struct QDigest *old = tmp;
     swap_q(q, tmp);
@@ -378,11 +726,91 @@ size_t postorder_by_rank(struct QDigestNode *n, size_t *curr_rank,
  * */
 size_t percentile(struct QDigest *q, double p) {
     // p is in the range [0,1]
+    if (p <= 0.0) p = 0.0;
+    if (p >= 1.0) p = 1.0;
+    // Below 2^53 the double product is exact enough. Above it p is turned
+    // into a 53-bit binary fraction so the rank is computed in integers.
+    if (q->N <= ((size_t)1 << 53)) {
+        size_t curr_rank = 0;
+        const size_t req_rank = p * q->N;
+        return postorder_by_rank(q->root, &curr_rank, req_rank);
+    }
+    const uint64_t den = (uint64_t)1 << 53;
+    return percentile_exact(q, (uint64_t)(p * den), den);
+}
+
+size_t percentile_exact(struct QDigest *q, uint64_t num, uint64_t den) {
+    if (num > den)
+        num = den;
     size_t curr_rank = 0;
-    const size_t req_rank = p * q->N;
+    const size_t req_rank = mul_div_floor(q->N, num, den);
     return postorder_by_rank(q->root, &curr_rank, req_rank);
 }
 
+/*
+ * Descend towards value and add up every subtree lying entirely at or
+ * below it. A node is counted at its upper bound, as in percentile(),
+ * so this is the inverse of the percentile query.
+ * */
+size_t rank(struct QDigest *q, size_t value) {
+    size_t r = 0;
+    struct QDigestNode *n = q->root;
+    while (n) {
+        if (n->upper_bound <= value) {
+            r += n->subtree_count;
+            break;
+        }
+        if (value < n->lower_bound)
+            break;
+        // n itself ends above value, only part of its subtree qualifies
+        size_t mid = n->lower_bound + (n->upper_bound - n->lower_bound) / 2;
+        if (value <= mid) {
+            n = n->left;
+        } else {
+            if (n->left)
+                r += n->left->subtree_count;
+            n = n->right;
+        }
+    }
+    return r;
+}
+
+size_t range_count(struct QDigest *q, size_t lo, size_t hi) {
+    if (lo > hi)
+        return 0;
+    size_t below = (lo == 0) ? 0 : rank(q, lo - 1);
+    return rank(q, hi) - below;
+}
+
+/* Nodes taken off the traversal queue at a time */
+#define MERGE_BATCH 64
+
+/* Inserts every node below root into q in BFS order. The nodes of the
+ * digest being merged into keep their versions, the others are stamped
+ * as changes when they carry a count. The queue holds plain node
+ * pointers in a ring buffer that is reused across calls, so the
+ * traversal itself allocates nothing per node. */
+static void merge_tree(struct QDigest *q, struct queue *qu,
+                       struct QDigestNode *root, bool keep_versions) {
+    Item batch[MERGE_BATCH];
+    push(qu, root);
+    while (!is_empty(qu)) {
+        const size_t len = pop_n(qu, batch, MERGE_BATCH);
+        for (size_t i = 0; i < len; i++) {
+            struct QDigestNode *n = batch[i];
+            if (n->left) {
+                push(qu, n->left);
+            }
+            if (n->right) {
+                push(qu, n->right);
+            }
+            struct QDigestNode *curr = add_node(q, n);
+            if (keep_versions)
+                curr->version = n->version;
+        }
+    }
+}
+
 /*
  * Merge two qdigests with q2 being the one that is merged into q1.
  * Therefore, q2 is declared constant since it should not be modified
@@ -394,21 +822,13 @@ void merge(struct QDigest *q1, const struct QDigest *q2) {
         ? q1->root->upper_bound
         : q2->root->upper_bound;
 
-    struct QDigest *tmp = create_tmp_q(max_k, max_upper_bound);
+    struct QDigest *tmp = create_pooled_q(max_k, max_upper_bound, q1->pool);
+    tmp->policy = q1->policy;
+    tmp->saturated = q1->saturated || q2->saturated;
+    move_log(tmp, q1);
     struct queue *qu = create_queue();
-    push(qu, create_queue_node(q1->root));
-    push(qu, create_queue_node(q2->root));
-    while (!is_empty(qu)) {
-        struct QDigestNode *n = front(qu);
-        pop(qu);
-        if (n->left) {
-            push(qu, create_queue_node(n->left));
-        }
-        if (n->right) {
-            push(qu, create_queue_node(n->right));
-        }
-        insert_node(tmp, n);
-    }
+    merge_tree(tmp, qu, q1->root, true);
+    merge_tree(tmp, qu, q2->root, false);
     compress_if_needed(tmp);
     struct QDigest *old = tmp;
     swap_q(q1, tmp);
@@ -416,6 +836,300 @@ void merge(struct QDigest *q1, const struct QDigest *q2) {
     delete_queue(qu);
 }
 
+/* Recomputes the subtree counts below n, returns the one of n */
+static size_t sum_subtrees(struct QDigestNode *n) {
+    if (!n)
+        return 0;
+    n->subtree_count = n->count;
+    add_saturating(&n->subtree_count, sum_subtrees(n->left));
+    add_saturating(&n->subtree_count, sum_subtrees(n->right));
+    return n->subtree_count;
+}
+
+/* Hands a subtree of another digest over to q, stamping its counts as
+ * changes of q */
+static void adopt_subtree(struct QDigest *q, struct QDigestNode *n) {
+    if (!n)
+        return;
+    if (n->count > 0)
+        n->version = q->log.version;
+    (q->num_nodes)++;
+    adopt_subtree(q, n->left);
+    adopt_subtree(q, n->right);
+}
+
+/* Copy of a subtree of another digest, allocated from q's pool */
+static struct QDigestNode *copy_subtree(struct QDigest *q,
+                                        const struct QDigestNode *n,
+                                        struct QDigestNode *parent) {
+    if (!n)
+        return NULL;
+    struct QDigestNode *c = pool_alloc(q->pool, n->lower_bound, n->upper_bound);
+    c->count = n->count;
+    c->subtree_count = n->subtree_count;
+    if (n->count > 0)
+        c->version = q->log.version;
+    c->parent = parent;
+    (q->num_nodes)++;
+    c->left = copy_subtree(q, n->left, c);
+    c->right = copy_subtree(q, n->right, c);
+    return c;
+}
+
+/* Adds the subtree of b to a, which covers the same range. Children
+ * missing on a's side are taken over whole, so only the nodes both
+ * trees have are visited; with steal, the nodes of b are moved or
+ * released to b_pool rather than copied. */
+static void graft_nodes(struct QDigest *q, struct QDigestNode *a,
+                        struct QDigestNode *b, bool steal,
+                        struct NodePool *b_pool) {
+    if (!add_saturating(&a->count, b->count))
+        q->saturated = true;
+    if (b->count > 0)
+        a->version = q->log.version;
+
+    struct QDigestNode **a_child[2] = {&a->left, &a->right};
+    struct QDigestNode *b_child[2] = {b->left, b->right};
+    a->subtree_count = a->count;
+    for (int i = 0; i < 2; i++) {
+        if (!b_child[i]) {
+            // nothing to add
+        } else if (!*a_child[i]) {
+            if (steal) {
+                adopt_subtree(q, b_child[i]);
+                *a_child[i] = b_child[i];
+                b_child[i]->parent = a;
+            } else {
+                *a_child[i] = copy_subtree(q, b_child[i], a);
+            }
+        } else {
+            graft_nodes(q, *a_child[i], b_child[i], steal, b_pool);
+        }
+        if (*a_child[i])
+            add_saturating(&a->subtree_count, (*a_child[i])->subtree_count);
+    }
+    if (steal)
+        pool_free(b_pool, b);
+}
+
+void merge_graft(struct QDigest *q1, struct QDigest *q2) {
+    assert(q1 != q2);
+    if (q2->K > q1->K)
+        q1->K = q2->K;
+    if (q2->root->upper_bound > q1->root->upper_bound)
+        expand_tree(q1, (size_t)1 << log_2_ceil(q2->root->upper_bound + 1));
+
+    const size_t lower = q2->root->lower_bound;
+    const size_t upper = q2->root->upper_bound;
+    struct QDigestNode *target = locate_node(q1, lower, upper);
+    const size_t before = target->subtree_count;
+    const bool steal = q1->pool == q2->pool;
+    graft_nodes(q1, target, q2->root, steal, q2->pool);
+    add_to_path(target->parent, target->subtree_count - before);
+    if (!add_saturating(&q1->N, q2->N) || q2->saturated)
+        q1->saturated = true;
+
+    // q2 is left empty, and its replicas need a full delta
+    if (!steal)
+        pool_free_tree(q2->pool, q2->root);
+    q2->root = pool_alloc(q2->pool, lower, upper);
+    q2->num_nodes = 1;
+    q2->N = 0;
+    q2->saturated = false;
+    q2->log.len = 0;
+    q2->log.version++;
+    q2->log.trimmed_version = q2->log.version;
+
+    compress_if_needed(q1);
+}
+
+/* The node of q with the given range or, if it is missing, its deepest
+ * existing ancestor; NULL if the range lies outside the root */
+static struct QDigestNode *find_covering(struct QDigest *q, size_t lower,
+                                         size_t upper) {
+    struct QDigestNode *n = q->root;
+    if (lower < n->lower_bound || upper > n->upper_bound)
+        return NULL;
+    for (;;) {
+        if (n->lower_bound == lower && n->upper_bound == upper)
+            return n;
+        size_t mid = n->lower_bound + (n->upper_bound - n->lower_bound) / 2;
+        struct QDigestNode *child = NULL;
+        if (upper <= mid)
+            child = n->left;
+        else if (lower > mid)
+            child = n->right;
+        if (!child)
+            return n;
+        n = child;
+    }
+}
+
+/* Takes w from the count of n and then of its ancestors, and returns
+ * what could not be found */
+static uint64_t take_count(struct QDigest *q, struct QDigestNode *n,
+                           uint64_t w) {
+    for (; n && w > 0; n = n->parent) {
+        const size_t take = n->count < w ? n->count : (size_t)w;
+        if (take == 0)
+            continue;
+        n->count -= take;
+        n->version = q->log.version;
+        for (struct QDigestNode *a = n; a; a = a->parent)
+            a->subtree_count -= take;
+        q->N -= take;
+        w -= take;
+    }
+    return w;
+}
+
+/* Removes the counts below n, deepest first, and releases the nodes of
+ * q1 they leave empty; returns false if some count was missing */
+static bool subtract_subtree(struct QDigest *q1, const struct QDigestNode *n) {
+    if (!n)
+        return true;
+    bool found = subtract_subtree(q1, n->left);
+    found = subtract_subtree(q1, n->right) && found;
+    if (n->count == 0)
+        return found;
+    struct QDigestNode *at = find_covering(q1, n->lower_bound, n->upper_bound);
+    if (!at)
+        return false;
+    found = take_count(q1, at, n->count) == 0 && found;
+    while (at->parent) {
+        struct QDigestNode *par = at->parent;
+        if (!delete_node_if_needed(q1, at, 0, 0))
+            break;
+        at = par;
+    }
+    return found;
+}
+
+bool subtract(struct QDigest *q1, const struct QDigest *q2) {
+    return subtract_subtree(q1, q2->root);
+}
+
+void merge_flat(struct QDigest *q, const struct QFlatNode *nodes, size_t len,
+                size_t K) {
+    if (K > q->K)
+        q->K = K;
+    size_t max_upper_bound = q->root->upper_bound;
+    for (size_t i = 0; i < len; i++)
+        if (nodes[i].count > 0 && nodes[i].upper_bound > max_upper_bound)
+            max_upper_bound = nodes[i].upper_bound;
+    if (max_upper_bound > q->root->upper_bound)
+        expand_tree(q, (size_t)1 << log_2_ceil(max_upper_bound + 1));
+
+    // rebuild the sender's tree on its own, then graft it: the subtrees
+    // q does not have yet are moved over instead of merged node by node
+    struct QDigest *tmp =
+        create_pooled_q(q->K, q->root->upper_bound, q->pool);
+    tmp->root->lower_bound = q->root->lower_bound;
+    struct QDigestNode *finger = tmp->root;
+    for (size_t i = 0; i < len; i++) {
+        if (nodes[i].count == 0)
+            continue;
+        finger = locate_near(tmp, finger, nodes[i].lower_bound,
+                             nodes[i].upper_bound);
+        if (!add_saturating(&finger->count, nodes[i].count) ||
+            !add_saturating(&tmp->N, nodes[i].count))
+            tmp->saturated = true;
+    }
+    // subtree counts are settled once rather than along every path
+    sum_subtrees(tmp->root);
+    merge_graft(q, tmp);
+    delete_qdigest(tmp);
+}
+
+/* ================= EXPORT FUNCTIONS =======================*/
+
+/* The rank at which CDF point j is due: ceil(N * (j + 1) / max_buckets) */
+static size_t cdf_threshold(const struct CdfCursor *c) {
+    return c->N - mul_div_floor(c->N, c->max_buckets - 1 - c->next,
+                                c->max_buckets);
+}
+
+static void cdf_emit(struct CdfCursor *c, size_t upper_bound) {
+    // a parent always follows its right subtree and shares its upper
+    // bound, so consecutive points with the same bound are folded
+    if (c->len > 0 && c->bounds[c->len - 1] == upper_bound) {
+        c->cum_counts[c->len - 1] = c->cum;
+        return;
+    }
+    c->bounds[c->len] = upper_bound;
+    c->cum_counts[c->len] = c->cum;
+    c->len++;
+}
+
+void cdf_init(struct CdfCursor *c, size_t *bounds, size_t *cum_counts,
+              size_t max_buckets, size_t N, size_t num_nodes) {
+    c->bounds = bounds;
+    c->cum_counts = cum_counts;
+    c->max_buckets = max_buckets;
+    c->len = 0;
+    c->cum = 0;
+    c->N = N;
+    c->next = 0;
+    c->every_node = num_nodes <= max_buckets;
+}
+
+void cdf_visit(struct CdfCursor *c, size_t upper_bound, size_t count) {
+    if (count == 0)
+        return;
+    c->cum += count;
+    if (c->every_node) {
+        cdf_emit(c, upper_bound);
+        return;
+    }
+    if (c->next < c->max_buckets && c->cum >= cdf_threshold(c)) {
+        cdf_emit(c, upper_bound);
+        while (c->next < c->max_buckets && cdf_threshold(c) <= c->cum)
+            c->next++;
+    }
+}
+
+/* Same visiting order as postorder_by_rank(), but the whole tree is
+ * walked once and every threshold is served on the way. */
+static void postorder_cdf(struct QDigestNode *n, struct CdfCursor *c) {
+    if (!n)
+        return;
+    postorder_cdf(n->left, c);
+    postorder_cdf(n->right, c);
+    cdf_visit(c, n->upper_bound, n->count);
+}
+
+size_t export_cdf(struct QDigest *q, size_t *bounds, size_t *cum_counts,
+                  size_t max_buckets) {
+    if (max_buckets == 0 || q->N == 0)
+        return 0;
+    struct CdfCursor c;
+    cdf_init(&c, bounds, cum_counts, max_buckets, q->N, q->num_nodes);
+    postorder_cdf(q->root, &c);
+    return c.len;
+}
+
+/* Nodes are visited by non-decreasing upper bound, so the current
+ * bucket index only ever moves forward. */
+void postorder_histogram(struct QDigestNode *n, const size_t *edges, size_t n_edges,
+                         size_t *out, size_t *bucket) {
+    if (!n)
+        return;
+    postorder_histogram(n->left, edges, n_edges, out, bucket);
+    postorder_histogram(n->right, edges, n_edges, out, bucket);
+    if (n->count == 0)
+        return;
+    while (*bucket < n_edges && n->upper_bound > edges[*bucket])
+        (*bucket)++;
+    add_saturating(&out[*bucket], n->count);
+}
+
+void export_histogram(struct QDigest *q, const size_t *edges, size_t n,
+                      size_t *out) {
+    memset(out, 0, (n + 1) * sizeof(size_t));
+    size_t bucket = 0;
+    postorder_histogram(q->root, edges, n, out, &bucket);
+}
+
 /* ================= SERIALIZATION FUNCTIONS =======================*/
 
 /* Functions in this section utilize a buffer (buf) to communicate */
@@ -450,6 +1164,9 @@ char *preorder_to_string(struct QDigestNode *n, char *buf, size_t *length) {
 void to_string(struct QDigest *q, char *buf, size_t *length) {
     int k;
     *length = 0;
+    // deferred compression is settled before the digest leaves the process
+    if (q->policy.mode == COMPRESS_MANUAL)
+        compress_now(q);
     struct QDigestNode *root = q->root;
     k = sprintf(buf, "%zu %zu %zu %zu\n",
                    q->N,
@@ -462,6 +1179,20 @@ void to_string(struct QDigest *q, char *buf, size_t *length) {
     buf = preorder_to_string(root, buf, length);
 }
 
+bool parse_node_line(const char **p, const char *end, size_t v[3]) {
+    const char *s = *p;
+    for (int i = 0; i < 3; i++) {
+        char *next;
+        while (s < end && (*s == ' ' || *s == '\n')) s++;
+        if (s == end || *s < '0' || *s > '9')
+            return false;
+        v[i] = (size_t)strtoull(s, &next, 10);
+        s = next;
+    }
+    *p = s;
+    return true;
+}
+
 /* Deserialize the tree from the serialized version in the string
  * 'buf'. The serialized version is obtained by calling 
  * to_string() */
@@ -480,26 +1211,481 @@ struct QDigest *from_string(char *buf) {
 
     /* Initialize new QDigest struct by inheriting from the serialized version */
     struct QDigest *q = create_tmp_q(_K, _upper_bound);
-    struct QDigestNode *root = create_node(_lower_bound, _upper_bound);
-    q->root = root;
-
-    while (true) {
-        size_t lower_bound, upper_bound, count;
-        int consumed = 0;
-        int n = sscanf(buf, "%zu %zu %zu%n",
-                       &lower_bound, &upper_bound, &count, &consumed);
-        if (n != 3) {
-            break;   // no more nodes
+    q->root->lower_bound = _lower_bound;
+
+    /* sscanf() would rescan the rest of the string on every line */
+    const char *p = buf;
+    const char *end = buf + strlen(buf);
+    size_t v[3];
+    while (parse_node_line(&p, end, v) &&
+           v[0] <= v[1] && v[0] >= _lower_bound && v[1] <= _upper_bound) {
+        // insert_node() only reads the range and the count
+        struct QDigestNode node = {0};
+        node.lower_bound = v[0];
+        node.upper_bound = v[1];
+        node.count = v[2];
+        insert_node(q, &node);
+    }
+
+    return q;
+}
+
+/* ============ PARALLEL SERIALIZATION ============ */
+
+/* A piece of the text produced by to_string_parallel(): either the line
+ * of a single node above the split depth or a whole subtree below it */
+struct TextSegment {
+    struct QDigestNode *n;
+    bool whole;
+    char *buf;
+    size_t length;
+};
+
+/* Number of nodes with count > 0 in the subtree rooted at n */
+static size_t count_lines(const struct QDigestNode *n) {
+    if (!n) return 0;
+    return (n->count > 0) + count_lines(n->left) + count_lines(n->right);
+}
+
+static size_t count_segments(const struct QDigestNode *n, int depth,
+                             int split_depth) {
+    if (!n) return 0;
+    if (depth == split_depth) return 1;
+    return (n->count > 0) + count_segments(n->left, depth + 1, split_depth) +
+           count_segments(n->right, depth + 1, split_depth);
+}
+
+/* Lists the segments in the order preorder_to_string() would emit them */
+static void fill_segments(struct QDigestNode *n, int depth, int split_depth,
+                          struct TextSegment *segs, size_t *len) {
+    if (!n) return;
+    if (depth == split_depth || n->count > 0) {
+        segs[*len].n = n;
+        segs[*len].whole = depth == split_depth;
+        (*len)++;
+        if (depth == split_depth) return;
+    }
+    fill_segments(n->left, depth + 1, split_depth, segs, len);
+    fill_segments(n->right, depth + 1, split_depth, segs, len);
+}
+
+static int clamp_split_depth(int split_depth) {
+    if (split_depth < 0) return 0;
+    if (split_depth > PARALLEL_MAX_SPLIT_DEPTH) return PARALLEL_MAX_SPLIT_DEPTH;
+    return split_depth;
+}
+
+void to_string_parallel(struct QDigest *q, char *buf, size_t *length,
+                        int split_depth) {
+    split_depth = clamp_split_depth(split_depth);
+    *length = 0;
+    if (q->policy.mode == COMPRESS_MANUAL)
+        compress_now(q);
+    struct QDigestNode *root = q->root;
+    *length = sprintf(buf, "%zu %zu %zu %zu\n",
+                      q->N,
+                      q->K,
+                      root->lower_bound,
+                      root->upper_bound);
+
+    size_t n_segs = count_segments(root, 0, split_depth);
+    struct TextSegment *segs = xmalloc(n_segs * sizeof(struct TextSegment));
+    size_t filled = 0;
+    fill_segments(root, 0, split_depth, segs, &filled);
+    assert(filled == n_segs);
+
+    // every segment is encoded into a buffer of its own
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < n_segs; i++) {
+        struct TextSegment *seg = &segs[i];
+        seg->length = 0;
+        if (seg->whole) {
+            seg->buf = xmalloc(count_lines(seg->n) * TEXT_LINE_MAX + 1);
+            preorder_to_string(seg->n, seg->buf, &seg->length);
+        } else {
+            seg->buf = xmalloc(TEXT_LINE_MAX + 1);
+            seg->length = sprintf(seg->buf, "%zu %zu %zu\n",
+                                  seg->n->lower_bound,
+                                  seg->n->upper_bound,
+                                  seg->n->count);
+        }
+    }
+
+    // offset table: where each segment starts in the output
+    size_t *offset = xmalloc((n_segs + 1) * sizeof(size_t));
+    offset[0] = *length;
+    for (size_t i = 0; i < n_segs; i++)
+        offset[i + 1] = offset[i] + segs[i].length;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < n_segs; i++) {
+        memcpy(buf + offset[i], segs[i].buf, segs[i].length);
+        free(segs[i].buf);
+    }
+    buf[offset[n_segs]] = '\0';
+    *length = offset[n_segs];
+
+    free(offset);
+    free(segs);
+}
+
+/* A node line parsed by from_string_parallel(), tagged with the subtree
+ * below the split depth it belongs to (PARSED_TOP for nodes above it) */
+struct ParsedNode {
+    size_t lower_bound;
+    size_t upper_bound;
+    size_t count;
+    size_t subtree;
+};
+
+#define PARSED_TOP SIZE_MAX
+
+/* Follows the midpoint splits of locate_node() for at most split_depth
+ * levels. Returns the index of the subtree at split_depth holding
+ * [lower, upper], or PARSED_TOP if the range is a node above it. */
+static size_t subtree_of(size_t lo, size_t hi, size_t lower, size_t upper,
+                         int split_depth) {
+    size_t index = 0;
+    for (int d = 0; d < split_depth; d++) {
+        if (lo == lower && hi == upper) return PARSED_TOP;
+        size_t mid = lo + (hi - lo) / 2;
+        index <<= 1;
+        if (upper <= mid) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+            index |= 1;
+        }
+    }
+    return index;
+}
+
+/* Range [*lo, *hi] of the subtree at split_depth with the given index */
+static void subtree_range(size_t *lo, size_t *hi, size_t index,
+                          int split_depth) {
+    for (int d = split_depth - 1; d >= 0; d--) {
+        size_t mid = *lo + (*hi - *lo) / 2;
+        if ((index >> d) & 1)
+            *lo = mid + 1;
+        else
+            *hi = mid;
+    }
+}
+
+/* Parses the node lines in [p, end), stopping at the first malformed
+ * or out of range one. Returns false if it had to stop early. */
+static bool parse_chunk(const char *p, const char *end, size_t lo, size_t hi,
+                        int split_depth, struct ParsedNode *out,
+                        size_t *len) {
+    size_t v[3];
+    *len = 0;
+    while (parse_node_line(&p, end, v)) {
+        if (v[0] > v[1] || v[0] < lo || v[1] > hi)
+            return false;
+        struct ParsedNode *pn = &out[(*len)++];
+        pn->lower_bound = v[0];
+        pn->upper_bound = v[1];
+        pn->count = v[2];
+        pn->subtree = subtree_of(lo, hi, v[0], v[1], split_depth);
+    }
+    // only trailing whitespace may be left
+    while (p < end && (*p == ' ' || *p == '\n')) p++;
+    return p == end;
+}
+
+struct QDigest *from_string_parallel(char *buf, int split_depth) {
+    split_depth = clamp_split_depth(split_depth);
+    size_t _N, _K, _lower_bound, _upper_bound;
+    int chars = 0;
+    if (sscanf(buf, "%zu %zu %zu %zu\n%n",
+               &_N, &_K, &_lower_bound, &_upper_bound, &chars) != 4)
+    {
+        return NULL; // check for invalid header
+    }
+    // a root too narrow to split has nothing to parallelize
+    if (split_depth == 0 ||
+        (size_t)split_depth > log_2_ceil(_upper_bound - _lower_bound + 1))
+        return from_string(buf);
+    const char *body = buf + chars;
+    size_t body_len = strlen(body);
+
+    /* Parse: the text is cut at line boundaries into one chunk per
+     * thread-sized share, each parsed into its own array */
+    size_t n_chunks = body_len / PARALLEL_PARSE_CHUNK + 1;
+    size_t *cut = xmalloc((n_chunks + 1) * sizeof(size_t));
+    cut[0] = 0;
+    for (size_t c = 1; c < n_chunks; c++) {
+        size_t pos = body_len / n_chunks * c;
+        if (pos < cut[c - 1]) pos = cut[c - 1];
+        while (pos < body_len && body[pos - 1] != '\n') pos++;
+        cut[c] = pos;
+    }
+    cut[n_chunks] = body_len;
+
+    struct ParsedNode **parsed = xmalloc(n_chunks * sizeof(struct ParsedNode *));
+    size_t *parsed_len = xmalloc(n_chunks * sizeof(size_t));
+    bool *complete = xmalloc(n_chunks * sizeof(bool));
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t c = 0; c < n_chunks; c++) {
+        size_t lines = 1;
+        for (size_t i = cut[c]; i < cut[c + 1]; i++)
+            lines += body[i] == '\n';
+        parsed[c] = xmalloc(lines * sizeof(struct ParsedNode));
+        complete[c] = parse_chunk(body + cut[c], body + cut[c + 1],
+                                  _lower_bound, _upper_bound, split_depth,
+                                  parsed[c], &parsed_len[c]);
+    }
+    // like from_string(), everything after the first bad line is ignored
+    for (size_t c = 0; c < n_chunks; c++) {
+        if (!complete[c]) {
+            for (size_t d = c + 1; d < n_chunks; d++)
+                parsed_len[d] = 0;
+            break;
+        }
+    }
+
+    /* Group the nodes by subtree. The nodes above the split depth go
+     * straight into the digest. */
+    struct QDigest *q = create_tmp_q(_K, _upper_bound);
+    q->root->lower_bound = _lower_bound;
+    size_t n_subtrees = (size_t)1 << split_depth;
+    size_t *start = xmalloc((n_subtrees + 1) * sizeof(size_t));
+    memset(start, 0, (n_subtrees + 1) * sizeof(size_t));
+    for (size_t c = 0; c < n_chunks; c++) {
+        for (size_t i = 0; i < parsed_len[c]; i++) {
+            struct ParsedNode *pn = &parsed[c][i];
+            if (pn->subtree == PARSED_TOP) {
+                struct QDigestNode node = {0};
+                node.lower_bound = pn->lower_bound;
+                node.upper_bound = pn->upper_bound;
+                node.count = pn->count;
+                insert_node(q, &node);
+            } else {
+                start[pn->subtree + 1]++;
+            }
         }
-        buf += consumed;
-        struct QDigestNode *node = create_node(lower_bound, upper_bound);
-        node->count = count;
-        insert_node(q, node);
+    }
+    for (size_t j = 0; j < n_subtrees; j++)
+        start[j + 1] += start[j];
+    struct ParsedNode *grouped = xmalloc((start[n_subtrees] + 1) *
+                                         sizeof(struct ParsedNode));
+    size_t *fill = xmalloc(n_subtrees * sizeof(size_t));
+    memcpy(fill, start, n_subtrees * sizeof(size_t));
+    for (size_t c = 0; c < n_chunks; c++) {
+        for (size_t i = 0; i < parsed_len[c]; i++)
+            if (parsed[c][i].subtree != PARSED_TOP)
+                grouped[fill[parsed[c][i].subtree]++] = parsed[c][i];
+        free(parsed[c]);
     }
 
+    /* Rebuild every subtree as a digest of its own */
+    struct QDigest **sub = xmalloc(n_subtrees * sizeof(struct QDigest *));
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t j = 0; j < n_subtrees; j++) {
+        sub[j] = NULL;
+        if (start[j] == start[j + 1]) continue;
+        size_t lo = _lower_bound, hi = _upper_bound;
+        subtree_range(&lo, &hi, j, split_depth);
+        sub[j] = create_tmp_q(_K, hi);
+        sub[j]->root->lower_bound = lo;
+        for (size_t i = start[j]; i < start[j + 1]; i++) {
+            struct QDigestNode node = {0};
+            node.lower_bound = grouped[i].lower_bound;
+            node.upper_bound = grouped[i].upper_bound;
+            node.count = grouped[i].count;
+            insert_node(sub[j], &node);
+        }
+    }
+
+    /* Stitch: each subtree root replaces the node of the same range,
+     * which is created empty since nothing above the split touches it */
+    for (size_t j = 0; j < n_subtrees; j++) {
+        if (!sub[j]) continue;
+        struct QDigestNode *slot = locate_node(q, sub[j]->root->lower_bound,
+                                               sub[j]->root->upper_bound);
+        assert(slot->count == 0 && !slot->left && !slot->right);
+        struct QDigestNode *parent = slot->parent;
+        if (parent->left == slot)
+            parent->left = sub[j]->root;
+        else
+            parent->right = sub[j]->root;
+        sub[j]->root->parent = parent;
+        pool_free(q->pool, slot);
+        q->num_nodes += sub[j]->num_nodes - 1;
+        if (!add_saturating(&q->N, sub[j]->N) || sub[j]->saturated)
+            q->saturated = true;
+        add_to_path(parent, sub[j]->root->subtree_count);
+        free(sub[j]);   // header only, the nodes now belong to q
+    }
+
+    free(sub);
+    free(fill);
+    free(grouped);
+    free(start);
+    free(complete);
+    free(parsed_len);
+    free(parsed);
+    free(cut);
     return q;
 }
 
+/* ============ DELTA SERIALIZATION ============ */
+
+size_t delta_max_size(const struct QDigest *q) {
+    // the header takes at most three node lines
+    return (q->num_nodes + q->log.len + 3) * TEXT_LINE_MAX + 1;
+}
+
+/* Writes the nodes changed after base_version, zero counts included */
+static char *preorder_to_delta(const struct QDigestNode *n,
+                               uint64_t base_version, char *buf,
+                               size_t *length) {
+    if (!n) return buf;
+    if (n->version > base_version) {
+        int k = sprintf(buf, "%zu %zu %zu\n",
+                        n->lower_bound,
+                        n->upper_bound,
+                        n->count);
+        buf += k;
+        *length += k;
+    }
+    buf = preorder_to_delta(n->left, base_version, buf, length);
+    buf = preorder_to_delta(n->right, base_version, buf, length);
+    return buf;
+}
+
+uint64_t to_delta(struct QDigest *q, uint64_t base_version, char *buf,
+                  size_t *length) {
+    if (q->policy.mode == COMPRESS_MANUAL)
+        compress_now(q);
+    struct DeltaLog *log = &q->log;
+    const bool full = base_version == 0 || base_version < log->trimmed_version;
+    int k = sprintf(buf, "%" PRIu64 " %" PRIu64 " %d %zu %zu %zu %zu\n",
+                    log->version,
+                    base_version,
+                    full,
+                    q->N,
+                    q->K,
+                    q->root->lower_bound,
+                    q->root->upper_bound);
+    buf += k;
+    *length = k;
+
+    if (full) {
+        preorder_to_string(q->root, buf, length);
+    } else {
+        // removals go first: a range may have been removed and created again
+        size_t first = log->len;
+        while (first > 0 && log->tombstones[first - 1].version > base_version)
+            first--;
+        for (size_t i = first; i < log->len; i++) {
+            k = sprintf(buf, "%zu %zu 0\n",
+                        log->tombstones[i].lower_bound,
+                        log->tombstones[i].upper_bound);
+            buf += k;
+            *length += k;
+        }
+        preorder_to_delta(q->root, base_version, buf, length);
+    }
+    // later changes belong to the next delta
+    return log->version++;
+}
+
+/* Looks up the node covering exactly [lower, upper], without creating it */
+static struct QDigestNode *find_node(const struct QDigest *q, size_t lower,
+                                     size_t upper) {
+    struct QDigestNode *curr = q->root;
+    while (curr && (curr->lower_bound != lower || curr->upper_bound != upper)) {
+        size_t mid =
+            curr->lower_bound + (curr->upper_bound - curr->lower_bound) / 2;
+        curr = (upper <= mid) ? curr->left : curr->right;
+    }
+    return curr;
+}
+
+/* Sets the count of [lower, upper] to count, keeping N and the subtree
+ * counts in line. A leaf that drops to zero is removed. */
+static void set_node_count(struct QDigest *q, size_t lower, size_t upper,
+                           size_t count) {
+    struct QDigestNode *n = (count > 0) ? locate_node(q, lower, upper)
+                                        : find_node(q, lower, upper);
+    if (!n)
+        return;
+    if (count >= n->count) {
+        size_t w = count - n->count;
+        if (!add_saturating(&q->N, w))
+            q->saturated = true;
+        add_to_path(n, w);
+    } else {
+        size_t w = n->count - count;
+        q->N -= w;
+        for (struct QDigestNode *a = n; a; a = a->parent)
+            a->subtree_count -= w;
+    }
+    n->count = count;
+    n->version = q->log.version;
+    if (count == 0 && n != q->root)
+        delete_node_if_needed(q, n, 0, 0);
+}
+
+uint64_t apply_delta(struct QDigest *q, const char *buf) {
+    uint64_t version, base_version;
+    int full;
+    size_t _N, _K, _lower_bound, _upper_bound;
+    int chars = 0;
+    if (sscanf(buf, "%" SCNu64 " %" SCNu64 " %d %zu %zu %zu %zu\n%n",
+               &version, &base_version, &full, &_N, &_K, &_lower_bound,
+               &_upper_bound, &chars) != 7 || _lower_bound > _upper_bound)
+    {
+        return 0; // check for invalid header
+    }
+
+    if (full) {
+        // the replica is rebuilt from scratch
+        pool_free_tree(q->pool, q->root);
+        q->root = pool_alloc(q->pool, _lower_bound, _upper_bound);
+        q->num_nodes = 1;
+        q->N = 0;
+        q->saturated = false;
+    } else if (_lower_bound != q->root->lower_bound ||
+               _upper_bound < q->root->upper_bound) {
+        return 0;
+    } else if (_upper_bound > q->root->upper_bound) {
+        // the sender grew its universe since the base version
+        if (_upper_bound == SIZE_MAX || ((_upper_bound + 1) & _upper_bound))
+            return 0;
+        expand_tree(q, _upper_bound + 1);
+    }
+    q->K = _K;
+
+    const char *p = buf + chars;
+    const char *end = p + strlen(p);
+    size_t v[3];
+    while (parse_node_line(&p, end, v)) {
+        if (v[0] > v[1] || v[0] < _lower_bound || v[1] > _upper_bound)
+            return 0;
+        set_node_count(q, v[0], v[1], v[2]);
+    }
+    return version;
+}
+
+void trim_tombstones(struct QDigest *q, uint64_t acked_version) {
+    struct DeltaLog *log = &q->log;
+    // no receiver can hold the version still open
+    if (acked_version >= log->version)
+        acked_version = log->version - 1;
+    size_t i = 0;
+    while (i < log->len && log->tombstones[i].version <= acked_version)
+        i++;
+    if (i > 0) {
+        memmove(log->tombstones, log->tombstones + i,
+                (log->len - i) * sizeof(struct Tombstone));
+        log->len -= i;
+    }
+    if (acked_version > log->trimmed_version)
+        log->trimmed_version = acked_version;
+}
+
 #ifdef TESTCORE
 
 int main(void) {
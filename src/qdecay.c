@@ -0,0 +1,70 @@
+#include "../include/qdecay.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct QDecay *create_decay(size_t K, size_t upper_bound, double half_life,
+                            double start) {
+    assert(half_life > 0.0);
+    struct QDecay *d = xmalloc(sizeof(struct QDecay));
+    d->q = create_tmp_q(K, upper_bound);
+    d->lambda = log(2.0) / half_life;
+    d->landmark = start;
+    d->horizon = DECAY_MAX_GROWTH_LOG2 * half_life;
+    return d;
+}
+
+void delete_decay(struct QDecay *d) {
+    delete_qdigest(d->q);
+    free(d);
+}
+
+/* Scales the counts of a subtree in place and rebuilds its subtree
+ * counts. Returns the new total of the subtree. */
+static size_t scale_counts(struct QDigestNode *n, double factor,
+                           uint64_t version) {
+    if (!n)
+        return 0;
+    size_t total = scale_counts(n->left, factor, version);
+    total += scale_counts(n->right, factor, version);
+    size_t scaled = (size_t)floor((double)n->count * factor);
+    if (scaled != n->count)
+        n->version = version;
+    n->count = scaled;
+    total += n->count;
+    n->subtree_count = total;
+    return total;
+}
+
+void decay_rescale(struct QDecay *d, double t) {
+    assert(t >= d->landmark);
+    const double factor = exp(-d->lambda * (t - d->landmark));
+    d->landmark = t;
+    d->q->N = scale_counts(d->q->root, factor, d->q->log.version);
+    // drop the nodes that decayed to nothing
+    compress_now(d->q);
+}
+
+bool decay_insert(struct QDecay *d, size_t key, double t) {
+    if (t - d->landmark > d->horizon)
+        decay_rescale(d, t);
+
+    double w = ldexp(exp(d->lambda * (t - d->landmark)), DECAY_FIXED_SHIFT);
+    // very late arrivals still count for the smallest representable weight
+    uint64_t weight = (w < 1.0) ? 1 : (uint64_t)llround(w);
+    return insert_weighted(d->q, key, weight, true);
+}
+
+size_t decay_percentile(struct QDecay *d, double p) {
+    return percentile(d->q, p);
+}
+
+double decay_total(struct QDecay *d, double t) {
+    return ldexp((double)d->q->N, -DECAY_FIXED_SHIFT) *
+           exp(-d->lambda * (t - d->landmark));
+}
@@ -0,0 +1,258 @@
+#include "../include/qhybrid.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Entries allocated by the first insert */
+#define HYBRID_MIN_CAPACITY 8
+
+struct QHybrid *create_hybrid(size_t K, size_t upper_bound, size_t limit) {
+    struct QHybrid *h = xmalloc(sizeof(struct QHybrid));
+    h->q = NULL;
+    h->entries = NULL;
+    h->len = 0;
+    h->capacity = 0;
+    h->limit = limit;
+    h->sorted = true;
+    h->N = 0;
+    h->K = K;
+    // a dyadic universe, so that digests of different sizes merge
+    assert(upper_bound + 1 != 0);
+    h->upper_bound = ((size_t)1 << log_2_ceil(upper_bound + 1)) - 1;
+    return h;
+}
+
+void delete_hybrid(struct QHybrid *h) {
+    if (h->q)
+        delete_qdigest(h->q);
+    free(h->entries);
+    free(h);
+}
+
+bool hybrid_is_exact(const struct QHybrid *h) { return h->q == NULL; }
+
+static int compare_entries(const void *a, const void *b) {
+    const size_t x = ((const struct ExactEntry *)a)->value;
+    const size_t y = ((const struct ExactEntry *)b)->value;
+    return (x > y) - (x < y);
+}
+
+/* Sorts the entries and folds the duplicates */
+static void compact(struct QHybrid *h) {
+    if (h->sorted)
+        return;
+    qsort(h->entries, h->len, sizeof(struct ExactEntry), compare_entries);
+    size_t out = 0;
+    for (size_t i = 0; i < h->len; i++) {
+        if (out > 0 && h->entries[out - 1].value == h->entries[i].value)
+            add_saturating(&h->entries[out - 1].count, h->entries[i].count);
+        else
+            h->entries[out++] = h->entries[i];
+    }
+    h->len = out;
+    h->sorted = true;
+}
+
+/* Grows the entries towards the limit, false if they are at the limit */
+static bool grow(struct QHybrid *h) {
+    if (h->capacity >= h->limit)
+        return false;
+    size_t capacity = h->capacity ? h->capacity * 2 : HYBRID_MIN_CAPACITY;
+    if (capacity > h->limit)
+        capacity = h->limit;
+    struct ExactEntry *entries = xmalloc(capacity * sizeof(struct ExactEntry));
+    if (h->len > 0)
+        memcpy(entries, h->entries, h->len * sizeof(struct ExactEntry));
+    free(h->entries);
+    h->entries = entries;
+    h->capacity = capacity;
+    return true;
+}
+
+/* The sorted entries as tree leaves */
+static struct QFlatNode *entries_to_leaves(const struct ExactEntry *entries,
+                                           size_t len) {
+    struct QFlatNode *leaves =
+        xmalloc((len > 0 ? len : 1) * sizeof(struct QFlatNode));
+    for (size_t i = 0; i < len; i++) {
+        leaves[i].count = entries[i].count;
+        leaves[i].subtree_count = entries[i].count;
+        leaves[i].lower_bound = entries[i].value;
+        leaves[i].upper_bound = entries[i].value;
+    }
+    return leaves;
+}
+
+struct QDigest *hybrid_digest(struct QHybrid *h) {
+    if (h->q)
+        return h->q;
+    compact(h);
+    h->q = create_tmp_q(h->K, h->upper_bound);
+    // sorted leaves are in preorder, so the bulk build is linear and
+    // compresses once at the end instead of along the inserts
+    struct QFlatNode *leaves = entries_to_leaves(h->entries, h->len);
+    merge_flat(h->q, leaves, h->len, h->K);
+    free(leaves);
+    free(h->entries);
+    h->entries = NULL;
+    h->len = h->capacity = 0;
+    return h->q;
+}
+
+/* hybrid_insert() with a full-width count */
+static void add(struct QHybrid *h, size_t key, size_t count) {
+    if (h->q) {
+        insert_weighted(h->q, key, count, true);
+        return;
+    }
+    if (key > h->upper_bound) {
+        // the universe insert() would grow to
+        assert(key + 1 != 0);
+        h->upper_bound = ((size_t)1 << log_2_ceil(key + 1)) - 1;
+    }
+    if (h->len == h->capacity && !grow(h)) {
+        compact(h);
+        if (h->len == h->capacity) {
+            // full of distinct values: only a known value still fits
+            size_t lo = 0, hi = h->len;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (h->entries[mid].value < key)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == h->len || h->entries[lo].value != key) {
+                insert_weighted(hybrid_digest(h), key, count, true);
+                return;
+            }
+            add_saturating(&h->entries[lo].count, count);
+            add_saturating(&h->N, count);
+            return;
+        }
+    }
+    if (h->len > 0 && h->entries[h->len - 1].value >= key)
+        h->sorted = false;
+    h->entries[h->len].value = key;
+    h->entries[h->len].count = count;
+    h->len++;
+    add_saturating(&h->N, count);
+}
+
+void hybrid_insert(struct QHybrid *h, size_t key, unsigned int count) {
+    add(h, key, count);
+}
+
+size_t hybrid_percentile(struct QHybrid *h, double p) {
+    if (h->q)
+        return percentile(h->q, p);
+    if (h->len == 0)
+        return 0;
+    compact(h);
+    if (p <= 0.0) p = 0.0;
+    if (p >= 1.0) p = 1.0;
+    // the rank percentile() would look for
+    size_t req_rank;
+    if (h->N <= ((size_t)1 << 53)) {
+        req_rank = p * h->N;
+    } else {
+        const uint64_t den = (uint64_t)1 << 53;
+        req_rank = mul_div_floor(h->N, (uint64_t)(p * den), den);
+    }
+    size_t cum = 0;
+    for (size_t i = 0; i < h->len; i++) {
+        add_saturating(&cum, h->entries[i].count);
+        if (cum >= req_rank)
+            return h->entries[i].value;
+    }
+    return h->entries[h->len - 1].value;
+}
+
+size_t hybrid_rank(struct QHybrid *h, size_t value) {
+    if (h->q)
+        return rank(h->q, value);
+    size_t r = 0;
+    for (size_t i = 0; i < h->len; i++)
+        if (h->entries[i].value <= value)
+            add_saturating(&r, h->entries[i].count);
+    return r;
+}
+
+void hybrid_merge(struct QHybrid *h1, const struct QHybrid *h2) {
+    if (h2->K > h1->K)
+        h1->K = h2->K;
+    if (h2->q) {
+        merge(hybrid_digest(h1), h2->q);
+    } else if (h1->q) {
+        struct QFlatNode *leaves = entries_to_leaves(h2->entries, h2->len);
+        merge_flat(h1->q, leaves, h2->len, h2->K);
+        free(leaves);
+    } else {
+        if (h2->upper_bound > h1->upper_bound)
+            h1->upper_bound = h2->upper_bound;
+        for (size_t i = 0; i < h2->len; i++)
+            add(h1, h2->entries[i].value, h2->entries[i].count);
+    }
+}
+
+size_t hybrid_max_string(const struct QHybrid *h) {
+    // the header line takes at most two node lines
+    size_t lines = h->q ? h->q->num_nodes : h->len;
+    return (lines + 2) * TEXT_LINE_MAX;
+}
+
+void hybrid_to_string(struct QHybrid *h, char *buf, size_t *buf_length) {
+    if (h->q) {
+        to_string(h->q, buf, buf_length);
+        return;
+    }
+    compact(h);
+    size_t len = sprintf(buf, "%zu %zu %d %zu\n", h->N, h->K, 0,
+                         h->upper_bound);
+    for (size_t i = 0; i < h->len; i++)
+        len += sprintf(buf + len, "%zu %zu %zu\n", h->entries[i].value,
+                       h->entries[i].value, h->entries[i].count);
+    *buf_length = len;
+}
+
+struct QHybrid *hybrid_from_string(char *buf, size_t limit) {
+    size_t N, K, lower_bound, upper_bound;
+    int chars = 0;
+    if (sscanf(buf, "%zu %zu %zu %zu\n%n", &N, &K, &lower_bound,
+               &upper_bound, &chars) != 4)
+        return NULL;
+
+    struct QHybrid *h = create_hybrid(K, upper_bound, limit);
+    const char *p = buf + chars;
+    const char *end = p + strlen(p);
+    size_t v[3];
+    bool exact = lower_bound == 0;
+    while (exact && parse_node_line(&p, end, v) && v[1] <= upper_bound) {
+        // the same lines from_string() would accept, leaves only
+        if (v[0] != v[1] || h->len == limit) {
+            exact = false;
+        } else if (v[2] > 0) {
+            if (h->len == h->capacity)
+                grow(h);
+            h->entries[h->len].value = v[0];
+            h->entries[h->len].count = v[2];
+            h->len++;
+            add_saturating(&h->N, v[2]);
+        }
+    }
+    if (!exact) {
+        free(h->entries);
+        h->entries = NULL;
+        h->len = h->capacity = 0;
+        h->N = 0;
+        h->q = from_string(buf);
+    }
+    h->sorted = false;
+    return h;
+}
@@ -0,0 +1,135 @@
+#include "../include/qkeymap.h"
+#include "../include/qcore.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SIZE_BITS (sizeof(size_t) * 8)
+
+/* Number of mantissa bits of a double */
+#define MANTISSA_BITS 52
+
+/* Position of the leading one of v > 0 */
+static unsigned floor_log2(size_t v) {
+    unsigned e = 0;
+    while (v >>= 1)
+        e++;
+    return e;
+}
+
+size_t log_key(size_t value, unsigned bits) {
+    assert(bits < SIZE_BITS);
+    if (value < ((size_t)1 << bits))
+        return value;
+    const unsigned e = floor_log2(value);
+    const size_t mask = ((size_t)1 << bits) - 1;
+    return ((size_t)(e - bits + 1) << bits) | ((value >> (e - bits)) & mask);
+}
+
+size_t log_value(size_t key, unsigned bits) {
+    assert(bits < SIZE_BITS);
+    if (key < ((size_t)1 << bits))
+        return key;
+    const unsigned shift = (unsigned)(key >> bits) - 1;
+    // the keys past log_upper_bound() would start beyond SIZE_MAX
+    assert(shift + bits < SIZE_BITS);
+    const size_t mask = ((size_t)1 << bits) - 1;
+    const size_t lower = (((size_t)1 << bits) | (key & mask)) << shift;
+    return lower + ((((size_t)1 << shift) - 1) >> 1);
+}
+
+size_t log_upper_bound(unsigned bits) {
+    assert(bits < SIZE_BITS);
+    return ((SIZE_BITS - bits + 1) << bits) - 1;
+}
+
+void insert_log(struct QDigest *q, size_t value, unsigned int count,
+                unsigned bits) {
+    insert(q, log_key(value, bits), count, true);
+}
+
+size_t percentile_log(struct QDigest *q, double p, unsigned bits) {
+    return log_value(percentile(q, p), bits);
+}
+
+/* The sign, exponent and leading mantissa bits of a double; ordered
+ * like the values for non-negative ones */
+static uint64_t leading_bits(double x, unsigned bits) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u >> (MANTISSA_BITS - bits);
+}
+
+static double from_bits(uint64_t u) {
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+bool keymap_init(struct KeyMap *map, unsigned bits, double min_value,
+                 double max_value, bool negative) {
+    if (bits > MANTISSA_BITS || !(min_value > 0) || !(max_value >= min_value)
+        || !isfinite(max_value))
+        return false;
+    const uint64_t base = leading_bits(min_value, bits);
+    const uint64_t span = leading_bits(max_value, bits) - base + 1;
+    // both signs and zero have to fit in a size_t
+    if (span > (SIZE_MAX - 1) / 2)
+        return false;
+    map->bits = bits;
+    map->min_value = min_value;
+    map->max_value = max_value;
+    map->negative = negative;
+    map->base = base;
+    map->span = (size_t)span;
+    return true;
+}
+
+size_t keymap_upper_bound(const struct KeyMap *map) {
+    return map->negative ? 2 * map->span : map->span;
+}
+
+size_t keymap_key(const struct KeyMap *map, double x) {
+    const bool neg = x < 0;
+    double m = fabs(x);
+    size_t r = 0;
+    if (m >= map->min_value) {
+        if (m > map->max_value)
+            m = map->max_value;
+        r = (size_t)(leading_bits(m, map->bits) - map->base) + 1;
+    }
+    if (!map->negative)
+        return neg ? 0 : r;
+    return neg ? map->span - r : map->span + r;
+}
+
+double keymap_value(const struct KeyMap *map, size_t key) {
+    const size_t zero = map->negative ? map->span : 0;
+    const bool neg = key < zero;
+    const size_t r = neg ? zero - key : key - zero;
+    if (r == 0)
+        return 0.0;
+    const unsigned shift = MANTISSA_BITS - map->bits;
+    const uint64_t lead = map->base + r - 1;
+    const double lower = from_bits(lead << shift);
+    const double upper = from_bits(((lead + 1) << shift) - 1);
+    const double mid = lower + (upper - lower) / 2;
+    return neg ? -mid : mid;
+}
+
+void insert_double(struct QDigest *q, const struct KeyMap *map, double x,
+                   unsigned int count) {
+    insert(q, keymap_key(map, x), count, true);
+}
+
+double percentile_double(struct QDigest *q, const struct KeyMap *map,
+                         double p) {
+    return keymap_value(map, percentile(q, p));
+}
+
+size_t rank_double(struct QDigest *q, const struct KeyMap *map, double x) {
+    return rank(q, keymap_key(map, x));
+}
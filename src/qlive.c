@@ -0,0 +1,82 @@
+#include "../include/qlive.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include "../include/qsnapshot.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Encodes the digest into a new view holding one reference */
+static struct QView *encode_view(const struct QDigest *q, uint64_t serial) {
+    struct QView *v = xmalloc(sizeof(struct QView));
+    const size_t len = snapshot_size(q);
+    v->buf = xmalloc(len);
+    snapshot_encode(q, v->buf);
+    v->snap = snapshot_view(v->buf, len);
+    assert(v->snap);
+    v->serial = serial;
+    v->refs = 1;
+    return v;
+}
+
+static void free_view(struct QView *v) {
+    snapshot_close(v->snap);
+    free(v->buf);
+    free(v);
+}
+
+struct QLive *create_live(size_t K, size_t upper_bound, size_t publish_every) {
+    struct QLive *l = xmalloc(sizeof(struct QLive));
+    l->q = create_tmp_q(K, upper_bound);
+    pthread_mutex_init(&l->lock, NULL);
+    l->publish_every = publish_every;
+    l->unpublished = 0;
+    l->serial = 1;
+    l->current = encode_view(l->q, l->serial);
+    return l;
+}
+
+void delete_live(struct QLive *l) {
+    assert(l->current->refs == 1);
+    free_view(l->current);
+    pthread_mutex_destroy(&l->lock);
+    delete_qdigest(l->q);
+    free(l);
+}
+
+void live_insert(struct QLive *l, size_t key, unsigned int count) {
+    insert(l->q, key, count, true);
+    if (++l->unpublished == l->publish_every)
+        live_publish(l);
+}
+
+void live_publish(struct QLive *l) {
+    // the expensive part runs before the lock is taken
+    struct QView *v = encode_view(l->q, ++l->serial);
+    pthread_mutex_lock(&l->lock);
+    struct QView *old = l->current;
+    l->current = v;
+    const size_t refs = --old->refs;
+    pthread_mutex_unlock(&l->lock);
+    if (refs == 0)
+        free_view(old);
+    l->unpublished = 0;
+}
+
+struct QView *qdigest_snapshot(struct QLive *l) {
+    pthread_mutex_lock(&l->lock);
+    struct QView *v = l->current;
+    v->refs++;
+    pthread_mutex_unlock(&l->lock);
+    return v;
+}
+
+void view_release(struct QLive *l, struct QView *v) {
+    pthread_mutex_lock(&l->lock);
+    const size_t refs = --v->refs;
+    pthread_mutex_unlock(&l->lock);
+    if (refs == 0)
+        free_view(v);
+}
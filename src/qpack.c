@@ -0,0 +1,242 @@
+#include "../include/qpack.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Parameters of the LZ4 block format */
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5      // the block always ends with literals
+#define LZ_MF_LIMIT 12          // no match may start in the last bytes
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_LOG 12
+#define LZ_SKIP_TRIGGER 6       // speed up over incompressible input
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static size_t lz_hash(uint32_t v) {
+    return (size_t)((v * 2654435761u) >> (32 - LZ_HASH_LOG));
+}
+
+/* Writes the extension bytes of a length that did not fit its nibble */
+static uint8_t *write_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* Writes one sequence: literals followed by a match. The last sequence
+ * of a block has literals only (match_len == 0). */
+static uint8_t *emit_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len,
+                              size_t offset, size_t match_len) {
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        op = write_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0)
+        return op;
+
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    size_t m = match_len - LZ_MIN_MATCH;
+    *token |= (uint8_t)(m < 15 ? m : 15);
+    if (m >= 15)
+        op = write_length(op, m - 15);
+    return op;
+}
+
+size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst) {
+    // positions + 1 of the last 4-byte sequences seen, 0 when empty
+    size_t table[1 << LZ_HASH_LOG];
+    memset(table, 0, sizeof(table));
+    uint8_t *op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    if (len > LZ_MF_LIMIT) {
+        const size_t match_limit = len - LZ_LAST_LITERALS;
+        const size_t ip_limit = len - LZ_MF_LIMIT;
+        while (ip < ip_limit) {
+            uint32_t seq = read32(src + ip);
+            size_t h = lz_hash(seq);
+            size_t cand = table[h];
+            table[h] = ip + 1;
+            if (cand == 0 || ip - (cand - 1) > LZ_MAX_OFFSET ||
+                read32(src + cand - 1) != seq) {
+                ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            size_t ref = cand - 1;
+            size_t match_len = LZ_MIN_MATCH;
+            while (ip + match_len < match_limit &&
+                   src[ref + match_len] == src[ip + match_len])
+                match_len++;
+            op = emit_sequence(op, src + anchor, ip - anchor, ip - ref,
+                               match_len);
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+    op = emit_sequence(op, src + anchor, len - anchor, 0, 0);
+    return (size_t)(op - dst);
+}
+
+/* Adds the extension bytes of a length to *len */
+static bool read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip == iend || *len > SIZE_MAX - 255)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *src, size_t len, uint8_t *dst,
+                   size_t raw_len) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    size_t op = 0;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !read_length(&ip, iend, &lit_len))
+            return false;
+        if ((size_t)(iend - ip) < lit_len || raw_len - op < lit_len)
+            return false;
+        memcpy(dst + op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend)
+            break;  // the last sequence has no match
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_length(&ip, iend, &match_len))
+            return false;
+        match_len += LZ_MIN_MATCH;
+        if (raw_len - op < match_len)
+            return false;
+        if (offset >= match_len) {
+            memcpy(dst + op, dst + op - offset, match_len);
+        } else {
+            // the match overlaps the bytes it produces
+            for (size_t i = 0; i < match_len; i++)
+                dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+    return op == raw_len;
+}
+
+size_t pack_bound(size_t len) {
+    return sizeof(struct PackHeader) + lz_bound(len);
+}
+
+size_t pack(const void *src, size_t len, void *dst, size_t threshold) {
+    struct PackHeader hdr;
+    memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+    hdr.flags = 0;
+    hdr.raw_len = len;
+    hdr.payload_len = len;
+
+    uint8_t *payload = (uint8_t *)dst + sizeof(struct PackHeader);
+    if (len >= threshold) {
+        size_t n = lz_compress(src, len, payload);
+        // keep the compressed payload only if it is smaller
+        if (n < len) {
+            hdr.flags = PACK_FLAG_LZ;
+            hdr.payload_len = n;
+        }
+    }
+    if (!(hdr.flags & PACK_FLAG_LZ))
+        memcpy(payload, src, len);
+    // dst may not be aligned for the header
+    memcpy(dst, &hdr, sizeof(hdr));
+    return sizeof(hdr) + (size_t)hdr.payload_len;
+}
+
+/* Reads and validates the header of a packed buffer */
+static bool read_header(const void *buf, size_t len, struct PackHeader *hdr) {
+    if (len < sizeof(struct PackHeader))
+        return false;
+    memcpy(hdr, buf, sizeof(*hdr));
+    if (memcmp(hdr->magic, PACK_MAGIC, sizeof(hdr->magic)) != 0 ||
+        (hdr->flags & ~PACK_FLAG_LZ) != 0 ||
+        hdr->payload_len > len - sizeof(struct PackHeader))
+        return false;
+    if (hdr->flags & PACK_FLAG_LZ)
+        // a match expands at most 255 times the bytes describing it
+        return hdr->raw_len / 255 <= hdr->payload_len;
+    return hdr->raw_len == hdr->payload_len;
+}
+
+bool is_packed(const void *buf, size_t len) {
+    struct PackHeader hdr;
+    return read_header(buf, len, &hdr);
+}
+
+void *unpack_alloc(const void *buf, size_t len, size_t *raw_len) {
+    struct PackHeader hdr;
+    if (!read_header(buf, len, &hdr))
+        return NULL;
+    const uint8_t *payload = (const uint8_t *)buf + sizeof(struct PackHeader);
+    uint8_t *out = xmalloc((size_t)hdr.raw_len + 1);
+    if (hdr.flags & PACK_FLAG_LZ) {
+        if (!lz_decompress(payload, (size_t)hdr.payload_len, out,
+                           (size_t)hdr.raw_len)) {
+            free(out);
+            return NULL;
+        }
+    } else {
+        memcpy(out, payload, (size_t)hdr.raw_len);
+    }
+    out[hdr.raw_len] = '\0';
+    *raw_len = (size_t)hdr.raw_len;
+    return out;
+}
+
+void *to_packed(struct QDigest *q, size_t threshold, size_t *packed_len) {
+    // the header line takes at most two node lines
+    char *text = xmalloc((q->num_nodes + 2) * TEXT_LINE_MAX);
+    size_t len;
+    to_string(q, text, &len);
+    void *out = xmalloc(pack_bound(len));
+    *packed_len = pack(text, len, out, threshold);
+    free(text);
+    return out;
+}
+
+struct QDigest *from_packed(const void *buf, size_t len) {
+    size_t raw_len;
+    char *text = unpack_alloc(buf, len, &raw_len);
+    if (!text)
+        return NULL;
+    struct QDigest *q = from_string(text);
+    free(text);
+    return q;
+}
@@ -0,0 +1,293 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../include/qsnapshot.h"
+#include "../include/memory_utils.h"
+#include "../include/node_pool.h"
+#include "../include/qcore.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+size_t snapshot_size(const struct QDigest *q) {
+    return sizeof(struct QSnapshotHeader) +
+           q->num_nodes * sizeof(struct QSnapshotNode);
+}
+
+/* Writes the subtree rooted at n in preorder starting at *next and
+ * returns the index it was given. */
+static uint64_t preorder_to_snapshot(const struct QDigestNode *n,
+                                     struct QSnapshotNode *nodes,
+                                     uint64_t *next) {
+    uint64_t idx = (*next)++;
+    struct QSnapshotNode *out = &nodes[idx];
+    out->lower_bound = n->lower_bound;
+    out->upper_bound = n->upper_bound;
+    out->count = n->count;
+    out->subtree_count = n->subtree_count;
+    out->left = n->left ? preorder_to_snapshot(n->left, nodes, next)
+                        : SNAPSHOT_NO_CHILD;
+    out->right = n->right ? preorder_to_snapshot(n->right, nodes, next)
+                          : SNAPSHOT_NO_CHILD;
+    return idx;
+}
+
+size_t snapshot_encode(const struct QDigest *q, void *buf) {
+    struct QSnapshotHeader *hdr = buf;
+    memcpy(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic));
+    hdr->byte_order = SNAPSHOT_BYTE_ORDER;
+    hdr->N = q->N;
+    hdr->K = q->K;
+    hdr->num_nodes = q->num_nodes;
+    hdr->reserved = 0;
+
+    struct QSnapshotNode *nodes = (struct QSnapshotNode *)(hdr + 1);
+    uint64_t next = 0;
+    preorder_to_snapshot(q->root, nodes, &next);
+    assert(next == q->num_nodes);
+    return snapshot_size(q);
+}
+
+int snapshot_write(const struct QDigest *q, const char *path) {
+    size_t len = snapshot_size(q);
+    void *buf = xmalloc(len);
+    snapshot_encode(q, buf);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        free(buf);
+        return -1;
+    }
+    size_t written = fwrite(buf, 1, len, f);
+    int rc = (fclose(f) == 0 && written == len) ? 0 : -1;
+    free(buf);
+    return rc;
+}
+
+struct QSnapshot *snapshot_view(const void *buf, size_t len) {
+    if (len < sizeof(struct QSnapshotHeader))
+        return NULL;
+    const struct QSnapshotHeader *hdr = buf;
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->byte_order != SNAPSHOT_BYTE_ORDER || hdr->num_nodes == 0)
+        return NULL;
+    size_t room = (len - sizeof(struct QSnapshotHeader)) / sizeof(struct QSnapshotNode);
+    if (hdr->num_nodes > room)
+        return NULL;
+
+    struct QSnapshot *s = xmalloc(sizeof(struct QSnapshot));
+    s->hdr = hdr;
+    s->nodes = (const struct QSnapshotNode *)(hdr + 1);
+    s->map = NULL;
+    s->map_len = 0;
+    return s;
+}
+
+struct QSnapshot *snapshot_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid once the descriptor is closed
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    struct QSnapshot *s = snapshot_view(map, len);
+    if (!s) {
+        munmap(map, len);
+        return NULL;
+    }
+    s->map = map;
+    s->map_len = len;
+    return s;
+}
+
+void snapshot_close(struct QSnapshot *s) {
+    if (!s)
+        return;
+    if (s->map)
+        munmap(s->map, s->map_len);
+    free(s);
+}
+
+/* Children always come after their parent in preorder. Anything else
+ * is treated as a missing child, which also rules out cycles in a
+ * corrupted file. */
+static const struct QSnapshotNode *snapshot_child(const struct QSnapshot *s,
+                                                  uint64_t parent,
+                                                  uint64_t child) {
+    if (child <= parent || child >= s->hdr->num_nodes)
+        return NULL;
+    return &s->nodes[child];
+}
+
+static size_t snapshot_index(const struct QSnapshot *s,
+                             const struct QSnapshotNode *n) {
+    return (size_t)(n - s->nodes);
+}
+
+/* Same traversal as postorder_by_rank(), over node indices */
+static size_t snapshot_postorder_by_rank(const struct QSnapshot *s,
+                                         const struct QSnapshotNode *n,
+                                         size_t *curr_rank, size_t req_rank) {
+    if (!n)
+        return 0;
+    size_t idx = snapshot_index(s, n);
+    size_t val = snapshot_postorder_by_rank(s, snapshot_child(s, idx, n->left),
+                                            curr_rank, req_rank);
+    if (*curr_rank >= req_rank)
+        return val;
+    val = snapshot_postorder_by_rank(s, snapshot_child(s, idx, n->right),
+                                     curr_rank, req_rank);
+    if (*curr_rank >= req_rank)
+        return val;
+
+    val = n->upper_bound;
+    *curr_rank += n->count;
+    return val;
+}
+
+size_t snapshot_percentile(const struct QSnapshot *s, double p) {
+    if (p <= 0.0) p = 0.0;
+    if (p >= 1.0) p = 1.0;
+    size_t curr_rank = 0;
+    size_t req_rank;
+    if (s->hdr->N <= ((uint64_t)1 << 53)) {
+        req_rank = p * s->hdr->N;
+    } else {
+        const uint64_t den = (uint64_t)1 << 53;
+        req_rank = mul_div_floor(s->hdr->N, (uint64_t)(p * den), den);
+    }
+    return snapshot_postorder_by_rank(s, &s->nodes[0], &curr_rank, req_rank);
+}
+
+size_t snapshot_rank(const struct QSnapshot *s, size_t value) {
+    size_t r = 0;
+    const struct QSnapshotNode *n = &s->nodes[0];
+    while (n) {
+        if (n->upper_bound <= value) {
+            r += n->subtree_count;
+            break;
+        }
+        if (value < n->lower_bound)
+            break;
+        size_t idx = snapshot_index(s, n);
+        size_t mid = n->lower_bound + (n->upper_bound - n->lower_bound) / 2;
+        if (value <= mid) {
+            n = snapshot_child(s, idx, n->left);
+        } else {
+            const struct QSnapshotNode *l = snapshot_child(s, idx, n->left);
+            if (l)
+                r += l->subtree_count;
+            n = snapshot_child(s, idx, n->right);
+        }
+    }
+    return r;
+}
+
+static void snapshot_postorder_cdf(const struct QSnapshot *s,
+                                   const struct QSnapshotNode *n,
+                                   struct CdfCursor *c) {
+    if (!n)
+        return;
+    size_t idx = snapshot_index(s, n);
+    snapshot_postorder_cdf(s, snapshot_child(s, idx, n->left), c);
+    snapshot_postorder_cdf(s, snapshot_child(s, idx, n->right), c);
+    cdf_visit(c, n->upper_bound, n->count);
+}
+
+size_t snapshot_export_cdf(const struct QSnapshot *s, size_t *bounds,
+                           size_t *cum_counts, size_t max_buckets) {
+    if (max_buckets == 0 || s->hdr->N == 0)
+        return 0;
+    struct CdfCursor c;
+    cdf_init(&c, bounds, cum_counts, max_buckets, s->hdr->N,
+             s->hdr->num_nodes);
+    snapshot_postorder_cdf(s, &s->nodes[0], &c);
+    return c.len;
+}
+
+static struct QDigestNode *snapshot_to_tree(const struct QSnapshot *s,
+                                            const struct QSnapshotNode *n,
+                                            struct QDigestNode *parent,
+                                            struct NodePool *pool,
+                                            size_t *num_nodes) {
+    if (!n)
+        return NULL;
+    size_t idx = snapshot_index(s, n);
+    struct QDigestNode *ret = pool_alloc(pool, n->lower_bound, n->upper_bound);
+    ret->count = n->count;
+    ret->subtree_count = n->subtree_count;
+    ret->parent = parent;
+    (*num_nodes)++;
+    ret->left = snapshot_to_tree(s, snapshot_child(s, idx, n->left), ret,
+                                 pool, num_nodes);
+    ret->right = snapshot_to_tree(s, snapshot_child(s, idx, n->right), ret,
+                                  pool, num_nodes);
+    return ret;
+}
+
+struct QDigest *snapshot_thaw(const struct QSnapshot *s) {
+    return snapshot_thaw_pooled(s, NULL);
+}
+
+struct QDigest *snapshot_thaw_pooled(const struct QSnapshot *s,
+                                     struct NodePool *pool) {
+    size_t num_nodes = 0;
+    struct QDigestNode *root = snapshot_to_tree(s, &s->nodes[0], NULL, pool,
+                                                &num_nodes);
+    struct QDigest *q = create_q(root, num_nodes, s->hdr->N, s->hdr->K, 0);
+    q->pool = pool;
+    return q;
+}
+
+struct QMapped *mapped_open(const char *path) {
+    struct QSnapshot *s = snapshot_open(path);
+    if (!s)
+        return NULL;
+    struct QMapped *m = xmalloc(sizeof(struct QMapped));
+    m->snap = s;
+    m->q = NULL;
+    return m;
+}
+
+struct QDigest *mapped_digest(struct QMapped *m) {
+    if (!m->q) {
+        m->q = snapshot_thaw(m->snap);
+        snapshot_close(m->snap);
+        m->snap = NULL;
+    }
+    return m->q;
+}
+
+void mapped_insert(struct QMapped *m, size_t key, unsigned int count) {
+    insert(mapped_digest(m), key, count, true);
+}
+
+size_t mapped_percentile(struct QMapped *m, double p) {
+    return m->q ? percentile(m->q, p) : snapshot_percentile(m->snap, p);
+}
+
+size_t mapped_rank(struct QMapped *m, size_t value) {
+    return m->q ? rank(m->q, value) : snapshot_rank(m->snap, value);
+}
+
+void mapped_close(struct QMapped *m) {
+    if (m->q)
+        delete_qdigest(m->q);
+    snapshot_close(m->snap);
+    free(m);
+}
@@ -0,0 +1,314 @@
+#include "../include/qstore.h"
+#include "../include/memory_utils.h"
+#include "../include/node_pool.h"
+#include "../include/qcore.h"
+#include "../include/qpack.h"
+#include "../include/qsnapshot.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STORE_INITIAL_CAPACITY 16
+
+/* 64-bit FNV-1a */
+static uint64_t hash_key(const char *key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *key; key++) {
+        h ^= (unsigned char)*key;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static void init_shard(struct QStoreShard *sh, size_t capacity) {
+    sh->entries = xmalloc(capacity * sizeof(struct QStoreEntry));
+    for (size_t i = 0; i < capacity; i++)
+        sh->entries[i].key = NULL;
+    sh->capacity = capacity;
+    sh->len = 0;
+}
+
+struct QDigestStore *create_store(size_t n_shards, size_t K,
+                                  size_t upper_bound) {
+    assert(n_shards > 0);
+    struct QDigestStore *s = xmalloc(sizeof(struct QDigestStore));
+    s->shards = xmalloc(n_shards * sizeof(struct QStoreShard));
+    s->n_shards = n_shards;
+    s->K = K;
+    s->upper_bound = upper_bound;
+    for (size_t i = 0; i < n_shards; i++) {
+        init_shard(&s->shards[i], STORE_INITIAL_CAPACITY);
+        s->shards[i].pool = create_pool(STORE_SLAB_NODES);
+    }
+    return s;
+}
+
+void delete_store(struct QDigestStore *s) {
+    for (size_t i = 0; i < s->n_shards; i++) {
+        struct QStoreShard *sh = &s->shards[i];
+        for (size_t j = 0; j < sh->capacity; j++) {
+            if (sh->entries[j].key)
+                free(sh->entries[j].q.log.tombstones);
+            free(sh->entries[j].key);
+        }
+        free(sh->entries);
+        // the nodes of every digest go away with the slabs
+        delete_pool(sh->pool);
+    }
+    free(s->shards);
+    free(s);
+}
+
+size_t store_size(const struct QDigestStore *s) {
+    size_t n = 0;
+    for (size_t i = 0; i < s->n_shards; i++)
+        n += s->shards[i].len;
+    return n;
+}
+
+static struct QStoreShard *shard_of(const struct QDigestStore *s, uint64_t h) {
+    return &s->shards[h % s->n_shards];
+}
+
+/* Returns the slot holding key, or the empty slot where it would go */
+static struct QStoreEntry *probe(const struct QStoreShard *sh, const char *key,
+                                 uint64_t h) {
+    size_t mask = sh->capacity - 1;
+    for (size_t i = (size_t)(h >> 17) & mask;; i = (i + 1) & mask) {
+        struct QStoreEntry *e = &sh->entries[i];
+        if (!e->key || (e->hash == h && strcmp(e->key, key) == 0))
+            return e;
+    }
+}
+
+/* Doubles the table. Digest headers are moved by value: no node points
+ * back to its header, so the trees are untouched. */
+static void grow_shard(struct QStoreShard *sh) {
+    struct QStoreEntry *old = sh->entries;
+    size_t old_capacity = sh->capacity;
+    size_t len = sh->len;
+    init_shard(sh, old_capacity * 2);
+    sh->len = len;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].key)
+            *probe(sh, old[i].key, old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+struct QDigest *store_get(struct QDigestStore *s, const char *key) {
+    uint64_t h = hash_key(key);
+    struct QStoreEntry *e = probe(shard_of(s, h), key, h);
+    return e->key ? &e->q : NULL;
+}
+
+struct QDigest *store_get_or_create(struct QDigestStore *s, const char *key) {
+    uint64_t h = hash_key(key);
+    struct QStoreShard *sh = shard_of(s, h);
+    struct QStoreEntry *e = probe(sh, key, h);
+    if (e->key)
+        return &e->q;
+
+    // keep the load factor below 3/4
+    if (4 * (sh->len + 1) > 3 * sh->capacity) {
+        grow_shard(sh);
+        e = probe(sh, key, h);
+    }
+    size_t key_len = strlen(key);
+    e->key = xmalloc(key_len + 1);
+    memcpy(e->key, key, key_len + 1);
+    e->hash = h;
+    init_q(&e->q, s->K, s->upper_bound, sh->pool);
+    sh->len++;
+    return &e->q;
+}
+
+void store_insert(struct QDigestStore *s, const char *key, size_t value,
+                  unsigned int count) {
+    insert(store_get_or_create(s, key), value, count, true);
+}
+
+static void merge_shard(struct QDigestStore *dst, const struct QStoreShard *src) {
+    for (size_t j = 0; j < src->capacity; j++) {
+        const struct QStoreEntry *e = &src->entries[j];
+        if (e->key)
+            merge(store_get_or_create(dst, e->key), &e->q);
+    }
+}
+
+void store_merge(struct QDigestStore *dst, const struct QDigestStore *src) {
+    if (dst->n_shards != src->n_shards) {
+        // keys of a source shard are spread over every destination shard
+        for (size_t i = 0; i < src->n_shards; i++)
+            merge_shard(dst, &src->shards[i]);
+        return;
+    }
+    // a key lands in shard i of both stores: shards are independent
+    const long n_shards = (long)src->n_shards;
+#pragma omp parallel for schedule(dynamic)
+    for (long i = 0; i < n_shards; i++)
+        merge_shard(dst, &src->shards[i]);
+}
+
+/* Every record is: key length, snapshot length, padded key, snapshot */
+static size_t record_size(const struct QStoreEntry *e) {
+    return 2 * sizeof(uint64_t) + pad8(strlen(e->key)) + snapshot_size(&e->q);
+}
+
+size_t store_serialized_size(const struct QDigestStore *s) {
+    size_t len = sizeof(struct QStoreHeader);
+    for (size_t i = 0; i < s->n_shards; i++) {
+        const struct QStoreShard *sh = &s->shards[i];
+        for (size_t j = 0; j < sh->capacity; j++) {
+            if (sh->entries[j].key)
+                len += record_size(&sh->entries[j]);
+        }
+    }
+    return len;
+}
+
+size_t store_serialize(const struct QDigestStore *s, void *buf) {
+    struct QStoreHeader *hdr = buf;
+    memcpy(hdr->magic, STORE_MAGIC, sizeof(hdr->magic));
+    hdr->byte_order = SNAPSHOT_BYTE_ORDER;
+    hdr->n_shards = s->n_shards;
+    hdr->K = s->K;
+    hdr->upper_bound = s->upper_bound;
+    hdr->n_entries = store_size(s);
+
+    char *out = (char *)(hdr + 1);
+    for (size_t i = 0; i < s->n_shards; i++) {
+        const struct QStoreShard *sh = &s->shards[i];
+        for (size_t j = 0; j < sh->capacity; j++) {
+            const struct QStoreEntry *e = &sh->entries[j];
+            if (!e->key)
+                continue;
+            uint64_t *lens = (uint64_t *)out;
+            size_t key_len = strlen(e->key);
+            lens[0] = key_len;
+            lens[1] = snapshot_size(&e->q);
+            out += 2 * sizeof(uint64_t);
+            memset(out, 0, pad8(key_len));
+            memcpy(out, e->key, key_len);
+            out += pad8(key_len);
+            out += snapshot_encode(&e->q, out);
+        }
+    }
+    return (size_t)(out - (char *)buf);
+}
+
+struct QDigestStore *store_deserialize(const void *buf, size_t len) {
+    const struct QStoreHeader *hdr = buf;
+    if (len < sizeof(struct QStoreHeader) ||
+        memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->byte_order != SNAPSHOT_BYTE_ORDER || hdr->n_shards == 0)
+        return NULL;
+
+    struct QDigestStore *s = create_store(hdr->n_shards, hdr->K,
+                                          hdr->upper_bound);
+    const char *in = (const char *)(hdr + 1);
+    const char *end = (const char *)buf + len;
+    // room for a NUL-terminated copy of the current key
+    size_t key_cap = 64;
+    char *key = xmalloc(key_cap);
+    for (uint64_t n = 0; n < hdr->n_entries; n++) {
+        if ((size_t)(end - in) < 2 * sizeof(uint64_t))
+            goto malformed;
+        const uint64_t *lens = (const uint64_t *)in;
+        size_t key_len = lens[0], snap_len = lens[1];
+        in += 2 * sizeof(uint64_t);
+        // bound the lengths first: pad8 wraps for lengths near SIZE_MAX
+        if (key_len > (size_t)(end - in) || snap_len > (size_t)(end - in) ||
+            (size_t)(end - in) < pad8(key_len) ||
+            (size_t)(end - in) - pad8(key_len) < snap_len)
+            goto malformed;
+
+        if (key_len + 1 > key_cap) {
+            key_cap = key_len + 1;
+            free(key);
+            key = xmalloc(key_cap);
+        }
+        memcpy(key, in, key_len);
+        key[key_len] = '\0';
+        in += pad8(key_len);
+
+        struct QSnapshot *snap = snapshot_view(in, snap_len);
+        if (!snap)
+            goto malformed;
+        in += snap_len;
+
+        // replace the empty digest of the new key by the thawed one
+        struct QDigest *q = store_get_or_create(s, key);
+        pool_free_tree(q->pool, q->root);
+        struct QDigest *thawed = snapshot_thaw_pooled(snap, q->pool);
+        *q = *thawed;
+        free(thawed);
+        snapshot_close(snap);
+    }
+    free(key);
+    return s;
+
+malformed:
+    free(key);
+    delete_store(s);
+    return NULL;
+}
+
+int store_save(const struct QDigestStore *s, const char *path) {
+    size_t raw_len = store_serialized_size(s);
+    void *raw = xmalloc(raw_len);
+    store_serialize(s, raw);
+    void *buf = xmalloc(pack_bound(raw_len));
+    size_t len = pack(raw, raw_len, buf, PACK_DEFAULT_THRESHOLD);
+    free(raw);
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        free(buf);
+        return -1;
+    }
+    size_t written = fwrite(buf, 1, len, f);
+    int rc = (fclose(f) == 0 && written == len) ? 0 : -1;
+    free(buf);
+    return rc;
+}
+
+struct QDigestStore *store_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    long size = ftell(f);
+    if (size <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    void *buf = xmalloc((size_t)size);
+    size_t got = fread(buf, 1, (size_t)size, f);
+    fclose(f);
+
+    struct QDigestStore *s = NULL;
+    if (got == (size_t)size && is_packed(buf, got)) {
+        size_t raw_len;
+        void *raw = unpack_alloc(buf, got, &raw_len);
+        if (raw)
+            s = store_deserialize(raw, raw_len);
+        free(raw);
+    } else if (got == (size_t)size) {
+        // files written before packing was introduced
+        s = store_deserialize(buf, got);
+    }
+    free(buf);
+    return s;
+}
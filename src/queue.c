@@ -2,44 +2,69 @@
 #include "../include/memory_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef TESTQUEUE
 #include "../include/qcore.h"
 #endif
 
-struct queueNode *create_queue_node(Item val) {
-  struct queueNode *res = (struct queueNode *)xmalloc(sizeof(struct queueNode));
-  res->val = val;
-  // res->prev = NULL;
-  res->next = NULL;
-  return res;
-}
-
 struct queue *create_queue(void) {
   struct queue *q = xmalloc(sizeof(struct queue));
-  q->first = NULL;
-  q->last = NULL;
+  q->items = xmalloc(QUEUE_INITIAL_CAPACITY * sizeof(Item));
+  q->head = 0;
   q->len = 0;
+  q->capacity = QUEUE_INITIAL_CAPACITY;
 
   return q;
 }
 
 bool is_empty(struct queue *q) { return (q->len == 0); }
 
-void push(struct queue *q, struct queueNode *n) {
-  // in case list is empty
-  if (is_empty(q)) {
-    q->first = q->last = n;
-  } else {
-    // get the current last node and assign its next pointer to the new element
-    q->last->next = n;
-    // now last points to the newest node
-    q->last = n;
-  }
+/* Copies n items out of the ring starting at index from, which may wrap */
+static void copy_out(const struct queue *q, size_t from, Item *out, size_t n) {
+  size_t first = q->capacity - from;
+  if (first > n)
+    first = n;
+  memcpy(out, q->items + from, first * sizeof(Item));
+  memcpy(out + first, q->items, (n - first) * sizeof(Item));
+}
+
+/* Grows the ring to hold at least min_capacity items. The items are
+ * moved to the start of the new buffer. */
+static void reserve(struct queue *q, size_t min_capacity) {
+  if (min_capacity <= q->capacity)
+    return;
+  size_t capacity = q->capacity;
+  while (capacity < min_capacity)
+    capacity *= 2;
+  Item *items = xmalloc(capacity * sizeof(Item));
+  copy_out(q, q->head, items, q->len);
+  free(q->items);
+  q->items = items;
+  q->head = 0;
+  q->capacity = capacity;
+}
+
+void push(struct queue *q, Item val) {
+  if (q->len == q->capacity)
+    reserve(q, q->len + 1);
+  // the capacity is a power of two, so the mask wraps the index
+  q->items[(q->head + q->len) & (q->capacity - 1)] = val;
   (q->len)++;
 }
 
-Item front(struct queue *q) { return q->first->val; }
+void push_n(struct queue *q, const Item *vals, size_t n) {
+  reserve(q, q->len + n);
+  size_t tail = (q->head + q->len) & (q->capacity - 1);
+  size_t first = q->capacity - tail;
+  if (first > n)
+    first = n;
+  memcpy(q->items + tail, vals, first * sizeof(Item));
+  memcpy(q->items, vals + first, (n - first) * sizeof(Item));
+  q->len += n;
+}
+
+Item front(struct queue *q) { return q->items[q->head]; }
 
 Item pop(struct queue *q) {
   if (q->len == 0) {
@@ -47,25 +72,30 @@ Item pop(struct queue *q) {
     exit(EXIT_FAILURE);
   }
 
-  struct queueNode *old_first = q->first;
-  Item ret = old_first->val;
+  Item ret = q->items[q->head];
 
-  // Move head pointer forward
-  q->first = old_first->next;
+  // Move head forward
+  q->head = (q->head + 1) & (q->capacity - 1);
   (q->len)--;
 
-  // If queue becomes empty, update last too
-  if (q->first == NULL)
-    q->last = NULL;
-
-  free(old_first);
   return ret;
 }
 
+size_t pop_n(struct queue *q, Item *out, size_t max) {
+  size_t n = q->len < max ? q->len : max;
+  copy_out(q, q->head, out, n);
+  q->head = (q->head + n) & (q->capacity - 1);
+  q->len -= n;
+  return n;
+}
+
+void clear_queue(struct queue *q) {
+  q->head = 0;
+  q->len = 0;
+}
+
 void delete_queue(struct queue *q) {
-  while (!is_empty(q)) {
-    pop(q);
-  }
+  free(q->items);
   free(q);
 }
 
@@ -77,29 +107,44 @@ int main(void) {
   qdn->upper_bound = 65;
   qdn1->upper_bound = 100;
   qdn2->upper_bound = 1003;
-  struct queueNode *n = create_queue_node(qdn);
-  struct queueNode *n1 = create_queue_node(qdn1);
-  struct queueNode *n2 = create_queue_node(qdn2);
   struct queue *q = create_queue();
 
-#if 0
-  printf("is queue empty %d\n", is_empty(q));
-  push(q, n);
-  printf("is queue empty %d\n", is_empty(q));
-
-  printf("The upper bound from the popped value is %lu\n",
-         front(q)->upper_bound);
-  printf("is queue empty %d\n", is_empty(q));
-  printf("The upper bound from the popped value is %lu\n", pop(q)->upper_bound);
-  printf("is queue empty %d\n", is_empty(q));
-#endif
-  push(q, n);
-  push(q, n1);
-  push(q, n2);
+  push(q, qdn);
+  push(q, qdn1);
+  push(q, qdn2);
 
   while (q->len > 0) {
     printf("The popped value is: %lu\n", pop(q)->upper_bound);
   }
+
+  // wrap around the ring and grow it while it wraps
+  Item vals[4] = {qdn, qdn1, qdn2, qdn};
+  Item batch[8];
+  size_t popped = 0;
+  for (size_t round = 0; round < 100; round++) {
+    push_n(q, vals, 3);
+    push(q, vals[3]);
+    popped += pop_n(q, batch, round % 5);
+  }
+  printf("Pushed 400 values, popped %zu, %zu left, capacity %zu\n", popped,
+         q->len, q->capacity);
+  // every pop_n() takes what the rounds pushed, in order
+  for (size_t n, i = popped; (n = pop_n(q, batch, 8)) > 0;) {
+    for (size_t j = 0; j < n; j++, i++) {
+      if (batch[j] != vals[i % 4]) {
+        fprintf(stderr, "Ring buffer lost the order of its items\n");
+        return 1;
+      }
+    }
+  }
+  push(q, qdn1);
+  clear_queue(q);
+  printf("is queue empty after clear %d\n", is_empty(q));
+
+  delete_queue(q);
+  free(qdn);
+  free(qdn1);
+  free(qdn2);
   return 0;
 }
 #endif
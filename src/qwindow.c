@@ -0,0 +1,120 @@
+#include "../include/qwindow.h"
+#include "../include/memory_utils.h"
+#include "../include/qcore.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Maps the i-th live bucket (0 is the oldest) to its ring slot */
+static size_t window_slot(const struct QWindow *w, size_t i) {
+    return (w->head + i) % w->capacity;
+}
+
+struct QWindow *create_window(size_t n_buckets, size_t K, size_t upper_bound) {
+    assert(n_buckets > 0);
+    struct QWindow *w = xmalloc(sizeof(struct QWindow));
+    w->buckets = xmalloc(n_buckets * sizeof(struct QDigest *));
+    w->suffix = xmalloc(n_buckets * sizeof(struct QDigest *));
+    for (size_t i = 0; i < n_buckets; i++) {
+        w->buckets[i] = NULL;
+        w->suffix[i] = NULL;
+    }
+    w->capacity = n_buckets;
+    w->K = K;
+    w->upper_bound = upper_bound;
+    w->head = 0;
+    w->len = 1;
+    w->front_len = 0;
+    w->buckets[0] = create_tmp_q(K, upper_bound);
+    w->back = create_tmp_q(K, upper_bound);
+    return w;
+}
+
+void delete_window(struct QWindow *w) {
+    for (size_t i = 0; i < w->capacity; i++) {
+        if (w->buckets[i])
+            delete_qdigest(w->buckets[i]);
+        if (w->suffix[i])
+            delete_qdigest(w->suffix[i]);
+    }
+    delete_qdigest(w->back);
+    free(w->buckets);
+    free(w->suffix);
+    free(w);
+}
+
+struct QDigest *window_current(struct QWindow *w) {
+    return w->buckets[window_slot(w, w->len - 1)];
+}
+
+void window_insert(struct QWindow *w, size_t key, unsigned int count) {
+    insert(window_current(w), key, count, true);
+}
+
+/* Moves every sealed bucket of the back stack to the front stack and
+ * rebuilds the suffix merges from the youngest to the oldest. */
+static void window_flip(struct QWindow *w, size_t n_sealed) {
+    struct QDigest *acc = NULL;
+    for (size_t i = n_sealed; i-- > 0;) {
+        size_t slot = window_slot(w, i);
+        struct QDigest *s = acc ? clone_qdigest(acc)
+                                : create_tmp_q(w->K, w->upper_bound);
+        merge(s, w->buckets[slot]);
+        w->suffix[slot] = s;
+        acc = s;
+    }
+    w->front_len = n_sealed;
+    delete_qdigest(w->back);
+    w->back = create_tmp_q(w->K, w->upper_bound);
+}
+
+/* Expire the oldest bucket, given how many live buckets are sealed */
+static void window_drop_oldest(struct QWindow *w, size_t n_sealed) {
+    if (n_sealed == 0)
+        return;
+    if (w->front_len == 0)
+        window_flip(w, n_sealed);
+
+    size_t slot = w->head;
+    delete_qdigest(w->buckets[slot]);
+    delete_qdigest(w->suffix[slot]);
+    w->buckets[slot] = NULL;
+    w->suffix[slot] = NULL;
+    w->head = (w->head + 1) % w->capacity;
+    w->len--;
+    w->front_len--;
+}
+
+void window_expire(struct QWindow *w) {
+    window_drop_oldest(w, w->len - 1);
+}
+
+void window_advance(struct QWindow *w) {
+    // seal the current bucket into the back stack
+    merge(w->back, window_current(w));
+    if (w->len == w->capacity)
+        window_drop_oldest(w, w->len);
+
+    w->buckets[window_slot(w, w->len)] = create_tmp_q(w->K, w->upper_bound);
+    w->len++;
+}
+
+struct QDigest *window_merged(struct QWindow *w) {
+    struct QDigest *res;
+    if (w->front_len > 0) {
+        res = clone_qdigest(w->suffix[w->head]);
+        merge(res, w->back);
+    } else {
+        res = clone_qdigest(w->back);
+    }
+    merge(res, window_current(w));
+    return res;
+}
+
+size_t window_percentile(struct QWindow *w, double p) {
+    struct QDigest *q = window_merged(w);
+    size_t ret = (q->N == 0) ? 0 : percentile(q, p);
+    delete_qdigest(q);
+    return ret;
+}